@@ -0,0 +1,75 @@
+/**
+ * arena.c
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+	ArenaBlock* next;
+};
+
+Arena* arenaInit(unsigned long blockSize) {
+	Arena* arena;
+
+	arena				= (Arena *) malloc(sizeof(Arena));
+	arena->blocks		= NULL;
+	arena->current		= NULL;
+	arena->available	= 0;
+	arena->blockSize	= blockSize;
+
+	return arena;
+}
+
+/* Memory is not aligned, the arena is meant for strings. */
+void* arenaAlloc(Arena* arena, unsigned long size) {
+	ArenaBlock* block;
+	unsigned long blockSize;
+	char* returnAddress;
+
+	if (size > arena->available) {
+		/* Oversized requests get a block of their own. */
+		blockSize = size > arena->blockSize ? size : arena->blockSize;
+
+		block = (ArenaBlock *) malloc(sizeof(ArenaBlock) + blockSize);
+		if (block == NULL) {
+			return NULL;
+		}
+
+		block->next			= arena->blocks;
+		arena->blocks		= block;
+		arena->current		= (char*) (block + 1);
+		arena->available	= blockSize;
+	}
+
+	returnAddress		= arena->current;
+	arena->current		+= size;
+	arena->available	-= size;
+
+	return returnAddress;
+}
+
+/* Copies size bytes and adds a terminator. */
+char* arenaCopy(Arena* arena, const char* string, unsigned long size) {
+	char* copy = (char*) arenaAlloc(arena, size + 1);
+
+	if (copy != NULL) {
+		memcpy(copy, string, size);
+		copy[size] = 0;
+	}
+
+	return copy;
+}
+
+void arenaDestroy(Arena* arena) {
+	ArenaBlock* block;
+
+	while (arena->blocks != NULL) {
+		block			= arena->blocks;
+		arena->blocks	= block->next;
+		free(block);
+	}
+
+	free(arena);
+}
@@ -0,0 +1,24 @@
+/**
+ * arena.h
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+typedef struct ArenaBlock ArenaBlock;
+
+/* Bump allocator: memory is handed out from large blocks and only released all at once. */
+typedef struct {
+	ArenaBlock* blocks;
+	char* current;
+	unsigned long available;
+	unsigned long blockSize;
+} Arena;
+
+Arena*	arenaInit(unsigned long blockSize);
+void*	arenaAlloc(Arena* arena, unsigned long size);
+char*	arenaCopy(Arena* arena, const char* string, unsigned long size);
+void	arenaDestroy(Arena* arena);
+
+
+#endif /* ARENA_H_ */
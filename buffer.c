@@ -1,10 +1,27 @@
 /**
  * buffer.c
+ *
+ * Buffers keep their capacity when they are reset and grow geometrically, so a buffer that is reused for every page
+ * settles at the size of the largest page and stops reallocating.
  */
 
+#define _DEFAULT_SOURCE
+
 #include "buffer.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Set once at startup, before any thread uses a buffer. */
+static int hugePages = 0;
+
+void bufferUseHugePages(int enable) {
+	hugePages = enable;
+}
 
 Buffer *bufferInit() {
 	char* buffer;
@@ -16,22 +33,89 @@ Buffer *bufferInit() {
 	bufferStruct->totalsize		= 1024;
 	bufferStruct->currentsize	= 0;
 	bufferStruct->buffer		= buffer;
-	
+	bufferStruct->mapped		= 0;
+
 	return bufferStruct;
 }
 
+/*
+Maps memory aligned to the huge page size, so the kernel can back it with huge pages right away.
+Returns NULL if that does not work out, the buffer then stays on the heap.
+*/
+static char* mapHuge(unsigned long size) {
+	char* memory;
+	char* aligned;
+	unsigned long misalignment;
+
+	memory = mmap(NULL, size + BUFFER_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+
+	/* Trim the mapping to an aligned range. */
+	misalignment	= (unsigned long) memory % BUFFER_HUGE_PAGE_SIZE;
+	aligned			= memory + (misalignment ? BUFFER_HUGE_PAGE_SIZE - misalignment : 0);
+	if (aligned > memory) {
+		munmap(memory, aligned - memory);
+	}
+	munmap(aligned + size, memory + size + BUFFER_HUGE_PAGE_SIZE - (aligned + size));
+
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+	return aligned;
+}
+
+static void release(Buffer* buffer) {
+	if (buffer->mapped) {
+		munmap(buffer->buffer, buffer->totalsize);
+	}
+	else {
+		free(buffer->buffer);
+	}
+}
+
 void bufferAllocate(Buffer* buffer, unsigned long size) {
+	unsigned long totalsize;
+	char* memory;
+
 	if ((size + buffer->currentsize) > buffer->totalsize) {
-		/* Reallocate at least the required memory needed. */
-		unsigned long memoryNeeded = size+buffer->currentsize-buffer->totalsize;
+		/* Double the buffer, or more if that is not enough. */
+		totalsize = buffer->totalsize * 2;
+		if (totalsize < size + buffer->currentsize) {
+			totalsize = size + buffer->currentsize;
+		}
 
 		/* Round it to the upper 1K. */
-		memoryNeeded += (memoryNeeded % 1024) ? 1024 : 0;
-		memoryNeeded = memoryNeeded & ~1023;
-		buffer->totalsize += memoryNeeded;
-
-		/* Reallocate the buffer to totalsize+memoryNeeded. */
-		buffer->buffer = (char *) realloc(buffer->buffer, buffer->totalsize);
+		totalsize = (totalsize + 1023) & ~1023UL;
+
+		if (hugePages && totalsize >= BUFFER_HUGE_PAGE_SIZE) {
+			totalsize	= (totalsize + BUFFER_HUGE_PAGE_SIZE - 1) & ~(BUFFER_HUGE_PAGE_SIZE - 1UL);
+			memory		= mapHuge(totalsize);
+			if (memory != NULL) {
+				memcpy(memory, buffer->buffer, buffer->currentsize);
+				release(buffer);
+
+				buffer->buffer		= memory;
+				buffer->totalsize	= totalsize;
+				buffer->mapped		= 1;
+				return;
+			}
+		}
+
+		if (buffer->mapped) {
+			memory = (char *) malloc(totalsize);
+			memcpy(memory, buffer->buffer, buffer->currentsize);
+			release(buffer);
+			buffer->buffer = memory;
+			buffer->mapped = 0;
+		}
+		else {
+			buffer->buffer = (char *) realloc(buffer->buffer, totalsize);
+		}
+
+		buffer->totalsize = totalsize;
 	}
 }
 
@@ -51,19 +135,14 @@ char* bufferAdd(Buffer* buffer, const char* string, unsigned long size) {
 	return returnAddress;
 }
 
+/* Empties the buffer, its memory is kept for reuse. */
 Buffer* bufferReset(Buffer* buffer) {
-	if (buffer->totalsize != 1024) {
-		free(buffer->buffer);
-		buffer->buffer		= (char*) malloc(1024);
-		buffer->totalsize	= 1024;
-	}
-
 	buffer->currentsize	= 0;
 
 	return buffer;
 }
 
 void bufferDestroy(Buffer *buffer) {
-	free(buffer->buffer);
+	release(buffer);
 	free(buffer);
 }
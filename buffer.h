@@ -5,10 +5,15 @@
 #ifndef BUFFER_H_
 #define BUFFER_H_
 
+/* Buffers from this size on are backed by huge pages, if enabled. */
+#define BUFFER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 typedef struct {
 	unsigned long totalsize;
 	unsigned long currentsize;
 	char* buffer;
+	/* Set if the buffer is mapped instead of allocated. */
+	int mapped;
 } Buffer;
 
 Buffer*	bufferInit();
@@ -17,6 +22,7 @@ void	bufferAllocate(Buffer* buffer, unsigned long size);
 char*	bufferDetachBuffer(Buffer* buffer, unsigned int *bufferSize);
 void	bufferDestroy(Buffer* buffer);
 Buffer*	bufferReset(Buffer* buffer);
+void	bufferUseHugePages(int enable);
 
 
 #endif /* BUFFER_H_ */
@@ -0,0 +1,721 @@
+/**
+ * bzreader.c
+ *
+ * Decompresses a bzip2 file, optionally on several threads, and hands out the uncompressed data in order.
+ *
+ * The file is cut into chunks that can be decompressed independently:
+ * - With a multistream index, the chunks are groups of whole streams, starting at the offsets in the index.
+ * - Without an index, the file is scanned for the bit aligned block and end of stream signatures. Every block is then
+ *   wrapped into a stream of its own, with a stream header and an end of stream marker carrying the block CRC.
+ *   A signature can turn up by chance inside compressed data and split a block, whose first part then fails. Like
+ *   lbzip2, such a block is extended to the next signature and tried again, and the parts it swallows are skipped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "bzreader.h"
+#include "buffer.h"
+#include <bzlib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BLOCK_MAGIC 0x314159265359UL
+#define STREAM_END_MAGIC 0x177245385090UL
+#define MAGIC_MASK 0xffffffffffffUL
+
+/* Streams from the index are grouped until a chunk is at least this big. */
+#define MIN_CHUNK_SIZE (1024 * 1024)
+/* Output per call in single threaded mode. */
+#define SERIAL_OUTPUT_SIZE (1024 * 1024)
+/* A block compresses to at most about its 900k of input, a failing block is not extended beyond this. */
+#define MAX_BLOCK_BITS (1024 * 1024 * 8UL)
+/* Chunks in flight per thread. */
+#define CHUNKS_PER_THREAD 3
+
+#define NO_POSITION ((unsigned long) -1)
+
+#define CHUNK_FREE 0
+#define CHUNK_BUSY 1
+#define CHUNK_DONE 2
+#define CHUNK_ERROR 3
+
+typedef struct {
+	int state;
+	/* Compressed range in bits, either whole streams or a single block. */
+	unsigned long beginBit;
+	unsigned long endBit;
+	int isBlock;
+	Buffer* output;
+	/* Synthetic stream for blocks. */
+	Buffer* input;
+} BzChunk;
+
+struct BzReader {
+	int fd;
+	const unsigned char* data;
+	unsigned long size;
+
+	/* Range of the file to decompress, in bytes. */
+	unsigned long begin;
+	unsigned long end;
+
+	/* Stream offsets from the multistream index, NULL when scanning for blocks. */
+	unsigned long* offsets;
+	unsigned long amountOffsets;
+	unsigned long nextOffset;
+
+	/* Block scanning. */
+	unsigned long scanPosition;
+	unsigned long window;
+	unsigned long pendingBlock;
+
+	/* Single threaded mode. */
+	bz_stream stream;
+	int streamOpen;
+	unsigned long streamPosition;
+	char* serialOutput;
+
+	/* Multi threaded mode. */
+	unsigned int threads;
+	pthread_t* workers;
+	BzChunk* chunks;
+	unsigned long amountChunks;
+	unsigned long claimSequence;
+	unsigned long readSequence;
+	/* End of the last block handed out, blocks that start before it were merged into it. */
+	unsigned long readEndBit;
+	int holding;
+	int claimsDone;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t claimable;
+	pthread_cond_t decompressed;
+};
+
+/* Reads up to 57 bits starting at an arbitrary bit offset. */
+static unsigned long readBits(const BzReader* reader, unsigned long bit, unsigned int count) {
+	unsigned long value = 0;
+	unsigned long byte = bit >> 3;
+	unsigned int i;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < 8 && byte + i < reader->size; ++i) {
+		value |= (unsigned long) reader->data[byte + i] << (56 - 8 * i);
+	}
+
+	return (value << (bit & 7)) >> (64 - count);
+}
+
+/* Appends count bits, at most 32, to a zero initialised output. */
+static void writeBits(unsigned char* output, unsigned long* bit, unsigned long value, unsigned int count) {
+	unsigned int i;
+
+	for (i = 0; i < count; ++i, ++*bit) {
+		if ((value >> (count - 1 - i)) & 1) {
+			output[*bit >> 3] |= 0x80 >> (*bit & 7);
+		}
+	}
+}
+
+/*
+Finds the next block or end of stream signature. Every bit position is checked once: after shifting in a byte, the
+signatures ending in that byte are checked in order.
+*/
+static unsigned long findMagic(BzReader* reader, int* isBlock) {
+	unsigned long magic;
+	unsigned long end;
+	int shift;
+
+	while (reader->scanPosition < reader->end) {
+		reader->window = (reader->window << 8) | reader->data[reader->scanPosition++];
+
+		for (shift = 7; shift >= 0; --shift) {
+			end = reader->scanPosition * 8 - shift;
+			if (end < reader->begin * 8 + 48) {
+				continue;
+			}
+
+			magic = (reader->window >> shift) & MAGIC_MASK;
+			if (magic == BLOCK_MAGIC || magic == STREAM_END_MAGIC) {
+				*isBlock = magic == BLOCK_MAGIC;
+				return end - 48;
+			}
+		}
+	}
+
+	return NO_POSITION;
+}
+
+/* Start of the next block or end of stream signature from bit on, or the end of the range if there is none. */
+static unsigned long findMagicFrom(const BzReader* reader, unsigned long bit) {
+	unsigned long end = reader->end * 8;
+	unsigned long magic;
+
+	if (bit + 48 > end) {
+		return end;
+	}
+
+	magic = readBits(reader, bit, 48);
+	for (; bit + 48 <= end; ++bit) {
+		if (magic == BLOCK_MAGIC || magic == STREAM_END_MAGIC) {
+			return bit;
+		}
+
+		if (bit + 48 < end) {
+			magic = ((magic << 1) | ((reader->data[(bit + 48) >> 3] >> (7 - ((bit + 48) & 7))) & 1)) & MAGIC_MASK;
+		}
+	}
+
+	return end;
+}
+
+/* Determines the range of the next chunk. Returns 0 when the whole file has been handed out. */
+static int nextChunk(BzReader* reader, BzChunk* chunk) {
+	unsigned long begin;
+	unsigned long end;
+	unsigned long position;
+	int isBlock;
+
+	if (reader->offsets != NULL) {
+		if (reader->nextOffset >= reader->amountOffsets) {
+			return 0;
+		}
+
+		begin	= reader->offsets[reader->nextOffset++];
+		end		= reader->end;
+		while (reader->nextOffset < reader->amountOffsets) {
+			end = reader->offsets[reader->nextOffset];
+			if (end - begin >= MIN_CHUNK_SIZE) {
+				break;
+			}
+
+			end = reader->end;
+			++reader->nextOffset;
+		}
+
+		chunk->beginBit	= begin * 8;
+		chunk->endBit	= end * 8;
+		chunk->isBlock	= 0;
+		return 1;
+	}
+
+	/* Skip anything up to the first block, i.e. stream headers and end of stream markers. */
+	while (reader->pendingBlock == NO_POSITION) {
+		position = findMagic(reader, &isBlock);
+		if (position == NO_POSITION) {
+			return 0;
+		}
+
+		if (isBlock) {
+			reader->pendingBlock = position;
+		}
+	}
+
+	/* A block ends where the next block or the end of stream marker starts. */
+	chunk->beginBit	= reader->pendingBlock;
+	chunk->isBlock	= 1;
+
+	position = findMagic(reader, &isBlock);
+	if (position == NO_POSITION) {
+		chunk->endBit			= reader->end * 8;
+		reader->pendingBlock	= NO_POSITION;
+	}
+	else {
+		chunk->endBit			= position;
+		reader->pendingBlock	= isBlock ? position : NO_POSITION;
+	}
+
+	return 1;
+}
+
+/* Decompresses one or more consecutive streams completely. */
+static int decompressStreams(const char* input, unsigned long size, Buffer* output) {
+	bz_stream stream;
+	unsigned int available;
+	int result;
+
+	memset(&stream, 0, sizeof(stream));
+	if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+		return -1;
+	}
+
+	stream.next_in	= (char*) input;
+	stream.avail_in	= size;
+	output->currentsize = 0;
+
+	while (1) {
+		if (output->totalsize - output->currentsize < 65536) {
+			bufferAllocate(output, output->totalsize);
+		}
+
+		available			= output->totalsize - output->currentsize;
+		stream.next_out		= output->buffer + output->currentsize;
+		stream.avail_out	= available;
+
+		result = BZ2_bzDecompress(&stream);
+		output->currentsize += available - stream.avail_out;
+
+		if (result == BZ_STREAM_END) {
+			BZ2_bzDecompressEnd(&stream);
+			if (stream.avail_in == 0) {
+				return 0;
+			}
+
+			/* Concatenated stream. */
+			input	= stream.next_in;
+			size	= stream.avail_in;
+			memset(&stream, 0, sizeof(stream));
+			if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+				return -1;
+			}
+
+			stream.next_in	= (char*) input;
+			stream.avail_in	= size;
+		}
+		else if (result != BZ_OK || (stream.avail_in == 0 && stream.avail_out != 0)) {
+			/* Corrupt or truncated input. */
+			BZ2_bzDecompressEnd(&stream);
+			return -1;
+		}
+	}
+}
+
+static int decompressChunk(const BzReader* reader, BzChunk* chunk) {
+	unsigned long bits;
+	unsigned long bit;
+	unsigned long bytes;
+	unsigned long i;
+	unsigned int shift;
+	const unsigned char* source;
+	unsigned char* input;
+
+	if (!chunk->isBlock) {
+		return decompressStreams((const char*) reader->data + chunk->beginBit / 8,
+			(chunk->endBit - chunk->beginBit) / 8, chunk->output);
+	}
+
+	/* Stream header, the block, the end of stream marker with the stream CRC, which equals the block CRC. */
+	bits	= chunk->endBit - chunk->beginBit;
+	bytes	= 4 + (bits + 80 + 7) / 8;
+
+	bufferReset(chunk->input);
+	bufferAllocate(chunk->input, bytes);
+	input = (unsigned char*) chunk->input->buffer;
+	memset(input, 0, bytes);
+	memcpy(input, "BZh9", 4);
+
+	source	= reader->data + chunk->beginBit / 8;
+	shift	= chunk->beginBit & 7;
+	for (i = 0; i < bits / 8; ++i) {
+		input[4 + i] = shift ? (source[i] << shift) | (source[i + 1] >> (8 - shift)) : source[i];
+	}
+
+	bit = 32 + (bits & ~7UL);
+	writeBits(input, &bit, readBits(reader, chunk->beginBit + (bits & ~7UL), bits & 7), bits & 7);
+	writeBits(input, &bit, STREAM_END_MAGIC >> 24, 24);
+	writeBits(input, &bit, STREAM_END_MAGIC & 0xffffff, 24);
+	writeBits(input, &bit, readBits(reader, chunk->beginBit + 48, 32), 32);
+
+	return decompressStreams((const char*) input, bytes, chunk->output);
+}
+
+static void* bzWorker(void* data) {
+	BzReader* reader = (BzReader*) data;
+	BzChunk* chunk;
+	BzChunk range;
+	int result;
+
+	pthread_mutex_lock(&reader->lock);
+
+	while (1) {
+		while (!reader->stop && !reader->claimsDone && reader->claimSequence >= reader->readSequence + reader->amountChunks) {
+			pthread_cond_wait(&reader->claimable, &reader->lock);
+		}
+
+		if (reader->stop || reader->claimsDone) {
+			break;
+		}
+
+		if (!nextChunk(reader, &range)) {
+			reader->claimsDone = 1;
+			pthread_cond_broadcast(&reader->decompressed);
+			pthread_cond_broadcast(&reader->claimable);
+			break;
+		}
+
+		chunk			= &reader->chunks[reader->claimSequence++ % reader->amountChunks];
+		chunk->state	= CHUNK_BUSY;
+		chunk->beginBit	= range.beginBit;
+		chunk->endBit	= range.endBit;
+		chunk->isBlock	= range.isBlock;
+		pthread_mutex_unlock(&reader->lock);
+
+		result = decompressChunk(reader, chunk);
+
+		/* A block split by a signature in its data is whole again once it reaches the real next signature. */
+		while (result != 0 && chunk->isBlock && chunk->endBit < reader->end * 8 &&
+			chunk->endBit - chunk->beginBit < MAX_BLOCK_BITS) {
+			chunk->endBit	= findMagicFrom(reader, chunk->endBit + 1);
+			result			= decompressChunk(reader, chunk);
+		}
+
+		pthread_mutex_lock(&reader->lock);
+		chunk->state = result == 0 ? CHUNK_DONE : CHUNK_ERROR;
+		pthread_cond_broadcast(&reader->decompressed);
+	}
+
+	pthread_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+/* Collects the distinct stream offsets of a multistream index, lines look like offset:pageID:title. */
+static int readIndex(BzReader* reader, const char* indexPath) {
+	FILE* file;
+	BZFILE* compressed = NULL;
+	char buffer[65536];
+	int bytesRead;
+	int bzError = BZ_OK;
+	int i;
+	int inOffset = 1;
+	unsigned long offset = 0;
+	unsigned long capacity = 0;
+
+	file = fopen(indexPath, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	if (strlen(indexPath) > 4 && strcmp(indexPath + strlen(indexPath) - 4, ".bz2") == 0) {
+		compressed = BZ2_bzReadOpen(&bzError, file, 0, 0, NULL, 0);
+		if (compressed == NULL) {
+			fclose(file);
+			return -1;
+		}
+	}
+
+	/* The stream at offset 0 only holds the site info. */
+	reader->offsets			= malloc(sizeof(unsigned long) * 1024);
+	reader->offsets[0]		= reader->begin;
+	reader->amountOffsets	= 1;
+	capacity				= 1024;
+
+	while (1) {
+		if (compressed != NULL) {
+			bytesRead = BZ2_bzRead(&bzError, compressed, buffer, sizeof(buffer));
+			if (bzError != BZ_OK && bzError != BZ_STREAM_END) {
+				break;
+			}
+		}
+		else {
+			bytesRead = fread(buffer, 1, sizeof(buffer), file);
+		}
+
+		if (bytesRead <= 0) {
+			break;
+		}
+
+		for (i = 0; i < bytesRead; ++i) {
+			if (buffer[i] == '\n') {
+				inOffset	= 1;
+				offset		= 0;
+			}
+			else if (!inOffset) {
+				continue;
+			}
+			else if (buffer[i] >= '0' && buffer[i] <= '9') {
+				offset = offset * 10 + (buffer[i] - '0');
+			}
+			else {
+				inOffset = 0;
+
+				if (offset > reader->offsets[reader->amountOffsets - 1] && offset < reader->end) {
+					if (reader->amountOffsets == capacity) {
+						capacity		*= 2;
+						reader->offsets	= realloc(reader->offsets, sizeof(unsigned long) * capacity);
+					}
+
+					reader->offsets[reader->amountOffsets++] = offset;
+				}
+			}
+		}
+
+		if (compressed != NULL && bzError == BZ_STREAM_END) {
+			break;
+		}
+	}
+
+	if (compressed != NULL) {
+		BZ2_bzReadClose(&bzError, compressed);
+	}
+	fclose(file);
+
+	return 0;
+}
+
+/* Wikipedia publishes the index of pages-articles-multistream.xml.bz2 as pages-articles-multistream-index.txt.bz2. */
+static char* defaultIndexPath(const char* path) {
+	const char* suffix = "multistream.xml.bz2";
+	const char* indexSuffix = "multistream-index.txt.bz2";
+	unsigned long length = strlen(path);
+	char* indexPath;
+
+	if (length < strlen(suffix) || strcmp(path + length - strlen(suffix), suffix) != 0) {
+		return NULL;
+	}
+
+	indexPath = malloc(length - strlen(suffix) + strlen(indexSuffix) + 1);
+	memcpy(indexPath, path, length - strlen(suffix));
+	strcpy(indexPath + length - strlen(suffix), indexSuffix);
+
+	if (access(indexPath, R_OK) != 0) {
+		free(indexPath);
+		return NULL;
+	}
+
+	return indexPath;
+}
+
+/*
+Opens a bzip2 file, decompressing it with the given amount of threads. Zero threads decompresses serially in the
+calling thread. If no index is given, the multistream index next to the file is used when it exists.
+Only the streams between the byte offsets begin and end are decompressed, an end of 0 means the end of the file.
+*/
+BzReader* bzReaderOpen(const char* path, const char* indexPath, unsigned int threads, unsigned long begin,
+	unsigned long end) {
+	BzReader* reader;
+	struct stat status;
+	char* defaultIndex = NULL;
+	unsigned long i;
+
+	reader = calloc(1, sizeof(BzReader));
+	reader->pendingBlock = NO_POSITION;
+
+	reader->fd = open(path, O_RDONLY);
+	if (reader->fd < 0) {
+		free(reader);
+		return NULL;
+	}
+
+	if (fstat(reader->fd, &status) != 0) {
+		close(reader->fd);
+		free(reader);
+		return NULL;
+	}
+
+	reader->size			= status.st_size;
+	reader->end				= end == 0 || end > reader->size ? reader->size : end;
+	reader->begin			= begin > reader->end ? reader->end : begin;
+	reader->scanPosition	= reader->begin;
+	reader->streamPosition	= reader->begin;
+	if (reader->size > 0) {
+		reader->data = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+		if (reader->data == MAP_FAILED) {
+			close(reader->fd);
+			free(reader);
+			return NULL;
+		}
+	}
+
+	if (threads == 0) {
+		reader->serialOutput = malloc(SERIAL_OUTPUT_SIZE);
+		return reader;
+	}
+
+	if (indexPath == NULL) {
+		indexPath = defaultIndex = defaultIndexPath(path);
+	}
+
+	if (indexPath != NULL && readIndex(reader, indexPath) != 0) {
+		free(defaultIndex);
+		bzReaderClose(reader);
+		return NULL;
+	}
+	free(defaultIndex);
+
+	reader->amountChunks	= threads * CHUNKS_PER_THREAD;
+	reader->chunks			= calloc(reader->amountChunks, sizeof(BzChunk));
+	reader->workers			= malloc(sizeof(pthread_t) * threads);
+
+	for (i = 0; i < reader->amountChunks; ++i) {
+		reader->chunks[i].output	= bufferInit();
+		reader->chunks[i].input		= bufferInit();
+	}
+
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->claimable, NULL);
+	pthread_cond_init(&reader->decompressed, NULL);
+
+	reader->threads = threads;
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&reader->workers[i], NULL, bzWorker, reader) != 0) {
+			reader->threads = i;
+			bzReaderClose(reader);
+			return NULL;
+		}
+	}
+
+	return reader;
+}
+
+/* Decompresses the next part of the file, reading over the boundaries of concatenated streams. */
+static long serialRead(BzReader* reader, const char** data) {
+	int result;
+
+	reader->stream.next_out		= reader->serialOutput;
+	reader->stream.avail_out	= SERIAL_OUTPUT_SIZE;
+
+	while (reader->stream.avail_out != 0) {
+		if (!reader->streamOpen) {
+			if (reader->streamPosition >= reader->end) {
+				break;
+			}
+
+			memset(&reader->stream, 0, sizeof(reader->stream));
+			if (BZ2_bzDecompressInit(&reader->stream, 0, 0) != BZ_OK) {
+				return -1;
+			}
+
+			reader->streamOpen			= 1;
+			reader->stream.next_in		= (char*) reader->data + reader->streamPosition;
+			reader->stream.avail_in		= reader->end - reader->streamPosition;
+			reader->stream.next_out		= reader->serialOutput;
+			reader->stream.avail_out	= SERIAL_OUTPUT_SIZE;
+		}
+
+		result = BZ2_bzDecompress(&reader->stream);
+
+		if (result == BZ_STREAM_END) {
+			reader->streamPosition	= (const unsigned char*) reader->stream.next_in - reader->data;
+			reader->streamOpen		= 0;
+
+			/* Keep the output of the current call. */
+			*data = reader->serialOutput;
+			result = SERIAL_OUTPUT_SIZE - reader->stream.avail_out;
+			BZ2_bzDecompressEnd(&reader->stream);
+
+			if (result > 0) {
+				return result;
+			}
+		}
+		else if (result != BZ_OK || (reader->stream.avail_in == 0 && reader->stream.avail_out != 0)) {
+			return -1;
+		}
+	}
+
+	*data = reader->serialOutput;
+
+	return SERIAL_OUTPUT_SIZE - reader->stream.avail_out;
+}
+
+/* Size of the compressed file. */
+unsigned long bzReaderSize(const BzReader* reader) {
+	return reader->size;
+}
+
+/*
+Returns the next part of the uncompressed data, which stays valid until the next call.
+Returns 0 at the end of the file and -1 on corrupt input.
+*/
+long bzReaderRead(BzReader* reader, const char** data) {
+	BzChunk* chunk;
+	long size = 0;
+
+	if (reader->threads == 0) {
+		return serialRead(reader, data);
+	}
+
+	pthread_mutex_lock(&reader->lock);
+
+	while (size == 0) {
+		if (reader->holding) {
+			reader->chunks[reader->readSequence++ % reader->amountChunks].state = CHUNK_FREE;
+			reader->holding = 0;
+			pthread_cond_broadcast(&reader->claimable);
+		}
+
+		chunk = &reader->chunks[reader->readSequence % reader->amountChunks];
+		while (chunk->state != CHUNK_DONE && chunk->state != CHUNK_ERROR &&
+			!(reader->claimsDone && reader->readSequence >= reader->claimSequence)) {
+			pthread_cond_wait(&reader->decompressed, &reader->lock);
+		}
+
+		/* Parts of a block that was merged, whether they failed on their own or not. */
+		if ((chunk->state == CHUNK_DONE || chunk->state == CHUNK_ERROR) && chunk->isBlock &&
+			chunk->beginBit < reader->readEndBit) {
+			reader->holding = 1;
+			continue;
+		}
+
+		if (chunk->state == CHUNK_ERROR) {
+			size = -1;
+			break;
+		}
+
+		if (chunk->state != CHUNK_DONE) {
+			break;
+		}
+
+		if (chunk->isBlock) {
+			reader->readEndBit = chunk->endBit;
+		}
+
+		reader->holding	= 1;
+		size			= chunk->output->currentsize;
+		*data			= chunk->output->buffer;
+	}
+
+	pthread_mutex_unlock(&reader->lock);
+
+	return size;
+}
+
+void bzReaderClose(BzReader* reader) {
+	unsigned long i;
+
+	if (reader->threads > 0) {
+		pthread_mutex_lock(&reader->lock);
+		reader->stop = 1;
+		pthread_cond_broadcast(&reader->claimable);
+		pthread_mutex_unlock(&reader->lock);
+
+		for (i = 0; i < reader->threads; ++i) {
+			pthread_join(reader->workers[i], NULL);
+		}
+
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->claimable);
+		pthread_cond_destroy(&reader->decompressed);
+	}
+
+	if (reader->chunks != NULL) {
+		for (i = 0; i < reader->amountChunks; ++i) {
+			bufferDestroy(reader->chunks[i].output);
+			bufferDestroy(reader->chunks[i].input);
+		}
+	}
+
+	if (reader->streamOpen) {
+		BZ2_bzDecompressEnd(&reader->stream);
+	}
+
+	if (reader->size > 0) {
+		munmap((void*) reader->data, reader->size);
+	}
+
+	close(reader->fd);
+	free(reader->serialOutput);
+	free(reader->offsets);
+	free(reader->chunks);
+	free(reader->workers);
+	free(reader);
+}
@@ -0,0 +1,17 @@
+/**
+ * bzreader.h
+ */
+
+#ifndef BZREADER_H_
+#define BZREADER_H_
+
+typedef struct BzReader BzReader;
+
+BzReader*		bzReaderOpen(const char* path, const char* indexPath, unsigned int threads, unsigned long begin,
+					unsigned long end);
+unsigned long	bzReaderSize(const BzReader* reader);
+long			bzReaderRead(BzReader* reader, const char** data);
+void			bzReaderClose(BzReader* reader);
+
+
+#endif /* BZREADER_H_ */
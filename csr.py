@@ -0,0 +1,31 @@
+import struct
+import numpy
+
+# Reads the binary CSR matrices written by the tokenizer (--csr), see matrix.h
+# for the layout. Iterating yields the documents as gensim sparse vectors.
+class CsrCorpus(object):
+	def __init__(self, fname):
+		with open(fname, 'rb') as f:
+			header = f.read(64)
+		magic, version, valueType, rows, columns, entries, indicesOffset, valuesOffset, indptrOffset = \
+			struct.unpack('<8sIIQQQQQQ', header)
+		if magic != b'IRLSICSR' or version != 1:
+			raise ValueError('%s is not a CSR matrix' % fname)
+		self.num_docs = rows
+		self.num_terms = columns
+		self.num_nnz = entries
+		self.indices = numpy.memmap(fname, dtype='<u4', mode='r', offset=indicesOffset, shape=(entries,))
+		self.values = numpy.memmap(fname, dtype='<u4' if valueType == 0 else '<f4', mode='r',
+			offset=valuesOffset, shape=(entries,))
+		self.indptr = numpy.memmap(fname, dtype='<u8', mode='r', offset=indptrOffset, shape=(rows + 1,))
+
+	def __len__(self):
+		return self.num_docs
+
+	def __getitem__(self, docno):
+		begin, end = int(self.indptr[docno]), int(self.indptr[docno + 1])
+		return list(zip(self.indices[begin:end].tolist(), self.values[begin:end].tolist()))
+
+	def __iter__(self):
+		for docno in range(self.num_docs):
+			yield self[docno]
@@ -0,0 +1,112 @@
+/**
+ * hash.h
+ *
+ * Hashing of tokens in the style of wyhash: 16 bytes at a time are folded in with a 64 x 64 -> 128 bit multiply.
+ */
+
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__x86_64__)
+#define HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+#define HASH_SECRET0 0xa0761d6478bd642full
+#define HASH_SECRET1 0xe7037ed1a0b428dbull
+#define HASH_SECRET2 0x8ebc6af09c88c6e3ull
+#define HASH_SECRET3 0x589965cc75374cc3ull
+
+/* Both halves of the product, xor'ed together. */
+static inline uint64_t hashMultiply(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	__extension__ typedef unsigned __int128 Product;
+	Product product = (Product) a * b;
+
+	return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+	uint64_t high = (a >> 32) * (b >> 32);
+	uint64_t middle1 = (a >> 32) * (uint32_t) b;
+	uint64_t middle2 = (uint32_t) a * (b >> 32);
+	uint64_t low = (uint64_t) (uint32_t) a * (uint32_t) b;
+	uint64_t sum = low + (middle1 << 32);
+	uint64_t carry = sum < low;
+
+	low		= sum + (middle2 << 32);
+	carry	+= low < sum;
+	high	+= (middle1 >> 32) + (middle2 >> 32) + carry;
+
+	return low ^ high;
+#endif
+}
+
+static inline uint64_t hashFinish(uint64_t seed, unsigned int length) {
+	return hashMultiply(seed ^ HASH_SECRET2, length ^ HASH_SECRET3);
+}
+
+/*
+Lower cases the ASCII letters of a token in place, just like tolower in the C locale, and hashes the result in the
+same pass. The token has to be padded with zeros up to a multiple of 16 bytes.
+*/
+static inline uint64_t hashLowerToken(char* token, unsigned int length) {
+	uint64_t seed = HASH_SECRET0;
+	uint64_t low, high;
+	unsigned int i;
+#ifdef HASH_SSE2
+	__m128i bytes, upper;
+#else
+	unsigned int j;
+#endif
+
+	for (i = 0; i < length; i += 16) {
+#ifdef HASH_SSE2
+		bytes	= _mm_loadu_si128((const __m128i*) (token + i));
+		upper	= _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+			_mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+		bytes	= _mm_add_epi8(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+		_mm_storeu_si128((__m128i*) (token + i), bytes);
+
+		low		= _mm_cvtsi128_si64(bytes);
+		high	= _mm_cvtsi128_si64(_mm_unpackhi_epi64(bytes, bytes));
+#else
+		for (j = i; j < i + 16; ++j) {
+			if (token[j] >= 'A' && token[j] <= 'Z') {
+				token[j] += 0x20;
+			}
+		}
+
+		memcpy(&low, token + i, 8);
+		memcpy(&high, token + i + 8, 8);
+#endif
+		seed = hashMultiply(low ^ HASH_SECRET1, high ^ seed);
+	}
+
+	return hashFinish(seed, length);
+}
+
+/* The same hash of a token that is lower case already, without any requirements on padding. */
+static inline uint64_t hashToken(const char* token, unsigned int length) {
+	uint64_t seed = HASH_SECRET0;
+	uint64_t chunk[2];
+	unsigned int i;
+
+	for (i = 0; i < length; i += 16) {
+		if (length - i >= 16) {
+			memcpy(chunk, token + i, 16);
+		}
+		else {
+			chunk[0] = chunk[1] = 0;
+			memcpy(chunk, token + i, length - i);
+		}
+
+		seed = hashMultiply(chunk[0] ^ HASH_SECRET1, chunk[1] ^ seed);
+	}
+
+	return hashFinish(seed, length);
+}
+
+
+#endif /* HASH_H_ */
@@ -5,6 +5,9 @@ from gensim import corpora, models, similarities
 from html import index as htmlindex
 import simplejson
 import codecs
+import os
+from normalize import Normalizer
+from similarity import SimilarityIndex, IvfIndex
 
 HTML_HEADERS = [('Content-Type', 'text/html'), ('Access-Control-Allow-Origin', '*'), ('Access-Control-Allow-Headers','Requested-With,Content-Type')]
 COMMON_HEADERS = [('Content-Type', 'text/plain'), ('Access-Control-Allow-Origin', '*'), ('Access-Control-Allow-Headers', 'Requested-With,Content-Type')]
@@ -15,6 +18,11 @@ for line in f.read().split('\n')[:-1]:
     x = line.split('\t')
     docids[int(x[0])-1] = x[1]
 
+# Documents replaced by "tokenizer --update", left out of the results.
+deleted = set()
+if os.path.exists('deleted.txt'):
+    deleted = set(int(line) - 1 for line in open('deleted.txt') if line.strip())
+
 def notfound(start_response):
     start_response('404 File Not Found', COMMON_HEADERS + [('Content-length', '2')])
     yield '[]'
@@ -26,7 +34,24 @@ corpus = corpora.MmCorpus('tfidf.mm')
 print 'load lsi'
 lsi = models.LsiModel.load('irlsi.lsi')
 print 'load index'
-index = similarities.MatrixSimilarity.load('irlsi.index')
+threads = int(os.environ.get('IRLSI_SEARCH_THREADS', '1'))
+if os.path.exists('irlsi.ivf'):
+    # Approximate, IRLSI_PROBES lists of "lsi --ivf" scanned per query.
+    index = IvfIndex('irlsi.ivf', probes=int(os.environ.get('IRLSI_PROBES', '16')))
+elif os.path.exists('irlsi8.sim'):
+    # int8 first pass, the best candidates re-ranked against irlsi.sim when it is there.
+    index = SimilarityIndex('irlsi8.sim', threads=threads,
+        exact='irlsi.sim' if os.path.exists('irlsi.sim') else None,
+        candidates=int(os.environ.get('IRLSI_CANDIDATES', '200')))
+elif os.path.exists('irlsi.sim'):
+    index = SimilarityIndex('irlsi.sim', threads=threads)
+else:
+    index = similarities.MatrixSimilarity.load('irlsi.index')
+if isinstance(index, (SimilarityIndex, IvfIndex)):
+    # top() already leaves out what the index marks deleted, only the rest is padded for and filtered.
+    deleted -= index.deleted
+print 'load normalizer'
+normalizer = Normalizer(os.environ.get('IRLSI_NORMALIZE', ''))
 
 def LSIclient(environ, start_response):
     url = environ['PATH_INFO'][1:]
@@ -40,9 +65,12 @@ def LSIclient(environ, start_response):
     	    return notfound(start_response)
     query = params['query'][0]
     print 'Querying %s' % query
-    vec_lsi = lsi[corpus[dictionary.doc2bow(query.lower().split())]]
-    sims = index[vec_lsi]
-    sims = sorted(enumerate(sims), key=lambda item: -item[1])
+    vec_lsi = lsi[corpus[dictionary.doc2bow(normalizer.terms(query))]]
+    if isinstance(index, (SimilarityIndex, IvfIndex)):
+        sims = [sim for sim in index.top(vec_lsi, 21 + len(deleted)) if sim[0] not in deleted]
+    else:
+        sims = index[vec_lsi]
+        sims = sorted((sim for sim in enumerate(sims) if sim[0] not in deleted), key=lambda item: -item[1])
     reply = []
     for doc in sims[:21]:
         docid = doc[0]
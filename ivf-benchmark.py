@@ -0,0 +1,51 @@
+import os
+import random
+import sys
+import time
+from gensim import corpora, models, similarities
+from similarity import SimilarityIndex, IvfIndex
+
+# Recall@20 and latency of the ivf index (lsi --ivf irlsi.sim irlsi.ivf) for a
+# range of probes, against the exact results of MatrixSimilarity, or of the
+# similarity index when there is no irlsi.index. The queries are documents of
+# the corpus, as "ivf-benchmark.py [queries] [seed]".
+K = 20
+PROBES = [1, 2, 4, 8, 16, 32, 64, 128, 256]
+
+queries = int(sys.argv[1]) if len(sys.argv) > 1 else 100
+random.seed(int(sys.argv[2]) if len(sys.argv) > 2 else 0)
+
+print 'load corpus'
+corpus = corpora.MmCorpus('tfidf.mm')
+print 'load lsi'
+lsi = models.LsiModel.load('irlsi.lsi')
+print 'load indices'
+ivf = IvfIndex('irlsi.ivf')
+if os.path.exists('irlsi.index'):
+    exact = similarities.MatrixSimilarity.load('irlsi.index')
+else:
+    exact = SimilarityIndex('irlsi.sim', library=None)
+deleted = set(int(ivf.rows[p]) for p in ivf.documents.deleted)
+
+vectors = [lsi[corpus[i]] for i in random.sample(range(len(corpus)), queries)]
+
+print 'exact search'
+truth = []
+start = time.time()
+for vec in vectors:
+    sims = exact[vec]
+    truth.append(set(row for row, sim in sorted((sim for sim in enumerate(sims) if sim[0] not in deleted),
+        key=lambda item: (-item[1], item[0]))[:K]))
+print 'exact: %.2f ms per query' % ((time.time() - start) * 1000 / queries)
+
+for probes in PROBES:
+    if probes > len(ivf.lists) - 1:
+        break
+    found = 0
+    start = time.time()
+    results = [ivf.top(vec, K, probes) for vec in vectors]
+    elapsed = time.time() - start
+    for best, result in zip(truth, results):
+        found += len(best & set(row for row, sim in result))
+    print 'probes %4d: recall@%d %.4f, %.3f ms per query' % (probes, K,
+        float(found) / max(sum(len(best) for best in truth), 1), elapsed * 1000 / queries)
@@ -0,0 +1,390 @@
+/**
+ * ivf.c
+ *
+ * Builds and searches the inverted file index of ivf.h. The centroids are trained with spherical k-means, i.e. every
+ * document goes to the centroid of the highest cosine similarity and every centroid is the normalized sum of its
+ * documents, on an evenly spaced sample of the documents. A query scores the centroids, then scans the lists of the
+ * best probes of them with the kernels of search.c, so more probes trade time for recall.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ivf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Documents sampled per list to train the centroids on. */
+#define IVF_SAMPLE_PER_LIST 64
+#define IVF_BUFFER_SIZE (8 * 1024 * 1024)
+
+static uint64_t mix(uint64_t value) {
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+	return value ^ (value >> 31);
+}
+
+/* A row of the similarity index as floats. */
+static void decodeRow(const SimilarityIndex* index, unsigned long row, float* values) {
+	const void* vector = similarityRow(index, row);
+	unsigned long i;
+
+	for (i = 0; i < index->header.dimensions; ++i) {
+		switch (index->header.valueType) {
+		case SIMILARITY_INT8:
+			values[i] = ((const int8_t*) vector)[i] * index->scales[row];
+			break;
+		case SIMILARITY_FLOAT16:
+			values[i] = similarityFromHalf(((const uint16_t*) vector)[i]);
+			break;
+		default:
+			values[i] = ((const float*) vector)[i];
+		}
+	}
+}
+
+/* Sets the centroid to values scaled to unit length. */
+static void setCentroid(SimilarityIndex* centroids, unsigned long centroid, const double* values) {
+	float* vector = (float*) similarityRow(centroids, centroid);
+	unsigned long i;
+	double norm = 0;
+
+	for (i = 0; i < centroids->header.dimensions; ++i) {
+		norm += values[i] * values[i];
+	}
+	norm = norm > 0 ? 1 / sqrt(norm) : 0;
+
+	for (i = 0; i < centroids->header.dimensions; ++i) {
+		vector[i] = values[i] * norm;
+	}
+}
+
+/* Closest centroid of a document. */
+static unsigned long assign(const SimilarityIndex* centroids, const float* document) {
+	SearchResult best;
+
+	return searchRows(centroids, document, 0, centroids->header.rows, 1, &best) == 1 ? best.row : 0;
+}
+
+/* Trains the centroids, an index in memory, on the sample of amount documents. */
+static void train(SimilarityIndex* centroids, const float* sample, unsigned long amount, unsigned int iterations,
+	uint64_t seed) {
+	unsigned long lists = centroids->header.rows;
+	unsigned long dimensions = centroids->header.dimensions;
+	unsigned long* counts;
+	double* sums;
+	unsigned long centroid, i, j;
+	unsigned int iteration;
+
+	counts	= malloc(sizeof(unsigned long) * lists);
+	sums	= malloc(sizeof(double) * lists * dimensions);
+	for (i = 0; i < lists * dimensions; ++i) {
+		sums[i] = sample[(mix(seed ^ (i / dimensions)) % amount) * dimensions + i % dimensions];
+	}
+	for (i = 0; i < lists; ++i) {
+		setCentroid(centroids, i, sums + i * dimensions);
+	}
+
+	for (iteration = 0; iteration < iterations; ++iteration) {
+		memset(counts, 0, sizeof(unsigned long) * lists);
+		memset(sums, 0, sizeof(double) * lists * dimensions);
+
+		for (i = 0; i < amount; ++i) {
+			centroid = assign(centroids, sample + i * dimensions);
+			++counts[centroid];
+			for (j = 0; j < dimensions; ++j) {
+				sums[centroid * dimensions + j] += sample[i * dimensions + j];
+			}
+		}
+
+		/* An empty list starts over from a random document. */
+		for (i = 0; i < lists; ++i) {
+			if (counts[i] == 0) {
+				for (j = 0; j < dimensions; ++j) {
+					sums[i * dimensions + j] = sample[(mix(seed ^ (uint64_t) (iteration + 1) << 32 ^ i) % amount) *
+						dimensions + j];
+				}
+			}
+			setCentroid(centroids, i, sums + i * dimensions);
+		}
+
+		printf("\rIteration %u of %u", iteration + 1, iterations);
+		fflush(stdout);
+	}
+	printf("\n");
+
+	free(counts);
+	free(sums);
+}
+
+/* Zeros from the position of the file up to a multiple of alignment. */
+static int pad(FILE* file, unsigned long alignment) {
+	long position = ftell(file);
+
+	for (; position >= 0 && (unsigned long) position % alignment != 0; ++position) {
+		if (fputc(0, file) == EOF) {
+			return -1;
+		}
+	}
+
+	return position >= 0 ? 0 : -1;
+}
+
+/*
+Clusters the documents of the similarity index into lists, sqrt(documents) of them if 0, and writes the inverted file
+index. The centroids are trained for the given amount of iterations.
+*/
+int ivfWrite(const char* indexPath, const char* ivfPath, unsigned long lists, unsigned int iterations,
+	uint64_t seed) {
+	SimilarityIndex* source;
+	SimilarityIndex centroids;
+	IvfHeader header;
+	FILE* file;
+	float* sample;
+	float* document;
+	uint32_t* assigned;
+	uint64_t* starts;
+	uint64_t* order;
+	uint64_t* identity;
+	char padding[SIMILARITY_ALIGNMENT];
+	unsigned long rows, dimensions, amount, i;
+	int result = 0;
+
+	source = similarityOpen(indexPath);
+	if (source == NULL) {
+		return -1;
+	}
+
+	rows		= source->header.rows;
+	dimensions	= source->header.dimensions;
+	if (lists == 0) {
+		lists = sqrt(rows);
+	}
+	if (lists > rows) {
+		lists = rows;
+	}
+	if (lists == 0) {
+		lists = 1;
+	}
+
+	/* The centroids are an index in memory, so documents are assigned with the kernels of search.c. */
+	memset(&centroids, 0, sizeof(centroids));
+	centroids.header.valueType	= SIMILARITY_FLOAT32;
+	centroids.header.rows		= lists;
+	centroids.header.dimensions	= dimensions;
+	centroids.header.rowStride	= (dimensions * sizeof(float) + SIMILARITY_ROW_ALIGNMENT - 1) /
+		SIMILARITY_ROW_ALIGNMENT * SIMILARITY_ROW_ALIGNMENT;
+	centroids.data				= calloc(lists, centroids.header.rowStride);
+	centroids.vectors			= centroids.data;
+	centroids.deleted			= calloc(lists / 8 + 1, 1);
+
+	amount	= rows < lists * IVF_SAMPLE_PER_LIST ? rows : lists * IVF_SAMPLE_PER_LIST;
+	sample	= malloc(sizeof(float) * (amount > 0 ? amount : 1) * dimensions);
+	for (i = 0; i < amount; ++i) {
+		decodeRow(source, i * rows / amount, sample + i * dimensions);
+	}
+
+	printf("Documents: %lu, lists: %lu, sample: %lu\n", rows, lists, amount);
+	if (amount > 0) {
+		train(&centroids, sample, amount, iterations, seed);
+	}
+	free(sample);
+
+	/* Every document to its list, then the positions of the lists by counting. */
+	assigned	= malloc(sizeof(uint32_t) * (rows > 0 ? rows : 1));
+	starts		= calloc(lists + 1, sizeof(uint64_t));
+	document	= malloc(sizeof(float) * dimensions);
+	for (i = 0; i < rows; ++i) {
+		decodeRow(source, i, document);
+		assigned[i] = assign(&centroids, document);
+		++starts[assigned[i] + 1];
+	}
+	free(document);
+
+	for (i = 0; i < lists; ++i) {
+		starts[i + 1] += starts[i];
+	}
+
+	order = malloc(sizeof(uint64_t) * (rows > 0 ? rows : 1));
+	for (i = 0; i < rows; ++i) {
+		order[starts[assigned[i]]++] = i;
+	}
+	for (i = lists; i > 0; --i) {
+		starts[i] = starts[i - 1];
+	}
+	starts[0] = 0;
+	free(assigned);
+
+	identity = malloc(sizeof(uint64_t) * lists);
+	for (i = 0; i < lists; ++i) {
+		identity[i] = i;
+	}
+
+	file = fopen(ivfPath, "wb");
+	if (file == NULL) {
+		result = -1;
+	}
+	else {
+		setvbuf(file, NULL, _IOFBF, IVF_BUFFER_SIZE);
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, IVF_MAGIC, sizeof(header.magic));
+		header.version		= IVF_VERSION;
+		header.lists		= lists;
+		header.rows			= rows;
+		header.dimensions	= dimensions;
+
+		memset(padding, 0, sizeof(padding));
+		if (fwrite(padding, sizeof(padding), 1, file) != 1) {
+			result = -1;
+		}
+
+		header.centroidsOffset = ftell(file);
+		if (result == 0 && similarityWriteRows(file, &centroids, identity, lists) != 0) {
+			result = -1;
+		}
+
+		if (result == 0 && pad(file, sizeof(uint64_t)) != 0) {
+			result = -1;
+		}
+
+		header.listsOffset = ftell(file);
+		if (result == 0 && fwrite(starts, sizeof(uint64_t), lists + 1, file) != lists + 1) {
+			result = -1;
+		}
+
+		header.rowsOffset = ftell(file);
+		if (result == 0 && (fwrite(order, sizeof(uint64_t), rows, file) != rows ||
+			pad(file, SIMILARITY_ALIGNMENT) != 0)) {
+			result = -1;
+		}
+
+		header.documentsOffset = ftell(file);
+		if (result == 0 && similarityWriteRows(file, source, order, rows) != 0) {
+			result = -1;
+		}
+
+		if (result == 0 && (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)) {
+			result = -1;
+		}
+
+		if (fclose(file) != 0) {
+			result = -1;
+		}
+	}
+
+	free(identity);
+	free(order);
+	free(starts);
+	free(centroids.data);
+	free((void*) centroids.deleted);
+	similarityClose(source);
+
+	return result;
+}
+
+/* Maps an inverted file index read-only, see similarityOpen. */
+IvfIndex* ivfOpen(const char* path) {
+	IvfIndex* ivf;
+	IvfHeader* header;
+	struct stat status;
+	unsigned long i;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (unsigned long) status.st_size < SIMILARITY_ALIGNMENT) {
+		close(fd);
+		return NULL;
+	}
+
+	ivf			= calloc(1, sizeof(IvfIndex));
+	ivf->size	= status.st_size;
+	ivf->data	= mmap(NULL, ivf->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (ivf->data == MAP_FAILED) {
+		free(ivf);
+		return NULL;
+	}
+
+	header = &ivf->header;
+	memcpy(header, ivf->data, sizeof(IvfHeader));
+	if (memcmp(header->magic, IVF_MAGIC, sizeof(header->magic)) != 0 || header->version != IVF_VERSION ||
+		header->lists == 0 || header->centroidsOffset >= ivf->size || header->documentsOffset >= ivf->size ||
+		header->listsOffset % sizeof(uint64_t) != 0 || header->rowsOffset % sizeof(uint64_t) != 0 ||
+		header->listsOffset + (header->lists + 1) * sizeof(uint64_t) > ivf->size ||
+		header->rowsOffset + header->rows * sizeof(uint64_t) > ivf->size ||
+		similarityView(&ivf->centroids, (const char*) ivf->data + header->centroidsOffset,
+			ivf->size - header->centroidsOffset) != 0 ||
+		similarityView(&ivf->documents, (const char*) ivf->data + header->documentsOffset,
+			ivf->size - header->documentsOffset) != 0 ||
+		ivf->centroids.header.rows != header->lists || ivf->centroids.header.dimensions != header->dimensions ||
+		ivf->documents.header.rows != header->rows || ivf->documents.header.dimensions != header->dimensions) {
+		ivfClose(ivf);
+		return NULL;
+	}
+
+	ivf->lists	= (const uint64_t*) ((const char*) ivf->data + header->listsOffset);
+	ivf->rows	= (const uint64_t*) ((const char*) ivf->data + header->rowsOffset);
+	for (i = 0; i < header->lists; ++i) {
+		if (ivf->lists[i] > ivf->lists[i + 1]) {
+			break;
+		}
+	}
+	if (ivf->lists[0] != 0 || i < header->lists || ivf->lists[header->lists] != header->rows) {
+		ivfClose(ivf);
+		return NULL;
+	}
+
+	return ivf;
+}
+
+/*
+Finds the k documents most similar to the query among the lists of the probes centroids closest to it, see
+searchRows. The rows of the results are those of the similarity index. May be called from any amount of threads.
+*/
+unsigned int ivfQuery(const IvfIndex* ivf, const float* query, unsigned int probes, unsigned int k,
+	SearchResult* results) {
+	SearchResult* best;
+	unsigned long* ranges;
+	unsigned int amount, size, i;
+
+	if (probes > ivf->header.lists) {
+		probes = ivf->header.lists;
+	}
+	if (probes == 0 || k == 0) {
+		return 0;
+	}
+
+	best	= malloc(sizeof(SearchResult) * probes);
+	ranges	= malloc(sizeof(unsigned long) * probes * 2);
+	amount	= searchRows(&ivf->centroids, query, 0, ivf->header.lists, probes, best);
+	for (i = 0; i < amount; ++i) {
+		ranges[i * 2]		= ivf->lists[best[i].row];
+		ranges[i * 2 + 1]	= ivf->lists[best[i].row + 1];
+	}
+
+	size = searchRanges(&ivf->documents, query, ranges, amount, k, results);
+	for (i = 0; i < size; ++i) {
+		results[i].row = ivf->rows[results[i].row];
+	}
+
+	free(best);
+	free(ranges);
+
+	return size;
+}
+
+void ivfClose(IvfIndex* ivf) {
+	munmap(ivf->data, ivf->size);
+	free(ivf);
+}
@@ -0,0 +1,59 @@
+/**
+ * ivf.h
+ */
+
+#ifndef IVF_H_
+#define IVF_H_
+
+#include <stdint.h>
+#include "similarity.h"
+#include "search.h"
+
+/*
+Inverted file index over a similarity index: the documents are clustered around centroids, and a query only scans
+the lists of the few centroids closest to it. Little endian:
+- the header below, padded to SIMILARITY_ALIGNMENT,
+- at centroidsOffset, the unit centroids as a float32 similarity index of header.lists rows,
+- at listsOffset, uint64 positions, one per list plus one, so list i spans positions lists[i] up to lists[i + 1],
+- at rowsOffset, the row of the similarity index each position holds, uint64,
+- at documentsOffset, the rows of the similarity index in list order, as a similarity index of the same value type
+  with the deleted bits moved along.
+Both similarity indices start at a multiple of SIMILARITY_ALIGNMENT, their offsets are relative to their own header.
+*/
+#define IVF_MAGIC "IRLSIIVF"
+#define IVF_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t lists;
+	uint64_t rows;
+	uint64_t dimensions;
+	uint64_t centroidsOffset;
+	uint64_t listsOffset;
+	uint64_t rowsOffset;
+	uint64_t documentsOffset;
+} IvfHeader;
+
+/* A memory mapped inverted file index. */
+typedef struct {
+	IvfHeader header;
+	SimilarityIndex centroids;
+	SimilarityIndex documents;
+	const uint64_t* lists;
+	const uint64_t* rows;
+
+	void* data;
+	unsigned long size;
+} IvfIndex;
+
+int				ivfWrite(const char* indexPath, const char* ivfPath, unsigned long lists, unsigned int iterations,
+					uint64_t seed);
+IvfIndex*		ivfOpen(const char* path);
+unsigned int	ivfQuery(const IvfIndex* ivf, const float* query, unsigned int probes, unsigned int k,
+					SearchResult* results);
+void			ivfClose(IvfIndex* ivf);
+
+
+#endif /* IVF_H_ */
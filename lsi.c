@@ -0,0 +1,385 @@
+/*
+LSI model builder, the native counterpart of lsi.py
+- Randomized truncated SVD with power iterations over the binary tf-idf matrix (tokenizer tfidf --csr).
+- Multiplies the sparse matrix on a pool of threads (--threads N), in blocks of rows.
+- Optionally streams the matrix in blocks of documents that fit in a memory limit (--max-memory MB), merging the
+  decompositions of the blocks, so memory use does not grow with the amount of documents.
+- Folds the new documents of tokenizer --update into an existing model (--fold-in), appending them to its documents.
+- Writes the similarity index of the documents, to be mapped by the query processes (--index), see similarity.h.
+- Clusters a similarity index into an inverted file index for approximate search (--ivf), see ivf.h.
+- Writes the idf weighted topic vector of every term with a perfect hash of the terms, so the query side can fold a
+  query into topic space without a dictionary (--terms), see terms.h.
+- Uses the local LAPACK and BLAS for the small dense factorizations.
+- Writes the topic vector of every term (V), the singular values (S) and every document in topic space (U S) as
+  binary dense matrices, see matrix.h.
+
+Compiling:
+gcc -O2 -Wall -pedantic --std=c99 -pthread -o lsi lsi.c svd.c matrix.c output.c similarity.c search.c queue.c ivf.c \
+	terms.c tfidf.c buffer.c -llapack -lblas -lm
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "matrix.h"
+#include "svd.h"
+#include "similarity.h"
+#include "ivf.h"
+#include "terms.h"
+#include "tfidf.h"
+
+int help() {
+	printf("Syntax: lsi [--topics N] [--oversample N] [--power-iterations N] [--threads N] [--seed N] "
+		"[--max-memory MB] [binary tfidf input] [topic output] [singular value output] [document output]\n");
+	printf("        lsi --fold-in [--threads N] [binary tfidf input] [topic input] [document output to append to]\n");
+	printf("        lsi --index [--float16 | --int8] [--deleted deleted docIDs] [document input] [similarity index output]\n");
+	printf("        lsi --ivf [--lists N] [--iterations N] [--seed N] [similarity index input] [ivf index output]\n");
+	printf("        lsi --terms [word IDs] [topic input] [term table output]\n");
+	return 0;
+}
+
+static double now() {
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/* Writes rows of doubles as a dense matrix of floats. */
+static int writeDense(const char* path, const double* data, unsigned long rows, unsigned long columns) {
+	DenseWriter* writer;
+	float* row;
+	unsigned long i, j;
+	int result = 0;
+
+	writer = denseWriterOpen(path, columns);
+	if (writer == NULL) {
+		return -1;
+	}
+
+	row = malloc(sizeof(float) * columns);
+	for (i = 0; i < rows && result == 0; ++i) {
+		for (j = 0; j < columns; ++j) {
+			row[j] = data[i * columns + j];
+		}
+		result = denseWriterRows(writer, row, 1);
+	}
+	free(row);
+
+	if (denseWriterClose(writer) != 0) {
+		result = -1;
+	}
+
+	return result;
+}
+
+/* Decomposes and projects the matrix block by block, mapping only one block at a time. */
+static int stream(const char* path, const SvdOptions* options, unsigned long maxMemory, Svd* svd,
+	const char* documentPath) {
+	CsrReader* reader;
+	CsrHeader header;
+	CsrMatrix window;
+	DenseWriter* documents;
+	unsigned long blockRows, begin, end;
+	double start;
+
+	reader = csrReaderOpen(path, &header);
+	if (reader == NULL || header.valueType != CSR_FLOATS) {
+		fprintf(stderr, "Cannot open binary tfidf matrix, tokenizer tfidf --csr writes one.\n");
+		return -1;
+	}
+
+	blockRows = svdBlockRows(&header, options, maxMemory);
+	if (blockRows == 0) {
+		fprintf(stderr, "Not enough memory for %lu topics over %lu terms.\n", options->topics,
+			(unsigned long) header.columns);
+		return -1;
+	}
+
+	printf("Documents: %lu, terms: %lu, entries: %lu, threads: %u, documents per block: %lu\n",
+		(unsigned long) header.rows, (unsigned long) header.columns, (unsigned long) header.entries, options->threads,
+		blockRows);
+
+	start = now();
+	if (svdStream(reader, &header, blockRows, options, svd) != 0) {
+		fprintf(stderr, "Cannot decompose the matrix.\n");
+		return -1;
+	}
+	printf("Decomposed into %lu topics in %.1f seconds\n", svd->topics, now() - start);
+
+	start		= now();
+	documents	= denseWriterOpen(documentPath, svd->topics);
+	if (documents == NULL) {
+		perror("Cannot write documents.\n");
+		return -1;
+	}
+
+	for (begin = 0; begin < header.rows; begin = end) {
+		end = begin + blockRows < header.rows ? begin + blockRows : header.rows;
+		if (csrReaderRows(reader, begin, end, &window) != 0 ||
+			svdProject(&window, svd, documents, options->threads) != 0) {
+			perror("Cannot write documents.\n");
+			return -1;
+		}
+	}
+
+	if (denseWriterClose(documents) != 0) {
+		perror("Cannot write documents.\n");
+		return -1;
+	}
+	printf("Projected documents in %.1f seconds\n", now() - start);
+
+	csrReaderClose(reader);
+
+	return 0;
+}
+
+/* Projects the documents onto the topics of an earlier model and adds them to the end of its documents. */
+static int foldIn(const char* path, const char* topicPath, const char* documentPath, unsigned int threads) {
+	CsrMatrix* matrix;
+	DenseMatrix* topics;
+	DenseWriter* documents;
+	Svd svd;
+	unsigned long i;
+	int result;
+
+	matrix = csrOpen(path);
+	if (matrix == NULL || matrix->header.valueType != CSR_FLOATS) {
+		fprintf(stderr, "Cannot open binary tfidf matrix, tokenizer --update --csr writes one.\n");
+		return -1;
+	}
+
+	topics = denseOpen(topicPath);
+	if (topics == NULL) {
+		fprintf(stderr, "Cannot open topics.\n");
+		return -1;
+	}
+
+	/* Only V is needed, the documents are A V = U S. */
+	svd.topics	= topics->header.columns;
+	svd.terms	= topics->header.rows;
+	svd.sigma	= NULL;
+	svd.vectors	= malloc(sizeof(double) * svd.terms * svd.topics);
+	for (i = 0; i < svd.terms * svd.topics; ++i) {
+		svd.vectors[i] = topics->rows[i];
+	}
+	denseClose(topics);
+
+	if (matrix->header.columns != svd.terms) {
+		fprintf(stderr, "The matrix has %lu terms, the topics %lu.\n", (unsigned long) matrix->header.columns,
+			svd.terms);
+		return -1;
+	}
+
+	documents = denseWriterAppend(documentPath, svd.topics);
+	if (documents == NULL) {
+		fprintf(stderr, "Cannot append to documents, they have to be of the same topics.\n");
+		return -1;
+	}
+
+	result = svdProject(matrix, &svd, documents, threads);
+	if (denseWriterClose(documents) != 0 || result != 0) {
+		perror("Cannot write documents.\n");
+		return -1;
+	}
+	printf("Folded in %lu documents\n", (unsigned long) matrix->header.rows);
+
+	svdDestroy(&svd);
+	csrClose(matrix);
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	CsrMatrix* matrix;
+	DenseWriter* documents;
+	SvdOptions options;
+	Svd svd;
+	unsigned long maxMemory = 0;
+	unsigned long amountDocuments;
+	double start;
+	int argument;
+	int fold = 0;
+	int index = 0;
+	int ivf = 0;
+	int terms = 0;
+	unsigned long lists = 0;
+	unsigned int iterations = 10;
+	uint32_t indexType = SIMILARITY_FLOAT32;
+	const char* deleted = NULL;
+
+	/* The defaults of gensim's LsiModel, as used by lsi.py. */
+	options.topics			= 150;
+	options.oversample		= 100;
+	options.powerIterations	= 2;
+	options.threads			= sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	options.seed			= 0;
+	options.progress		= 1;
+
+	for (argument = 1; argument < argc && strncmp(argv[argument], "--", 2) == 0; ++argument) {
+		if (strcmp(argv[argument], "--topics") == 0 && argument + 1 < argc) {
+			options.topics = strtoul(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--oversample") == 0 && argument + 1 < argc) {
+			options.oversample = strtoul(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--power-iterations") == 0 && argument + 1 < argc) {
+			options.powerIterations = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--threads") == 0 && argument + 1 < argc) {
+			options.threads = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--seed") == 0 && argument + 1 < argc) {
+			options.seed = strtoull(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--max-memory") == 0 && argument + 1 < argc) {
+			maxMemory = strtoul(argv[++argument], NULL, 10) * 1024 * 1024;
+		}
+		else if (strcmp(argv[argument], "--fold-in") == 0) {
+			fold = 1;
+		}
+		else if (strcmp(argv[argument], "--index") == 0) {
+			index = 1;
+		}
+		else if (strcmp(argv[argument], "--float16") == 0) {
+			indexType = SIMILARITY_FLOAT16;
+		}
+		else if (strcmp(argv[argument], "--int8") == 0) {
+			indexType = SIMILARITY_INT8;
+		}
+		else if (strcmp(argv[argument], "--ivf") == 0) {
+			ivf = 1;
+		}
+		else if (strcmp(argv[argument], "--terms") == 0) {
+			terms = 1;
+		}
+		else if (strcmp(argv[argument], "--lists") == 0 && argument + 1 < argc) {
+			lists = strtoul(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--iterations") == 0 && argument + 1 < argc) {
+			iterations = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--deleted") == 0 && argument + 1 < argc) {
+			deleted = argv[++argument];
+		}
+		else {
+			return help();
+		}
+	}
+
+	if (fold) {
+		return argc - argument == 3 ? foldIn(argv[argument], argv[argument + 1], argv[argument + 2], options.threads) :
+			help();
+	}
+
+	if (index) {
+		if (argc - argument != 2) {
+			return help();
+		}
+
+		if (similarityWrite(argv[argument], deleted, argv[argument + 1], indexType) != 0) {
+			perror("Cannot write similarity index.\n");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (ivf) {
+		if (argc - argument != 2) {
+			return help();
+		}
+
+		searchInit(1);
+		if (ivfWrite(argv[argument], argv[argument + 1], lists, iterations, options.seed) != 0) {
+			perror("Cannot write ivf index.\n");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/*
+	The idfs are over the documents of the run that wrote the word IDs, which the model was built from, not over the
+	documents it holds, which grow with every fold-in.
+	*/
+	if (terms) {
+		if (argc - argument != 3) {
+			return help();
+		}
+
+		amountDocuments = tfidfDocuments(argv[argument]);
+		if (amountDocuments == 0) {
+			fprintf(stderr, "Cannot read the amount of documents of the word IDs %s.\n", argv[argument]);
+			return -1;
+		}
+
+		if (termsWrite(argv[argument], argv[argument + 1], amountDocuments, argv[argument + 2]) != 0) {
+			perror("Cannot write term table.\n");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if (argc - argument != 4 || options.topics == 0) {
+		return help();
+	}
+	argv += argument - 1;
+
+	if (maxMemory > 0) {
+		if (stream(argv[1], &options, maxMemory, &svd, argv[4]) != 0) {
+			return -1;
+		}
+
+		if (writeDense(argv[2], svd.vectors, svd.terms, svd.topics) != 0 ||
+			writeDense(argv[3], svd.sigma, 1, svd.topics) != 0) {
+			perror("Cannot write model.\n");
+			return -1;
+		}
+
+		svdDestroy(&svd);
+		return 0;
+	}
+
+	matrix = csrOpen(argv[1]);
+	if (matrix == NULL || matrix->header.valueType != CSR_FLOATS) {
+		fprintf(stderr, "Cannot open binary tfidf matrix, tokenizer tfidf --csr writes one.\n");
+		return -1;
+	}
+
+	printf("Documents: %lu, terms: %lu, entries: %lu, threads: %u\n", (unsigned long) matrix->header.rows,
+		(unsigned long) matrix->header.columns, (unsigned long) matrix->header.entries, options.threads);
+
+	start = now();
+	if (svdCompute(matrix, &options, &svd) != 0) {
+		fprintf(stderr, "Cannot decompose the matrix.\n");
+		return -1;
+	}
+	printf("Decomposed into %lu topics in %.1f seconds\n", svd.topics, now() - start);
+
+	if (writeDense(argv[2], svd.vectors, svd.terms, svd.topics) != 0 ||
+		writeDense(argv[3], svd.sigma, 1, svd.topics) != 0) {
+		perror("Cannot write model.\n");
+		return -1;
+	}
+
+	start		= now();
+	documents	= denseWriterOpen(argv[4], svd.topics);
+	if (documents == NULL || svdProject(matrix, &svd, documents, options.threads) != 0 ||
+		denseWriterClose(documents) != 0) {
+		perror("Cannot write documents.\n");
+		return -1;
+	}
+	printf("Projected documents in %.1f seconds\n", now() - start);
+
+	svdDestroy(&svd);
+	csrClose(matrix);
+
+	return 0;
+}
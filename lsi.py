@@ -1,5 +1,6 @@
 import codecs
-from gensim import corpora, models, similarities, utils
+from gensim import corpora, models, utils
+from similarity import SimilarityIndex
 
 import logging
 logging.basicConfig(format='%(asctime)s : %(levelname)s : %(message)s', level=logging.INFO)
@@ -12,5 +13,6 @@ print 'generate lsi'
 lsi = models.LsiModel(corpus=corpus, id2word=fakedict, num_topics=150)
 lsi.save('irlsi.lsi')
 print 'generate index'
-index = similarities.Similarity(corpus=lsi[corpus], num_features = 150, output_prefix="shard")
-index.save('irlsi.index')
+# Mapped by ir-uwsgi.py instead of unpickled. "lsi --index" writes the same format for the native lsi.
+SimilarityIndex.serialize('irlsi.sim', lsi[corpus], 150)
+# For approximate search: "lsi --ivf irlsi.sim irlsi.ivf", then ivf-benchmark.py for the recall of the probes.
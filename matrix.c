@@ -0,0 +1,776 @@
+/**
+ * matrix.c
+ *
+ * Matrix Market files in coordinate format, as read by gensim, and binary CSR matrices.
+ */
+
+#ifdef __linux__
+/* For copy_file_range. */
+#define _GNU_SOURCE
+#define MATRIX_COPY_FILE_RANGE
+#endif
+#define _POSIX_C_SOURCE 200809L
+
+#include "matrix.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Buffer size of the binary outputs. */
+#define CSR_BUFFER_SIZE (4 * 1024 * 1024)
+/* Bytes the kernel copies per call when moving entries from one file to another. */
+#define MATRIX_COPY_SIZE (1024 * 1024 * 1024)
+
+/* Maps one window of rows of a binary matrix at a time. */
+struct CsrReader {
+	int fd;
+	CsrHeader header;
+	long pageSize;
+
+	/* Row pointers of the window, relative to its first entry. */
+	uint64_t* indptr;
+	unsigned long capacity;
+
+	void* indices;
+	unsigned long indicesSize;
+	void* values;
+	unsigned long valuesSize;
+};
+
+struct DenseWriter {
+	FILE* file;
+	unsigned long rows;
+	unsigned long columns;
+
+	/* Byte swapped copies, big endian hosts only. */
+	uint32_t* swapped;
+	unsigned long swappedSize;
+};
+
+struct CsrWriter {
+	FILE* file;
+	/* Values are written to a file of their own and appended when the matrix is complete. */
+	FILE* values;
+	char* valuesPath;
+	uint32_t valueType;
+	uint64_t entries;
+
+	uint64_t* indptr;
+	unsigned long rows;
+	unsigned long capacity;
+
+	/* Byte swapped copies, big endian hosts only. */
+	uint32_t* swapped;
+	unsigned long swappedSize;
+};
+
+static int isLittleEndian() {
+	const uint16_t value = 1;
+	return *(const char*) &value == 1;
+}
+
+static uint32_t swap32(uint32_t value) {
+	return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+}
+
+static uint64_t swap64(uint64_t value) {
+	return ((uint64_t) swap32(value & 0xffffffff) << 32) | swap32(value >> 32);
+}
+
+/* Writes an array of 32 bit words in little endian order, swapping them in swapped on big endian hosts. */
+static int write32(uint32_t** swapped, unsigned long* swappedSize, FILE* file, const void* data, unsigned long amount) {
+	unsigned long i;
+
+	if (!isLittleEndian()) {
+		if (amount > *swappedSize) {
+			*swappedSize	= amount;
+			*swapped		= realloc(*swapped, sizeof(uint32_t) * amount);
+		}
+
+		for (i = 0; i < amount; ++i) {
+			(*swapped)[i] = swap32(((const uint32_t*) data)[i]);
+		}
+		data = *swapped;
+	}
+
+	return fwrite(data, sizeof(uint32_t), amount, file) == amount ? 0 : -1;
+}
+
+/* Pads a file with zeros up to a multiple of 8 bytes. */
+static int align(FILE* file) {
+	const char zeros[8] = { 0 };
+	long position = ftell(file);
+
+	if (position < 0) {
+		return -1;
+	}
+
+	return position % 8 == 0 || fwrite(zeros, 8 - position % 8, 1, file) == 1 ? 0 : -1;
+}
+
+/* Skips the banner and comments, leaving the file at the first entry. */
+int mmReadHeader(FILE* file, unsigned long* rows, unsigned long* columns, unsigned long* entries) {
+	char line[1024];
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (line[0] == '%') {
+			continue;
+		}
+
+		return sscanf(line, "%lu %lu %lu", rows, columns, entries) == 3 ? 0 : -1;
+	}
+
+	return -1;
+}
+
+static int writeSizes(char* line, unsigned long rows, unsigned long columns, unsigned long entries) {
+	return sprintf(line, "%lu %lu %lu", rows, columns, entries);
+}
+
+int mmWriteHeader(Output* output, unsigned long rows, unsigned long columns, unsigned long entries) {
+	char line[MM_SIZE_WIDTH + 1];
+	int length = writeSizes(line, rows, columns, entries);
+
+	line[length++] = '\n';
+
+	if (outputWrite(output, MM_HEADER, sizeof(MM_HEADER) - 1) != 0) {
+		return -1;
+	}
+
+	return outputWrite(output, line, length);
+}
+
+/* One line per entry, row and column are one based. */
+int mmWriteEntry(Output* output, unsigned long row, unsigned long column, unsigned long value) {
+	outputNumber(output, row);
+	outputChar(output, ' ');
+	outputNumber(output, column);
+	outputChar(output, ' ');
+	outputNumber(output, value);
+
+	return outputChar(output, '\n');
+}
+
+/* Formats a line with a weight into line, which has room for MM_ENTRY_WIDTH bytes. Returns its length. */
+int mmFormatWeight(char* line, unsigned long row, unsigned long column, float weight) {
+	/* Nine digits are enough to read back the same float. */
+	return sprintf(line, "%lu %lu %.9g\n", row, column, weight);
+}
+
+/* The entries of a matrix whose sizes are only known at the end go to path.body until then. */
+static char* bodyPath(const char* path) {
+	char* body = malloc(strlen(path) + 6);
+
+	sprintf(body, "%s.body", path);
+	return body;
+}
+
+/* Opens the output for the entries of the Matrix Market file at path, for when its sizes are only known at the end. */
+Output* mmBodyOpen(const char* path) {
+	char* body = bodyPath(path);
+	Output* output = outputOpen(body);
+
+	free(body);
+	return output;
+}
+
+/* Writes all of data to fd. */
+static int writeAll(int fd, const char* data, unsigned long size) {
+	ssize_t amount;
+
+	while (size > 0) {
+		amount = write(fd, data, size);
+		if (amount < 0) {
+			return -1;
+		}
+
+		data += amount;
+		size -= amount;
+	}
+
+	return 0;
+}
+
+/*
+Appends the rest of in, from its offset on, to out. The kernel copies the bytes where it can, so the entries do not
+pass through user space; a plain read and write takes over where it cannot, e.g. across file systems.
+*/
+static int appendFile(int out, int in) {
+	char* buffer;
+	ssize_t amount;
+	int result = 0;
+
+#ifdef MATRIX_COPY_FILE_RANGE
+	while ((amount = copy_file_range(in, NULL, out, NULL, MATRIX_COPY_SIZE, 0)) > 0);
+	if (amount == 0) {
+		return 0;
+	}
+	if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP) {
+		return -1;
+	}
+#endif
+
+	buffer = malloc(OUTPUT_BUFFER_SIZE);
+	while (result == 0 && (amount = read(in, buffer, OUTPUT_BUFFER_SIZE)) > 0) {
+		result = writeAll(out, buffer, amount);
+	}
+	if (amount < 0) {
+		result = -1;
+	}
+	free(buffer);
+
+	return result;
+}
+
+/*
+Writes the Matrix Market file at path: the header with the sizes, then the entries in the file body from offset
+on. The file body is removed.
+*/
+static int writeWithBody(const char* path, unsigned long rows, unsigned long columns, unsigned long entries,
+	const char* body, long offset) {
+	char header[sizeof(MM_HEADER) + MM_SIZE_WIDTH + 1];
+	int length;
+	int in, out;
+	int result = 0;
+
+	length = sprintf(header, "%s", MM_HEADER);
+	length += writeSizes(header + length, rows, columns, entries);
+	header[length++] = '\n';
+
+	in	= open(body, O_RDONLY);
+	out	= open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (in < 0 || out < 0 || lseek(in, offset, SEEK_SET) < 0 || writeAll(out, header, length) != 0 ||
+		appendFile(out, in) != 0) {
+		result = -1;
+	}
+
+	if (out >= 0 && close(out) != 0) {
+		result = -1;
+	}
+	if (in >= 0) {
+		close(in);
+	}
+
+	if (result == 0) {
+		unlink(body);
+	}
+
+	return result;
+}
+
+/*
+Closes the entries of mmBodyOpen and writes the Matrix Market file at path: the header with the sizes, then the
+entries, whose file is removed.
+*/
+int mmBodyClose(Output* body, const char* path, unsigned long rows, unsigned long columns, unsigned long entries) {
+	char* temporary = bodyPath(path);
+	int result = 0;
+
+	if (outputClose(body) != 0 || writeWithBody(path, rows, columns, entries, temporary, 0) != 0) {
+		result = -1;
+	}
+
+	free(temporary);
+
+	return result;
+}
+
+/*
+Closes the entries of mmBodyOpen and opens them for reading instead, for when they are rewritten rather than kept. The
+file is removed, its entries remain readable until the returned file is closed.
+*/
+FILE* mmBodyRead(Output* body, const char* path) {
+	char* temporary = bodyPath(path);
+	FILE* file = NULL;
+
+	if (outputClose(body) == 0) {
+		file = fopen(temporary, "r");
+	}
+	unlink(temporary);
+
+	free(temporary);
+
+	return file;
+}
+
+/*
+Rewrites the sizes in the header of the Matrix Market file at path, for when those written up front turn out to be
+off. This copies the entries, so it is meant for the rare case only.
+*/
+int mmRewriteHeader(const char* path, unsigned long rows, unsigned long columns, unsigned long entries) {
+	char* temporary = bodyPath(path);
+	FILE* file;
+	unsigned long oldRows, oldColumns, oldEntries;
+	long offset = -1;
+	int result = -1;
+
+	if (rename(path, temporary) == 0) {
+		file = fopen(temporary, "r");
+		if (file != NULL) {
+			if (mmReadHeader(file, &oldRows, &oldColumns, &oldEntries) == 0) {
+				offset = ftell(file);
+			}
+			fclose(file);
+		}
+
+		if (offset >= 0) {
+			result = writeWithBody(path, rows, columns, entries, temporary, offset);
+		}
+	}
+
+	free(temporary);
+
+	return result;
+}
+
+CsrWriter* csrWriterOpen(const char* path, uint32_t valueType) {
+	CsrWriter* writer;
+	CsrHeader header;
+
+	writer				= calloc(1, sizeof(CsrWriter));
+	writer->valueType	= valueType;
+	writer->capacity	= 1024;
+	writer->indptr		= malloc(sizeof(uint64_t) * writer->capacity);
+	writer->valuesPath	= malloc(strlen(path) + 8);
+	sprintf(writer->valuesPath, "%s.values", path);
+
+	writer->file	= fopen(path, "w+b");
+	writer->values	= fopen(writer->valuesPath, "w+b");
+	if (writer->file == NULL || writer->values == NULL) {
+		if (writer->file != NULL) {
+			fclose(writer->file);
+		}
+		free(writer->indptr);
+		free(writer->valuesPath);
+		free(writer);
+		return NULL;
+	}
+
+	setvbuf(writer->file, NULL, _IOFBF, CSR_BUFFER_SIZE);
+	setvbuf(writer->values, NULL, _IOFBF, CSR_BUFFER_SIZE);
+
+	/* The header is written once the sizes are known. */
+	memset(&header, 0, sizeof(header));
+	fwrite(&header, sizeof(header), 1, writer->file);
+	writer->indptr[0] = 0;
+
+	return writer;
+}
+
+/* Appends a row, columns have to be sorted. */
+int csrWriterRow(CsrWriter* writer, const uint32_t* columns, const void* values, unsigned long amount) {
+	if (writer->rows + 1 == writer->capacity) {
+		writer->capacity	*= 2;
+		writer->indptr		= realloc(writer->indptr, sizeof(uint64_t) * writer->capacity);
+	}
+
+	writer->entries += amount;
+	writer->indptr[++writer->rows] = writer->entries;
+
+	if (amount == 0) {
+		return 0;
+	}
+
+	if (write32(&writer->swapped, &writer->swappedSize, writer->file, columns, amount) != 0 ||
+		write32(&writer->swapped, &writer->swappedSize, writer->values, values, amount) != 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Completes the matrix by appending the values and row pointers and writing the header. */
+int csrWriterClose(CsrWriter* writer, unsigned long columns) {
+	CsrHeader header;
+	char* buffer;
+	unsigned long size;
+	unsigned long i;
+	int result = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CSR_MAGIC, sizeof(header.magic));
+	header.version			= CSR_VERSION;
+	header.valueType		= writer->valueType;
+	header.rows				= writer->rows;
+	header.columns			= columns;
+	header.entries			= writer->entries;
+	header.indicesOffset	= sizeof(CsrHeader);
+
+	buffer = malloc(CSR_BUFFER_SIZE);
+
+	if (align(writer->file) != 0 || fflush(writer->values) != 0) {
+		result = -1;
+	}
+
+	header.valuesOffset = ftell(writer->file);
+	rewind(writer->values);
+	while (result == 0 && (size = fread(buffer, 1, CSR_BUFFER_SIZE, writer->values)) > 0) {
+		if (fwrite(buffer, 1, size, writer->file) != size) {
+			result = -1;
+		}
+	}
+
+	if (result == 0 && align(writer->file) != 0) {
+		result = -1;
+	}
+
+	header.indptrOffset = ftell(writer->file);
+	if (!isLittleEndian()) {
+		for (i = 0; i <= writer->rows; ++i) {
+			writer->indptr[i] = swap64(writer->indptr[i]);
+		}
+	}
+
+	if (result == 0 && fwrite(writer->indptr, sizeof(uint64_t), writer->rows + 1, writer->file) != writer->rows + 1) {
+		result = -1;
+	}
+
+	if (!isLittleEndian()) {
+		header.version			= swap32(header.version);
+		header.valueType		= swap32(header.valueType);
+		header.rows				= swap64(header.rows);
+		header.columns			= swap64(header.columns);
+		header.entries			= swap64(header.entries);
+		header.indicesOffset	= swap64(header.indicesOffset);
+		header.valuesOffset		= swap64(header.valuesOffset);
+		header.indptrOffset		= swap64(header.indptrOffset);
+	}
+
+	if (result == 0 && (fseek(writer->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, writer->file) != 1)) {
+		result = -1;
+	}
+
+	if (fclose(writer->file) != 0) {
+		result = -1;
+	}
+
+	fclose(writer->values);
+	remove(writer->valuesPath);
+
+	free(buffer);
+	free(writer->indptr);
+	free(writer->swapped);
+	free(writer->valuesPath);
+	free(writer);
+
+	return result;
+}
+
+/* Maps a binary matrix into memory. The arrays are used in place, so this only works on little endian hosts. */
+CsrMatrix* csrOpen(const char* path) {
+	CsrMatrix* matrix;
+	struct stat status;
+	int fd;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (unsigned long) status.st_size < sizeof(CsrHeader)) {
+		close(fd);
+		return NULL;
+	}
+
+	matrix			= calloc(1, sizeof(CsrMatrix));
+	matrix->size	= status.st_size;
+	matrix->data	= mmap(NULL, matrix->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (matrix->data == MAP_FAILED) {
+		free(matrix);
+		return NULL;
+	}
+
+	memcpy(&matrix->header, matrix->data, sizeof(CsrHeader));
+	if (memcmp(matrix->header.magic, CSR_MAGIC, sizeof(matrix->header.magic)) != 0 ||
+		matrix->header.version != CSR_VERSION ||
+		matrix->header.indicesOffset + matrix->header.entries * 4 > matrix->size ||
+		matrix->header.valuesOffset + matrix->header.entries * 4 > matrix->size ||
+		matrix->header.indptrOffset + (matrix->header.rows + 1) * 8 > matrix->size) {
+		csrClose(matrix);
+		return NULL;
+	}
+
+	matrix->indices	= (const uint32_t*) ((const char*) matrix->data + matrix->header.indicesOffset);
+	matrix->values	= (const char*) matrix->data + matrix->header.valuesOffset;
+	matrix->indptr	= (const uint64_t*) ((const char*) matrix->data + matrix->header.indptrOffset);
+
+	return matrix;
+}
+
+void csrClose(CsrMatrix* matrix) {
+	munmap(matrix->data, matrix->size);
+	free(matrix);
+}
+
+/* Opens a binary matrix to be read in windows of rows, see csrReaderRows. Little endian hosts only like csrOpen. */
+CsrReader* csrReaderOpen(const char* path, CsrHeader* header) {
+	CsrReader* reader;
+	struct stat status;
+	int fd;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || pread(fd, header, sizeof(CsrHeader), 0) != sizeof(CsrHeader) ||
+		memcmp(header->magic, CSR_MAGIC, sizeof(header->magic)) != 0 || header->version != CSR_VERSION ||
+		header->indicesOffset + header->entries * 4 > (unsigned long) status.st_size ||
+		header->valuesOffset + header->entries * 4 > (unsigned long) status.st_size ||
+		header->indptrOffset + (header->rows + 1) * 8 > (unsigned long) status.st_size) {
+		close(fd);
+		return NULL;
+	}
+
+	reader				= calloc(1, sizeof(CsrReader));
+	reader->fd			= fd;
+	reader->header		= *header;
+	reader->pageSize	= sysconf(_SC_PAGESIZE);
+
+	return reader;
+}
+
+/* Maps size bytes at offset, which need not be page aligned. Returns where they start, or NULL. */
+static const void* mapRange(CsrReader* reader, uint64_t offset, uint64_t size, void** mapping,
+	unsigned long* mappingSize) {
+	uint64_t aligned = offset / reader->pageSize * reader->pageSize;
+
+	*mapping		= NULL;
+	*mappingSize	= size + (offset - aligned);
+	if (size == 0) {
+		return NULL;
+	}
+
+	*mapping = mmap(NULL, *mappingSize, PROT_READ, MAP_SHARED, reader->fd, aligned);
+	if (*mapping == MAP_FAILED) {
+		*mapping = NULL;
+		return NULL;
+	}
+
+	posix_madvise(*mapping, *mappingSize, POSIX_MADV_SEQUENTIAL);
+	return (const char*) *mapping + (offset - aligned);
+}
+
+static void unmapWindow(CsrReader* reader) {
+	if (reader->indices != NULL) {
+		munmap(reader->indices, reader->indicesSize);
+		reader->indices = NULL;
+	}
+
+	if (reader->values != NULL) {
+		munmap(reader->values, reader->valuesSize);
+		reader->values = NULL;
+	}
+}
+
+/*
+Maps the rows begin up to end into window, releasing the window before. The window is a matrix of its own, with row
+0 being row begin, and stays valid until the next call.
+*/
+int csrReaderRows(CsrReader* reader, unsigned long begin, unsigned long end, CsrMatrix* window) {
+	unsigned long rows = end - begin;
+	uint64_t first;
+	unsigned long i;
+
+	unmapWindow(reader);
+	if (begin > end || end > reader->header.rows) {
+		return -1;
+	}
+
+	if (rows + 1 > reader->capacity) {
+		reader->capacity	= rows + 1;
+		reader->indptr		= realloc(reader->indptr, sizeof(uint64_t) * reader->capacity);
+	}
+
+	if (pread(reader->fd, reader->indptr, sizeof(uint64_t) * (rows + 1), reader->header.indptrOffset + begin * 8) !=
+		(ssize_t) (sizeof(uint64_t) * (rows + 1))) {
+		return -1;
+	}
+
+	first = reader->indptr[0];
+	for (i = 0; i <= rows; ++i) {
+		reader->indptr[i] -= first;
+	}
+
+	memset(window, 0, sizeof(CsrMatrix));
+	window->header			= reader->header;
+	window->header.rows		= rows;
+	window->header.entries	= reader->indptr[rows];
+	window->indptr			= reader->indptr;
+	window->indices			= mapRange(reader, reader->header.indicesOffset + first * 4, window->header.entries * 4,
+		&reader->indices, &reader->indicesSize);
+	window->values			= mapRange(reader, reader->header.valuesOffset + first * 4, window->header.entries * 4,
+		&reader->values, &reader->valuesSize);
+
+	return window->header.entries == 0 || (window->indices != NULL && window->values != NULL) ? 0 : -1;
+}
+
+void csrReaderClose(CsrReader* reader) {
+	unmapWindow(reader);
+	close(reader->fd);
+	free(reader->indptr);
+	free(reader);
+}
+
+/* Writes the header once the amount of rows is known. */
+static int writeDenseHeader(FILE* file, unsigned long rows, unsigned long columns) {
+	char padding[DENSE_DATA_OFFSET];
+	DenseHeader header;
+
+	memset(padding, 0, sizeof(padding));
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DENSE_MAGIC, sizeof(header.magic));
+	header.version		= DENSE_VERSION;
+	header.valueType	= DENSE_FLOATS;
+	header.rows			= rows;
+	header.columns		= columns;
+	header.dataOffset	= DENSE_DATA_OFFSET;
+
+	if (!isLittleEndian()) {
+		header.version		= swap32(header.version);
+		header.valueType	= swap32(header.valueType);
+		header.rows			= swap64(header.rows);
+		header.columns		= swap64(header.columns);
+		header.dataOffset	= swap64(header.dataOffset);
+	}
+
+	memcpy(padding, &header, sizeof(header));
+	return fwrite(padding, sizeof(padding), 1, file) == 1 ? 0 : -1;
+}
+
+DenseWriter* denseWriterOpen(const char* path, unsigned long columns) {
+	DenseWriter* writer;
+
+	writer			= calloc(1, sizeof(DenseWriter));
+	writer->columns	= columns;
+	writer->file	= fopen(path, "wb");
+	if (writer->file == NULL) {
+		free(writer);
+		return NULL;
+	}
+
+	setvbuf(writer->file, NULL, _IOFBF, CSR_BUFFER_SIZE);
+	if (writeDenseHeader(writer->file, 0, columns) != 0) {
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+/* Opens an existing dense matrix of as many columns to add rows to, little endian hosts only like denseOpen. */
+DenseWriter* denseWriterAppend(const char* path, unsigned long columns) {
+	DenseWriter* writer;
+	DenseHeader header;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	writer			= calloc(1, sizeof(DenseWriter));
+	writer->columns	= columns;
+	writer->file	= fopen(path, "r+b");
+	if (writer->file == NULL) {
+		free(writer);
+		return NULL;
+	}
+
+	setvbuf(writer->file, NULL, _IOFBF, CSR_BUFFER_SIZE);
+	if (fread(&header, sizeof(header), 1, writer->file) != 1 ||
+		memcmp(header.magic, DENSE_MAGIC, sizeof(header.magic)) != 0 || header.version != DENSE_VERSION ||
+		header.valueType != DENSE_FLOATS || header.columns != columns || header.dataOffset != DENSE_DATA_OFFSET ||
+		fseek(writer->file, header.dataOffset + header.rows * columns * 4, SEEK_SET) != 0) {
+		fclose(writer->file);
+		free(writer);
+		return NULL;
+	}
+	writer->rows = header.rows;
+
+	return writer;
+}
+
+/* Appends amount rows. */
+int denseWriterRows(DenseWriter* writer, const float* rows, unsigned long amount) {
+	writer->rows += amount;
+	return write32(&writer->swapped, &writer->swappedSize, writer->file, rows, amount * writer->columns);
+}
+
+int denseWriterClose(DenseWriter* writer) {
+	int result = 0;
+
+	if (fseek(writer->file, 0, SEEK_SET) != 0 || writeDenseHeader(writer->file, writer->rows, writer->columns) != 0) {
+		result = -1;
+	}
+
+	if (fclose(writer->file) != 0) {
+		result = -1;
+	}
+
+	free(writer->swapped);
+	free(writer);
+
+	return result;
+}
+
+/* Maps a dense matrix into memory, little endian hosts only like csrOpen. */
+DenseMatrix* denseOpen(const char* path) {
+	DenseMatrix* matrix;
+	struct stat status;
+	int fd;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (unsigned long) status.st_size < DENSE_DATA_OFFSET) {
+		close(fd);
+		return NULL;
+	}
+
+	matrix			= calloc(1, sizeof(DenseMatrix));
+	matrix->size	= status.st_size;
+	matrix->data	= mmap(NULL, matrix->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (matrix->data == MAP_FAILED) {
+		free(matrix);
+		return NULL;
+	}
+
+	memcpy(&matrix->header, matrix->data, sizeof(DenseHeader));
+	if (memcmp(matrix->header.magic, DENSE_MAGIC, sizeof(matrix->header.magic)) != 0 ||
+		matrix->header.version != DENSE_VERSION || matrix->header.valueType != DENSE_FLOATS ||
+		matrix->header.dataOffset + matrix->header.rows * matrix->header.columns * 4 > matrix->size) {
+		denseClose(matrix);
+		return NULL;
+	}
+
+	matrix->rows = (const float*) ((const char*) matrix->data + matrix->header.dataOffset);
+
+	return matrix;
+}
+
+void denseClose(DenseMatrix* matrix) {
+	munmap(matrix->data, matrix->size);
+	free(matrix);
+}
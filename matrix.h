@@ -0,0 +1,115 @@
+/**
+ * matrix.h
+ */
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "output.h"
+
+#define MM_HEADER "%%MatrixMarket matrix coordinate real general\n"
+/* Room for a size line of three 64 bit counts. */
+#define MM_SIZE_WIDTH 64
+/* Room for a formatted entry with a weight. */
+#define MM_ENTRY_WIDTH 64
+
+/*
+Binary compressed sparse row matrix, little endian and fixed width throughout:
+- the header below,
+- the column indices of all entries, uint32,
+- the values of all entries, uint32 counts or float32 weights,
+- the row pointers, uint64, one per row plus one, so row i spans entries indptr[i] up to indptr[i + 1].
+Rows and columns are zero based, i.e. document ID - 1 and token ID - 1. Every section starts at an offset that is
+a multiple of 8.
+*/
+#define CSR_MAGIC "IRLSICSR"
+#define CSR_VERSION 1
+#define CSR_COUNTS 0
+#define CSR_FLOATS 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t valueType;
+	uint64_t rows;
+	uint64_t columns;
+	uint64_t entries;
+	uint64_t indicesOffset;
+	uint64_t valuesOffset;
+	uint64_t indptrOffset;
+} CsrHeader;
+
+/*
+Binary dense matrix, little endian: the header below, padded to DENSE_DATA_OFFSET, then the rows one after another.
+*/
+#define DENSE_MAGIC "IRLSIDNS"
+#define DENSE_VERSION 1
+#define DENSE_FLOATS 0
+#define DENSE_DATA_OFFSET 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t valueType;
+	uint64_t rows;
+	uint64_t columns;
+	uint64_t dataOffset;
+} DenseHeader;
+
+typedef struct CsrWriter CsrWriter;
+typedef struct CsrReader CsrReader;
+typedef struct DenseWriter DenseWriter;
+
+/* A memory mapped binary matrix. */
+typedef struct {
+	CsrHeader header;
+	const uint32_t* indices;
+	const void* values;
+	const uint64_t* indptr;
+
+	void* data;
+	unsigned long size;
+} CsrMatrix;
+
+/* A memory mapped dense matrix, float rows of header.columns each. */
+typedef struct {
+	DenseHeader header;
+	const float* rows;
+
+	void* data;
+	unsigned long size;
+} DenseMatrix;
+
+int			mmReadHeader(FILE* file, unsigned long* rows, unsigned long* columns, unsigned long* entries);
+int			mmWriteHeader(Output* output, unsigned long rows, unsigned long columns, unsigned long entries);
+int			mmWriteEntry(Output* output, unsigned long row, unsigned long column, unsigned long value);
+int			mmFormatWeight(char* line, unsigned long row, unsigned long column, float weight);
+Output*		mmBodyOpen(const char* path);
+int			mmBodyClose(Output* body, const char* path, unsigned long rows, unsigned long columns,
+				unsigned long entries);
+FILE*		mmBodyRead(Output* body, const char* path);
+int			mmRewriteHeader(const char* path, unsigned long rows, unsigned long columns, unsigned long entries);
+
+CsrWriter*	csrWriterOpen(const char* path, uint32_t valueType);
+int			csrWriterRow(CsrWriter* writer, const uint32_t* columns, const void* values, unsigned long amount);
+int			csrWriterClose(CsrWriter* writer, unsigned long columns);
+
+CsrMatrix*	csrOpen(const char* path);
+void		csrClose(CsrMatrix* matrix);
+
+CsrReader*	csrReaderOpen(const char* path, CsrHeader* header);
+int			csrReaderRows(CsrReader* reader, unsigned long begin, unsigned long end, CsrMatrix* window);
+void		csrReaderClose(CsrReader* reader);
+
+DenseWriter*	denseWriterOpen(const char* path, unsigned long columns);
+DenseWriter*	denseWriterAppend(const char* path, unsigned long columns);
+int				denseWriterRows(DenseWriter* writer, const float* rows, unsigned long amount);
+int				denseWriterClose(DenseWriter* writer);
+
+DenseMatrix*	denseOpen(const char* path);
+void			denseClose(DenseMatrix* matrix);
+
+
+#endif /* MATRIX_H_ */
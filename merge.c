@@ -0,0 +1,385 @@
+/**
+ * merge.c
+ *
+ * Merges the output of tokenizer runs over consecutive parts of a dump, as if the dump was tokenized in one run.
+ * Shards are given as triples of bow, word ID and docID files, in order of the dump.
+ * Also prunes the word list of a complete run or merge, writing the bow with the new token IDs.
+ */
+
+#include "merge.h"
+#include "matrix.h"
+#include "tfidf.h"
+#include "vocabulary.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	unsigned long id;
+	unsigned long occurence;
+} Entry;
+
+static int compareEntries(const void* a, const void* b) {
+	const Entry* e1 = (Entry*) a;
+	const Entry* e2 = (Entry*) b;
+	if (e1->id > e2->id) return 1;
+	else if (e1->id < e2->id) return -1;
+	else return 0;
+}
+
+/* Writes the entries of a document sorted on the new token IDs. */
+static int writeDocument(Output* bow, unsigned long documentID, Entry* entries, unsigned long amount) {
+	unsigned long i;
+
+	if (amount == 0) {
+		return 0;
+	}
+
+	qsort(entries, amount, sizeof(Entry), compareEntries);
+	for (i = 0; i < amount; ++i) {
+		if (mmWriteEntry(bow, documentID, entries[i].id, entries[i].occurence) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Copies the entries of a bow, read up to its header, renumbering documents and tokens. Tokens without a new ID are
+dropped if prune is set, they are an error otherwise. Adds the amount of entries written to written.
+*/
+static int mergeBow(Output* bow, FILE* shard, unsigned long documentOffset, const unsigned long* mapping,
+	unsigned long amountTokens, int prune, unsigned long* written) {
+	Entry* entries = NULL;
+	unsigned long amountEntries = 0;
+	unsigned long capacity = 0;
+	unsigned long documentID, previousID = 0;
+	unsigned long tokenID, occurence;
+	int result = 0;
+
+	while (fscanf(shard, "%lu %lu %lu", &documentID, &tokenID, &occurence) == 3) {
+		if (tokenID > amountTokens || (mapping[tokenID] == 0 && !prune)) {
+			result = -1;
+			break;
+		}
+
+		if (documentID != previousID) {
+			if (writeDocument(bow, documentOffset + previousID, entries, amountEntries) != 0) {
+				result = -1;
+				break;
+			}
+
+			*written		+= amountEntries;
+			amountEntries	= 0;
+			previousID		= documentID;
+		}
+
+		if (mapping[tokenID] == 0) {
+			continue;
+		}
+
+		if (amountEntries == capacity) {
+			capacity	= capacity ? capacity * 2 : 1024;
+			entries		= realloc(entries, sizeof(Entry) * capacity);
+		}
+
+		entries[amountEntries].id			= mapping[tokenID];
+		entries[amountEntries].occurence	= occurence;
+		++amountEntries;
+	}
+
+	if (result == 0 && !feof(shard)) {
+		result = -1;
+	}
+
+	if (result == 0) {
+		result		= writeDocument(bow, documentOffset + previousID, entries, amountEntries);
+		*written	+= amountEntries;
+	}
+
+	free(entries);
+
+	return result;
+}
+
+/* Rewrites a binary bow to the new token IDs, dropping tokens without one. */
+static int pruneCsr(const char* path, const unsigned long* mapping, unsigned long amountTokens,
+	unsigned long newAmountTokens) {
+	CsrMatrix* matrix;
+	CsrWriter* writer;
+	Entry* entries;
+	uint32_t* columns;
+	uint32_t* values;
+	const uint32_t* oldValues;
+	unsigned long row, i, amount;
+	char* prunedPath;
+	int result = 0;
+
+	matrix = csrOpen(path);
+	if (matrix == NULL) {
+		return -1;
+	}
+
+	prunedPath = malloc(strlen(path) + 8);
+	sprintf(prunedPath, "%s.pruned", path);
+
+	writer = csrWriterOpen(prunedPath, matrix->header.valueType);
+	if (writer == NULL) {
+		free(prunedPath);
+		csrClose(matrix);
+		return -1;
+	}
+
+	/* Rows are at most as long as the vocabulary, before pruning. */
+	entries		= malloc(sizeof(Entry) * (amountTokens + 1));
+	columns		= malloc(sizeof(uint32_t) * (amountTokens + 1));
+	values		= malloc(sizeof(uint32_t) * (amountTokens + 1));
+	oldValues	= (const uint32_t*) matrix->values;
+
+	for (row = 0; row < matrix->header.rows && result == 0; ++row) {
+		amount = 0;
+		for (i = matrix->indptr[row]; i < matrix->indptr[row + 1]; ++i) {
+			if (matrix->indices[i] >= amountTokens || mapping[matrix->indices[i] + 1] == 0) {
+				continue;
+			}
+
+			/* The bits of the value are copied, whether it is a count or a weight. */
+			entries[amount].id			= mapping[matrix->indices[i] + 1];
+			entries[amount].occurence	= oldValues[i];
+			++amount;
+		}
+
+		qsort(entries, amount, sizeof(Entry), compareEntries);
+		for (i = 0; i < amount; ++i) {
+			columns[i]	= entries[i].id - 1;
+			values[i]	= entries[i].occurence;
+		}
+
+		result = csrWriterRow(writer, columns, values, amount);
+	}
+
+	if (csrWriterClose(writer, newAmountTokens) != 0) {
+		result = -1;
+	}
+
+	if (result == 0 && rename(prunedPath, path) != 0) {
+		result = -1;
+	}
+
+	free(entries);
+	free(columns);
+	free(values);
+	free(prunedPath);
+	csrClose(matrix);
+
+	return result;
+}
+
+/*
+Prunes the word list, see Pruning and vocabularyPrune, and sets entries to the amount of entries of a bow of the
+remaining tokens. Returns the new ID for every old ID, see vocabularyPrune.
+*/
+static unsigned long* pruneVocabulary(Vocabulary* vocabulary, unsigned long documents, const Pruning* pruning,
+	unsigned long* amountTokens, unsigned long* entries) {
+	unsigned long maxOccurence = (unsigned long) -1;
+	unsigned long* mapping;
+
+	if (pruning->maxRatio > 0) {
+		maxOccurence = pruning->maxRatio * documents;
+	}
+
+	mapping = vocabularyPrune(vocabulary, pruning->minOccurence, maxOccurence, pruning->keep, amountTokens, entries);
+	printf("Pruned word list, kept tokens: %lu of %lu\n", vocabularySize(vocabulary), *amountTokens);
+
+	return mapping;
+}
+
+/*
+Prunes the word list of a run, see Pruning. The entries of its bow, still in the body of mmBodyOpen, are written to
+bowPath with the new IDs in one pass, and the binary bow is rewritten unless csrPath is NULL. The word IDs are left
+to the caller, they are written from the vocabulary.
+*/
+int pruneOutputs(Vocabulary* vocabulary, Output* body, const char* bowPath, const char* csrPath,
+	unsigned long documents, const Pruning* pruning) {
+	FILE* source;
+	Output* bow;
+	unsigned long* mapping;
+	unsigned long amountTokens;
+	unsigned long entries;
+	unsigned long written = 0;
+	int result = 0;
+
+	/* Every document of a token is an entry of it, so the size of the pruned bow is known up front. */
+	mapping	= pruneVocabulary(vocabulary, documents, pruning, &amountTokens, &entries);
+	source	= mmBodyRead(body, bowPath);
+	bow		= outputOpen(bowPath);
+	if (source == NULL || bow == NULL || mmWriteHeader(bow, documents, vocabularySize(vocabulary), entries) != 0 ||
+		mergeBow(bow, source, 0, mapping, amountTokens, 1, &written) != 0 || written != entries) {
+		result = -1;
+	}
+
+	if (source != NULL) {
+		fclose(source);
+	}
+	if (bow != NULL && outputClose(bow) != 0) {
+		result = -1;
+	}
+
+	if (result == 0 && csrPath != NULL) {
+		result = pruneCsr(csrPath, mapping, amountTokens, vocabularySize(vocabulary));
+	}
+
+	free(mapping);
+
+	return result;
+}
+
+/* Copies the docIDs of a shard, renumbering the documents. */
+static int mergeDocIDs(Output* docID, const char* path, unsigned long documentOffset) {
+	FILE* shard;
+	unsigned long documentID;
+	int c;
+
+	shard = fopen(path, "r");
+	if (shard == NULL) {
+		return -1;
+	}
+
+	while (fscanf(shard, "%lu", &documentID) == 1) {
+		outputNumber(docID, documentOffset + documentID);
+
+		while ((c = getc(shard)) != EOF) {
+			outputChar(docID, c);
+			if (c == '\n') {
+				break;
+			}
+		}
+	}
+
+	fclose(shard);
+
+	return docID->error ? -1 : 0;
+}
+
+int mergeShards(const char* bowPath, const char* wordIDPath, const char* docIDPath, char** shards,
+	unsigned int amountShards, const Pruning* pruning) {
+	Vocabulary* vocabulary;
+	FILE* file;
+	Output* bow;
+	Output* wordID;
+	Output* docID;
+	unsigned long* mapping;
+	unsigned long* pruned;
+	unsigned long* documents;
+	unsigned long amountTokens, amountMerged;
+	unsigned long columns, entries;
+	unsigned long totalDocuments = 0;
+	unsigned long totalEntries = 0;
+	unsigned long documentOffset = 0;
+	unsigned long written = 0;
+	unsigned int i;
+
+	vocabulary	= vocabularyInit();
+	documents	= malloc(sizeof(unsigned long) * amountShards);
+
+	/* First merge the vocabularies, so the size of the matrix is known up front. */
+	for (i = 0; i < amountShards; ++i) {
+		printf("Merging vocabulary of shard %u\n", i + 1);
+
+		file = fopen(shards[i * 3], "r");
+		if (file == NULL || mmReadHeader(file, &documents[i], &columns, &entries) != 0) {
+			fprintf(stderr, "Cannot read bow of shard %u\n", i + 1);
+			return -1;
+		}
+		fclose(file);
+
+		totalDocuments	+= documents[i];
+		totalEntries	+= entries;
+
+		mapping = vocabularyMap(vocabulary, shards[i * 3 + 1], 1, &amountTokens);
+		if (mapping == NULL) {
+			fprintf(stderr, "Cannot read word IDs of shard %u\n", i + 1);
+			return -1;
+		}
+		free(mapping);
+	}
+
+	/* Pruned before the bow is written, so it is written once with the new IDs and its size is known up front. */
+	if (pruning->enabled) {
+		pruned = pruneVocabulary(vocabulary, totalDocuments, pruning, &amountMerged, &totalEntries);
+		free(pruned);
+	}
+
+	bow		= outputOpen(bowPath);
+	wordID	= outputOpen(wordIDPath);
+	docID	= outputOpen(docIDPath);
+	if (bow == NULL || wordID == NULL || docID == NULL) {
+		perror("Cannot create output files");
+		return -1;
+	}
+
+	if (mmWriteHeader(bow, totalDocuments, vocabularySize(vocabulary), totalEntries) != 0) {
+		perror("Cannot write.\n");
+		return -1;
+	}
+
+	for (i = 0; i < amountShards; ++i) {
+		printf("Merging documents of shard %u\n", i + 1);
+
+		/* Tokens that are pruned map to 0. */
+		mapping = vocabularyMap(vocabulary, shards[i * 3 + 1], 0, &amountTokens);
+		if (mapping == NULL) {
+			fprintf(stderr, "Cannot read word IDs of shard %u\n", i + 1);
+			return -1;
+		}
+
+		file = fopen(shards[i * 3], "r");
+		if (file == NULL || mmReadHeader(file, &documents[i], &columns, &entries) != 0 ||
+			mergeBow(bow, file, documentOffset, mapping, amountTokens, pruning->enabled, &written) != 0) {
+			fprintf(stderr, "Cannot merge bow of shard %u\n", i + 1);
+			return -1;
+		}
+		fclose(file);
+
+		if (mergeDocIDs(docID, shards[i * 3 + 2], documentOffset) != 0) {
+			fprintf(stderr, "Cannot merge docIDs of shard %u\n", i + 1);
+			return -1;
+		}
+
+		documentOffset += documents[i];
+		free(mapping);
+	}
+
+	printf("Merged documents: %lu, tokens: %lu, entries: %lu\n", totalDocuments, vocabularySize(vocabulary),
+		totalEntries);
+
+	if (written != totalEntries) {
+		fprintf(stderr, "Merged %lu entries instead of %lu, the shards do not match their word IDs.\n", written,
+			totalEntries);
+		return -1;
+	}
+
+	if (outputClose(bow) != 0 || outputClose(docID) != 0) {
+		perror("Cannot write.\n");
+		return -1;
+	}
+
+	setbuf(stdout, NULL);
+	printf("Writing word IDs: ");
+	if (vocabularyWrite(vocabulary, wordID) != 0) {
+		perror("Cannot write.\n");
+		return -1;
+	}
+	printf("\n");
+
+	free(documents);
+	vocabularyDestroy(vocabulary);
+
+	if (outputClose(wordID) != 0 || tfidfWriteDocuments(wordIDPath, totalDocuments) != 0) {
+		perror("Cannot write.\n");
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+/**
+ * merge.h
+ */
+
+#ifndef MERGE_H_
+#define MERGE_H_
+
+#include "vocabulary.h"
+
+/*
+Pruning of the word list at the end of a run or merge: tokens that occur in less than minOccurence documents or in
+more than maxRatio of them (0 for no limit) are dropped, at most keep (0 for all) of the others remain. The remaining
+tokens are renumbered in order of descending document occurence.
+*/
+typedef struct {
+	int enabled;
+	unsigned long minOccurence;
+	double maxRatio;
+	unsigned long keep;
+} Pruning;
+
+int		mergeShards(const char* bowPath, const char* wordIDPath, const char* docIDPath, char** shards,
+			unsigned int amountShards, const Pruning* pruning);
+int		pruneOutputs(Vocabulary* vocabulary, Output* body, const char* bowPath, const char* csrPath,
+			unsigned long documents, const Pruning* pruning);
+
+
+#endif /* MERGE_H_ */
@@ -0,0 +1,623 @@
+/**
+ * normalize.c
+ *
+ * Normalization of tokens, shared by the tokenizer and the query side (see normalize.py), so that a query ends up with
+ * the same terms as the documents. Besides lower casing ASCII, tokens can be case folded beyond ASCII, checked
+ * against a compiled-in set of English stopwords and stemmed with the Porter stemmer.
+ *
+ * Building the library for the query side:
+ * gcc -O2 -Wall -pedantic --std=c99 -shared -fPIC -o libnormalize.so normalize.c
+ */
+
+#include "normalize.h"
+#include "hash.h"
+#include "scan.h"
+#include <string.h>
+
+/* The stopword table is a perfect hash: a bucket picks a displacement, which picks a slot that holds one word only. */
+#define STOPWORD_BUCKET_BITS 6
+#define STOPWORD_BUCKETS (1 << STOPWORD_BUCKET_BITS)
+#define STOPWORD_SLOTS 512
+#define STOPWORD_DISPLACEMENTS 256
+
+static const char* stopwords[] = {
+	"about", "above", "after", "again", "against", "all", "am", "an", "and", "any", "are", "as", "at", "be",
+	"because", "been", "before", "being", "below", "between", "both", "but", "by", "can", "could", "did", "do",
+	"does", "doing", "down", "during", "each", "few", "for", "from", "further", "had", "has", "have", "having", "he",
+	"her", "here", "hers", "herself", "him", "himself", "his", "how", "if", "in", "into", "is", "it", "its", "itself",
+	"just", "me", "more", "most", "my", "myself", "no", "nor", "not", "now", "of", "off", "on", "once", "only", "or",
+	"other", "our", "ours", "ourselves", "out", "over", "own", "same", "she", "should", "so", "some", "such", "than",
+	"that", "the", "their", "theirs", "them", "themselves", "then", "there", "these", "they", "this", "those",
+	"through", "to", "too", "under", "until", "up", "very", "was", "we", "were", "what", "when", "where", "which",
+	"while", "who", "whom", "why", "will", "with", "would", "you", "your", "yours", "yourself", "yourselves"
+};
+
+#define STOPWORDS (sizeof(stopwords) / sizeof(stopwords[0]))
+
+static unsigned char stopwordLengths[STOPWORDS];
+static unsigned char displacements[STOPWORD_BUCKETS];
+/* Index of the stopword plus one, zero if empty. */
+static unsigned char slots[STOPWORD_SLOTS];
+
+/* A word being stemmed: b[0 .. k] is the word, j marks the end of the stem in front of a matched suffix. */
+typedef struct {
+	char* b;
+	int k;
+	int j;
+} Stemmer;
+
+static inline unsigned int stopwordSlot(uint64_t hash, unsigned int displacement) {
+	return hashMultiply(hash, HASH_SECRET1 + displacement) & (STOPWORD_SLOTS - 1);
+}
+
+static int isStopword(const char* token, unsigned int length, uint64_t hash) {
+	unsigned int i = slots[stopwordSlot(hash, displacements[hash >> (64 - STOPWORD_BUCKET_BITS)])];
+
+	return i != 0 && stopwordLengths[i - 1] == length && memcmp(stopwords[i - 1], token, length) == 0;
+}
+
+/*
+Builds the stopword table. Has to be called before any normalizing, i.e. before the tokenizer threads start. Returns
+-1 if a bucket of stopwords cannot be placed with any displacement, which an edit of the list can bring about.
+*/
+int normalizeInit() {
+	uint64_t hashes[STOPWORDS];
+	unsigned int sizes[STOPWORD_BUCKETS];
+	unsigned int placed[STOPWORDS];
+	unsigned int i, size, bucket, displacement, slot, amount;
+
+	memset(sizes, 0, sizeof(sizes));
+	memset(slots, 0, sizeof(slots));
+	for (i = 0; i < STOPWORDS; ++i) {
+		stopwordLengths[i]	= strlen(stopwords[i]);
+		hashes[i]			= hashToken(stopwords[i], stopwordLengths[i]);
+		++sizes[hashes[i] >> (64 - STOPWORD_BUCKET_BITS)];
+	}
+
+	/* The largest buckets are the hardest to place, so they go first. */
+	for (size = STOPWORDS; size > 0; --size) {
+		for (bucket = 0; bucket < STOPWORD_BUCKETS; ++bucket) {
+			if (sizes[bucket] != size) {
+				continue;
+			}
+
+			for (displacement = 0; displacement < STOPWORD_DISPLACEMENTS; ++displacement) {
+				for (i = 0, amount = 0; i < STOPWORDS; ++i) {
+					if (hashes[i] >> (64 - STOPWORD_BUCKET_BITS) != bucket) {
+						continue;
+					}
+
+					slot = stopwordSlot(hashes[i], displacement);
+					if (slots[slot] != 0) {
+						break;
+					}
+
+					slots[slot]			= i + 1;
+					placed[amount++]	= slot;
+				}
+
+				if (i == STOPWORDS) {
+					break;
+				}
+
+				while (amount > 0) {
+					slots[placed[--amount]] = 0;
+				}
+			}
+
+			/* The displacement would not fit, and the stopwords of the bucket would silently not be found. */
+			if (displacement == STOPWORD_DISPLACEMENTS) {
+				return -1;
+			}
+			displacements[bucket] = displacement;
+		}
+	}
+
+	return 0;
+}
+
+/* Simple case folding of the Latin, Greek, Cyrillic and Armenian letters, never to a longer UTF-8 sequence. */
+static unsigned int foldCodePoint(unsigned int c) {
+	if (c >= 0xc0 && c <= 0xde && c != 0xd7) {
+		return c + 0x20;
+	}
+	else if (c >= 0x100 && c <= 0x17f) {
+		if (c == 0x130) {
+			return 'i';
+		}
+		else if (c == 0x178) {
+			return 0xff;
+		}
+		else if (c == 0x17f) {
+			return 's';
+		}
+		else if (c == 0x138 || c == 0x149) {
+			return c;
+		}
+		else if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e)) {
+			return (c & 1) ? c + 1 : c;
+		}
+
+		return c | 1;
+	}
+	else if (c >= 0x386 && c <= 0x3c2) {
+		if (c == 0x386) {
+			return 0x3ac;
+		}
+		else if (c >= 0x388 && c <= 0x38a) {
+			return c + 0x25;
+		}
+		else if (c == 0x38c) {
+			return 0x3cc;
+		}
+		else if (c == 0x38e || c == 0x38f) {
+			return c + 0x3f;
+		}
+		else if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2) {
+			return c + 0x20;
+		}
+		else if (c == 0x3c2) {
+			return 0x3c3;
+		}
+
+		return c;
+	}
+	else if (c >= 0x400 && c <= 0x52f) {
+		if (c <= 0x40f) {
+			return c + 0x50;
+		}
+		else if (c <= 0x42f) {
+			return c + 0x20;
+		}
+		else if ((c >= 0x460 && c <= 0x481) || (c >= 0x48a && c <= 0x4bf) || c >= 0x4d0) {
+			return c | 1;
+		}
+		else if (c == 0x4c0) {
+			return 0x4cf;
+		}
+		else if (c >= 0x4c1 && c <= 0x4ce) {
+			return (c & 1) ? c + 1 : c;
+		}
+
+		return c;
+	}
+	else if (c >= 0x531 && c <= 0x556) {
+		return c + 0x30;
+	}
+	else if ((c >= 0x1e00 && c <= 0x1e95) || (c >= 0x1ea0 && c <= 0x1eff)) {
+		return c | 1;
+	}
+	else if (c == 0x1e9e) {
+		return 0xdf;
+	}
+
+	return c;
+}
+
+/* Case folds a lower cased token in place. Anything that is not valid UTF-8 is kept as is. Returns the new length. */
+static unsigned int foldCase(char* token, unsigned int length) {
+	unsigned char* in = (unsigned char*) token;
+	unsigned char* end = in + length;
+	unsigned char* out = in;
+	unsigned int code, folded, size;
+
+	while (in < end) {
+		if (in[0] >= 0xc0 && in[0] < 0xe0 && end - in >= 2 && (in[1] & 0xc0) == 0x80) {
+			code	= ((in[0] & 0x1f) << 6) | (in[1] & 0x3f);
+			size	= 2;
+		}
+		else if (in[0] >= 0xe0 && in[0] < 0xf0 && end - in >= 3 && (in[1] & 0xc0) == 0x80 && (in[2] & 0xc0) == 0x80) {
+			code	= ((in[0] & 0x0f) << 12) | ((in[1] & 0x3f) << 6) | (in[2] & 0x3f);
+			size	= 3;
+		}
+		else {
+			*out++ = *in++;
+			continue;
+		}
+
+		folded = foldCodePoint(code);
+		if (folded == code) {
+			memmove(out, in, size);
+			out += size;
+		}
+		else if (folded < 0x80) {
+			*out++ = folded;
+		}
+		else if (folded < 0x800) {
+			*out++ = 0xc0 | (folded >> 6);
+			*out++ = 0x80 | (folded & 0x3f);
+		}
+		else {
+			*out++ = 0xe0 | (folded >> 12);
+			*out++ = 0x80 | ((folded >> 6) & 0x3f);
+			*out++ = 0x80 | (folded & 0x3f);
+		}
+
+		in += size;
+	}
+
+	return out - (unsigned char*) token;
+}
+
+/*
+The Porter stemmer, as described in M.F. Porter, An algorithm for suffix stripping, Program 14(3), 1980. It works on
+lower case ASCII words of at least three letters.
+*/
+
+static int consonant(Stemmer* z, int i) {
+	switch (z->b[i]) {
+		case 'a':
+		case 'e':
+		case 'i':
+		case 'o':
+		case 'u':
+			return 0;
+		case 'y':
+			return i == 0 ? 1 : !consonant(z, i - 1);
+		default:
+			return 1;
+	}
+}
+
+/* The amount of vowel consonant sequences in b[0 .. j]. */
+static int measure(Stemmer* z) {
+	int n = 0;
+	int i = 0;
+
+	while (i <= z->j && consonant(z, i)) {
+		++i;
+	}
+
+	while (i <= z->j) {
+		while (i <= z->j && !consonant(z, i)) {
+			++i;
+		}
+
+		if (i > z->j) {
+			break;
+		}
+
+		++n;
+		while (i <= z->j && consonant(z, i)) {
+			++i;
+		}
+	}
+
+	return n;
+}
+
+static int vowelInStem(Stemmer* z) {
+	int i;
+
+	for (i = 0; i <= z->j; ++i) {
+		if (!consonant(z, i)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int doubleConsonant(Stemmer* z, int i) {
+	return i >= 1 && z->b[i] == z->b[i - 1] && consonant(z, i);
+}
+
+/* Whether b[i - 2 .. i] is consonant, vowel, consonant, and the latter is not w, x or y. */
+static int cvc(Stemmer* z, int i) {
+	if (i < 2 || !consonant(z, i) || consonant(z, i - 1) || !consonant(z, i - 2)) {
+		return 0;
+	}
+
+	return z->b[i] != 'w' && z->b[i] != 'x' && z->b[i] != 'y';
+}
+
+/* Whether the word ends in suffix, if so j is set in front of it. */
+static int ends(Stemmer* z, const char* suffix) {
+	int length = strlen(suffix);
+
+	if (length > z->k + 1 || memcmp(z->b + z->k - length + 1, suffix, length) != 0) {
+		return 0;
+	}
+
+	z->j = z->k - length;
+	return 1;
+}
+
+/* Replaces b[j + 1 .. k] by suffix. */
+static void setTo(Stemmer* z, const char* suffix) {
+	int length = strlen(suffix);
+
+	memmove(z->b + z->j + 1, suffix, length);
+	z->k = z->j + length;
+}
+
+static void replace(Stemmer* z, const char* suffix) {
+	if (measure(z) > 0) {
+		setTo(z, suffix);
+	}
+}
+
+/* Plurals and -ed or -ing. */
+static void step1ab(Stemmer* z) {
+	char c;
+
+	if (z->b[z->k] == 's') {
+		if (ends(z, "sses")) {
+			z->k -= 2;
+		}
+		else if (ends(z, "ies")) {
+			setTo(z, "i");
+		}
+		else if (z->b[z->k - 1] != 's') {
+			--z->k;
+		}
+	}
+
+	if (ends(z, "eed")) {
+		if (measure(z) > 0) {
+			--z->k;
+		}
+	}
+	else if ((ends(z, "ed") || ends(z, "ing")) && vowelInStem(z)) {
+		z->k = z->j;
+		if (ends(z, "at")) {
+			setTo(z, "ate");
+		}
+		else if (ends(z, "bl")) {
+			setTo(z, "ble");
+		}
+		else if (ends(z, "iz")) {
+			setTo(z, "ize");
+		}
+		else if (doubleConsonant(z, z->k)) {
+			c = z->b[z->k];
+			if (c != 'l' && c != 's' && c != 'z') {
+				--z->k;
+			}
+		}
+		else {
+			z->j = z->k;
+			if (measure(z) == 1 && cvc(z, z->k)) {
+				setTo(z, "e");
+			}
+		}
+	}
+}
+
+/* Terminal y to i when there is another vowel in the stem. */
+static void step1c(Stemmer* z) {
+	if (ends(z, "y") && vowelInStem(z)) {
+		z->b[z->k] = 'i';
+	}
+}
+
+/* Double suffixes to single ones. */
+static void step2(Stemmer* z) {
+	switch (z->b[z->k - 1]) {
+		case 'a':
+			if (ends(z, "ational")) { replace(z, "ate"); }
+			else if (ends(z, "tional")) { replace(z, "tion"); }
+			break;
+		case 'c':
+			if (ends(z, "enci")) { replace(z, "ence"); }
+			else if (ends(z, "anci")) { replace(z, "ance"); }
+			break;
+		case 'e':
+			if (ends(z, "izer")) { replace(z, "ize"); }
+			break;
+		case 'l':
+			if (ends(z, "abli")) { replace(z, "able"); }
+			else if (ends(z, "alli")) { replace(z, "al"); }
+			else if (ends(z, "entli")) { replace(z, "ent"); }
+			else if (ends(z, "eli")) { replace(z, "e"); }
+			else if (ends(z, "ousli")) { replace(z, "ous"); }
+			break;
+		case 'o':
+			if (ends(z, "ization")) { replace(z, "ize"); }
+			else if (ends(z, "ation")) { replace(z, "ate"); }
+			else if (ends(z, "ator")) { replace(z, "ate"); }
+			break;
+		case 's':
+			if (ends(z, "alism")) { replace(z, "al"); }
+			else if (ends(z, "iveness")) { replace(z, "ive"); }
+			else if (ends(z, "fulness")) { replace(z, "ful"); }
+			else if (ends(z, "ousness")) { replace(z, "ous"); }
+			break;
+		case 't':
+			if (ends(z, "aliti")) { replace(z, "al"); }
+			else if (ends(z, "iviti")) { replace(z, "ive"); }
+			else if (ends(z, "biliti")) { replace(z, "ble"); }
+			break;
+	}
+}
+
+/* -ic-, -full, -ness etc. */
+static void step3(Stemmer* z) {
+	switch (z->b[z->k]) {
+		case 'e':
+			if (ends(z, "icate")) { replace(z, "ic"); }
+			else if (ends(z, "ative")) { replace(z, ""); }
+			else if (ends(z, "alize")) { replace(z, "al"); }
+			break;
+		case 'i':
+			if (ends(z, "iciti")) { replace(z, "ic"); }
+			break;
+		case 'l':
+			if (ends(z, "ical")) { replace(z, "ic"); }
+			else if (ends(z, "ful")) { replace(z, ""); }
+			break;
+		case 's':
+			if (ends(z, "ness")) { replace(z, ""); }
+			break;
+	}
+}
+
+/* -ant, -ence etc. when there are at least two vowel consonant sequences in front of them. */
+static void step4(Stemmer* z) {
+	int found = 0;
+
+	switch (z->b[z->k - 1]) {
+		case 'a':
+			found = ends(z, "al");
+			break;
+		case 'c':
+			found = ends(z, "ance") || ends(z, "ence");
+			break;
+		case 'e':
+			found = ends(z, "er");
+			break;
+		case 'i':
+			found = ends(z, "ic");
+			break;
+		case 'l':
+			found = ends(z, "able") || ends(z, "ible");
+			break;
+		case 'n':
+			found = ends(z, "ant") || ends(z, "ement") || ends(z, "ment") || ends(z, "ent");
+			break;
+		case 'o':
+			found = (ends(z, "ion") && z->j >= 0 && (z->b[z->j] == 's' || z->b[z->j] == 't')) || ends(z, "ou");
+			break;
+		case 's':
+			found = ends(z, "ism");
+			break;
+		case 't':
+			found = ends(z, "ate") || ends(z, "iti");
+			break;
+		case 'u':
+			found = ends(z, "ous");
+			break;
+		case 'v':
+			found = ends(z, "ive");
+			break;
+		case 'z':
+			found = ends(z, "ize");
+			break;
+	}
+
+	if (found && measure(z) > 1) {
+		z->k = z->j;
+	}
+}
+
+/* A final -e and -ll. */
+static void step5(Stemmer* z) {
+	int m;
+
+	z->j = z->k;
+	if (z->b[z->k] == 'e') {
+		m = measure(z);
+		if (m > 1 || (m == 1 && !cvc(z, z->k - 1))) {
+			--z->k;
+		}
+	}
+
+	if (z->b[z->k] == 'l' && doubleConsonant(z, z->k) && measure(z) > 1) {
+		--z->k;
+	}
+}
+
+/* Stems a word in place, returns its new length. */
+static unsigned int stem(char* word, unsigned int length) {
+	Stemmer z;
+
+	z.b	= word;
+	z.k	= length - 1;
+	z.j	= z.k;
+
+	step1ab(&z);
+	if (z.k > 0) {
+		step1c(&z);
+		step2(&z);
+		step3(&z);
+		step4(&z);
+		step5(&z);
+	}
+
+	return z.k + 1;
+}
+
+/*
+Normalizes a token in place, it may only get shorter. Returns its new length, 0 if it is a stopword, and sets hash to
+the hash of the result, see hash.h.
+*/
+unsigned int normalizeToken(char* token, unsigned int length, int flags, uint64_t* hash) {
+	unsigned int i;
+	int ascii = 1;
+
+	for (i = 0; i < length; ++i) {
+		if (token[i] >= 'A' && token[i] <= 'Z') {
+			token[i] += 0x20;
+		}
+		else if ((unsigned char) token[i] >= 0x80) {
+			ascii = 0;
+		}
+	}
+
+	if (!ascii && (flags & NORMALIZE_FOLD)) {
+		length = foldCase(token, length);
+	}
+
+	*hash = hashToken(token, length);
+	if ((flags & NORMALIZE_STOPWORDS) && isStopword(token, length, *hash)) {
+		return 0;
+	}
+
+	if ((flags & NORMALIZE_STEM) && ascii && length > 2) {
+		length	= stem(token, length);
+		*hash	= hashToken(token, length);
+	}
+
+	return length;
+}
+
+/*
+Splits text into tokens like the tokenizer does, apart from its handling of markup, and normalizes them. The terms
+are written to terms separated by spaces and zero terminated, terms has to hold length + 1 bytes. Returns the amount
+of terms.
+*/
+unsigned long normalizeText(const char* text, unsigned long length, int flags, char* terms) {
+	const char* end = text + length;
+	const char* begin;
+	char* term = terms;
+	char token[NORMALIZE_MAX_LENGTH];
+	unsigned long amount = 0;
+	unsigned int size;
+	uint64_t hash;
+
+	while (text < end) {
+		for (begin = text; text < end && scanWordByte(*text); ++text);
+		size = text - begin;
+
+		/* Just like the tokenizer, U+2000 to U+203F (0xe2 0x80 ..) delimit words. */
+		if (size > 0 && text < end && (unsigned char) *text == 0x80 && (unsigned char) text[-1] == 0xe2) {
+			--size;
+			++text;
+		}
+
+		if (text < end) {
+			++text;
+		}
+
+		if (size < NORMALIZE_MIN_LENGTH || size > NORMALIZE_MAX_LENGTH) {
+			continue;
+		}
+
+		memcpy(token, begin, size);
+		size = normalizeToken(token, size, flags, &hash);
+		if (size < NORMALIZE_MIN_LENGTH) {
+			continue;
+		}
+
+		if (term != terms) {
+			*term++ = ' ';
+		}
+
+		memcpy(term, token, size);
+		term += size;
+		++amount;
+	}
+
+	*term = 0;
+	return amount;
+}
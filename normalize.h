@@ -0,0 +1,24 @@
+/**
+ * normalize.h
+ */
+
+#ifndef NORMALIZE_H_
+#define NORMALIZE_H_
+
+#include <stdint.h>
+
+/* Steps on top of lower casing ASCII, which is always done. */
+#define NORMALIZE_FOLD 1
+#define NORMALIZE_STOPWORDS 2
+#define NORMALIZE_STEM 4
+
+/* Tokens outside of these lengths, in bytes, are ignored. */
+#define NORMALIZE_MIN_LENGTH 2
+#define NORMALIZE_MAX_LENGTH 48
+
+int				normalizeInit();
+unsigned int	normalizeToken(char* token, unsigned int length, int flags, uint64_t* hash);
+unsigned long	normalizeText(const char* text, unsigned long length, int flags, char* terms);
+
+
+#endif /* NORMALIZE_H_ */
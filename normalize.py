@@ -0,0 +1,24 @@
+import ctypes
+import os
+
+# The term normalization of the tokenizer (see normalize.c), so that queries are split and normalized just like the
+# documents were. Flags are the tokenizer options the index was built with, e.g. 'fold-case,stopwords,stem'.
+FLAGS = {'fold-case': 1, 'stopwords': 2, 'stem': 4}
+
+class Normalizer(object):
+	def __init__(self, flags='', library='libnormalize.so'):
+		self.flags = 0
+		for flag in flags.split(','):
+			if flag:
+				self.flags |= FLAGS[flag]
+		self.library = ctypes.CDLL(os.path.abspath(library))
+		self.library.normalizeInit()
+		self.library.normalizeText.restype = ctypes.c_ulong
+		self.library.normalizeText.argtypes = [ctypes.c_char_p, ctypes.c_ulong, ctypes.c_int, ctypes.c_char_p]
+
+	def terms(self, text):
+		if not isinstance(text, bytes):
+			text = text.encode('utf-8')
+		terms = ctypes.create_string_buffer(len(text) + 1)
+		self.library.normalizeText(text, len(text), self.flags, terms)
+		return terms.value.decode('utf-8').split()
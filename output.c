@@ -0,0 +1,155 @@
+/**
+ * output.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "output.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static Output* outputOpenFlags(const char* path, int flags) {
+	Output* output;
+
+	output			= (Output *) calloc(1, sizeof(Output));
+	output->fd		= open(path, flags, 0666);
+	output->buffer	= (char *) malloc(OUTPUT_BUFFER_SIZE);
+	output->size	= OUTPUT_BUFFER_SIZE;
+
+	if (output->fd < 0 || output->buffer == NULL) {
+		if (output->fd >= 0) {
+			close(output->fd);
+		}
+		free(output->buffer);
+		free(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+Output* outputOpen(const char* path) {
+	return outputOpenFlags(path, O_WRONLY | O_CREAT | O_TRUNC);
+}
+
+/* Opens an existing file, or a new one, to write after its current end. */
+Output* outputAppend(const char* path) {
+	Output* output;
+	off_t end;
+
+	output = outputOpenFlags(path, O_WRONLY | O_CREAT);
+	if (output == NULL) {
+		return NULL;
+	}
+
+	end = lseek(output->fd, 0, SEEK_END);
+	if (end < 0) {
+		outputClose(output);
+		return NULL;
+	}
+	output->flushed = end;
+
+	return output;
+}
+
+static int flush(Output* output) {
+	unsigned long written = 0;
+	ssize_t result;
+
+	while (written < output->used && !output->error) {
+		result = write(output->fd, output->buffer + written, output->used - written);
+		if (result < 0) {
+			output->error = 1;
+		}
+		else {
+			written += result;
+		}
+	}
+
+	output->flushed	+= output->used;
+	output->used	= 0;
+
+	return output->error ? -1 : 0;
+}
+
+int outputWrite(Output* output, const char* data, unsigned long size) {
+	unsigned long part;
+
+	while (size > 0) {
+		if (output->used == output->size && flush(output) != 0) {
+			return -1;
+		}
+
+		part = output->size - output->used;
+		if (part > size) {
+			part = size;
+		}
+
+		memcpy(output->buffer + output->used, data, part);
+		output->used	+= part;
+		data			+= part;
+		size			-= part;
+	}
+
+	return output->error ? -1 : 0;
+}
+
+int outputChar(Output* output, char c) {
+	if (output->used == output->size && flush(output) != 0) {
+		return -1;
+	}
+
+	output->buffer[output->used++] = c;
+
+	return output->error ? -1 : 0;
+}
+
+/* Decimal representation, the digits are produced from the back two at a time. */
+int outputNumber(Output* output, unsigned long number) {
+	static const char pairs[] =
+		"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+		"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char digits[24];
+	char* end = digits + sizeof(digits);
+	char* begin = end;
+
+	while (number >= 100) {
+		begin -= 2;
+		memcpy(begin, pairs + (number % 100) * 2, 2);
+		number /= 100;
+	}
+
+	if (number >= 10) {
+		begin -= 2;
+		memcpy(begin, pairs + number * 2, 2);
+	}
+	else {
+		*--begin = '0' + number;
+	}
+
+	if (output->size - output->used < sizeof(digits)) {
+		return outputWrite(output, begin, end - begin);
+	}
+
+	memcpy(output->buffer + output->used, begin, end - begin);
+	output->used += end - begin;
+
+	return output->error ? -1 : 0;
+}
+
+int outputClose(Output* output) {
+	int result;
+
+	result = flush(output);
+	if (close(output->fd) != 0) {
+		result = -1;
+	}
+
+	free(output->buffer);
+	free(output);
+
+	return result;
+}
@@ -0,0 +1,31 @@
+/**
+ * output.h
+ */
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+/* Buffer size of the text outputs. */
+#define OUTPUT_BUFFER_SIZE (8 * 1024 * 1024)
+
+/* Buffered writer for the text outputs, without the format string parsing and locale handling of stdio. */
+typedef struct {
+	int fd;
+	char* buffer;
+	unsigned long size;
+	unsigned long used;
+	/* Bytes flushed to the file so far. */
+	unsigned long flushed;
+	/* Set by the first failing write, later writes are dropped. */
+	int error;
+} Output;
+
+Output*			outputOpen(const char* path);
+Output*			outputAppend(const char* path);
+int				outputWrite(Output* output, const char* data, unsigned long size);
+int				outputChar(Output* output, char c);
+int				outputNumber(Output* output, unsigned long number);
+int				outputClose(Output* output);
+
+
+#endif /* OUTPUT_H_ */
@@ -0,0 +1,77 @@
+/**
+ * queue.c
+ */
+
+#include "queue.h"
+#include <stdlib.h>
+
+Queue* queueInit(unsigned int capacity) {
+	Queue* queue;
+
+	queue				= (Queue *) malloc(sizeof(Queue));
+	queue->items		= (void **) malloc(sizeof(void*) * capacity);
+	queue->capacity		= capacity;
+	queue->head			= 0;
+	queue->size			= 0;
+	queue->closed		= 0;
+
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->notEmpty, NULL);
+	pthread_cond_init(&queue->notFull, NULL);
+
+	return queue;
+}
+
+/* Blocks while the queue is full. */
+void queuePush(Queue* queue, void* item) {
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->size == queue->capacity) {
+		pthread_cond_wait(&queue->notFull, &queue->lock);
+	}
+
+	queue->items[(queue->head + queue->size) % queue->capacity] = item;
+	++queue->size;
+
+	pthread_cond_signal(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/* Blocks while the queue is empty. Returns NULL once the queue is closed and drained. */
+void* queuePop(Queue* queue) {
+	void* item = NULL;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->size == 0 && !queue->closed) {
+		pthread_cond_wait(&queue->notEmpty, &queue->lock);
+	}
+
+	if (queue->size != 0) {
+		item		= queue->items[queue->head];
+		queue->head	= (queue->head + 1) % queue->capacity;
+		--queue->size;
+
+		pthread_cond_signal(&queue->notFull);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return item;
+}
+
+/* Wakes up every consumer; items still queued can be popped afterwards. */
+void queueClose(Queue* queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void queueDestroy(Queue* queue) {
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->notEmpty);
+	pthread_cond_destroy(&queue->notFull);
+	free(queue->items);
+	free(queue);
+}
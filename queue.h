@@ -0,0 +1,30 @@
+/**
+ * queue.h
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <pthread.h>
+
+/* Bounded blocking FIFO of pointers, shared between threads. */
+typedef struct {
+	void** items;
+	unsigned int capacity;
+	unsigned int head;
+	unsigned int size;
+	int closed;
+
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+} Queue;
+
+Queue*	queueInit(unsigned int capacity);
+void	queuePush(Queue* queue, void* item);
+void*	queuePop(Queue* queue);
+void	queueClose(Queue* queue);
+void	queueDestroy(Queue* queue);
+
+
+#endif /* QUEUE_H_ */
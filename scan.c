@@ -0,0 +1,137 @@
+/**
+ * scan.c
+ *
+ * Classifies the bytes of a page into word bytes and delimiters, 64 at a time, with SSE2 or AVX2 if the CPU has
+ * them. The vector versions are compiled for their instruction set on their own and are picked at run time.
+ */
+
+#include "scan.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define CLASS_WORD 1
+#define CLASS_TRIGGER 2
+
+/* Zero for delimiters that need no further processing. */
+static unsigned char classes[256];
+
+static void classifyScalar(const char* text, uint64_t* word, uint64_t* stop) {
+	unsigned char c;
+	int i;
+
+	*word = *stop = 0;
+	for (i = 0; i < 64; ++i) {
+		c = classes[(unsigned char) text[i]];
+		*word	|= (uint64_t) (c & CLASS_WORD) << i;
+		*stop	|= (uint64_t) (c != 0) << i;
+	}
+}
+
+static void (*classify)(const char* text, uint64_t* word, uint64_t* stop) = classifyScalar;
+
+#ifdef SCAN_X86
+
+/*
+Bytes as signed numbers: letters are those for which (c | 0x20) + 31 wraps to -128 .. -103, and anything from 129
+on is negative except for -128 itself.
+*/
+__attribute__((target("sse2")))
+static void classifySSE2(const char* text, uint64_t* word, uint64_t* stop) {
+	__m128i bytes, letters, high, triggers;
+	uint64_t wordBits, triggerBits;
+	int i;
+
+	*word = *stop = 0;
+	for (i = 0; i < 64; i += 16) {
+		bytes		= _mm_loadu_si128((const __m128i*) (text + i));
+		letters		= _mm_cmplt_epi8(_mm_add_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), _mm_set1_epi8(31)),
+			_mm_set1_epi8(-102));
+		high		= _mm_and_si128(_mm_cmplt_epi8(bytes, _mm_setzero_si128()),
+			_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-128)));
+		triggers	= _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('{')),
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8('<'))), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('[')));
+
+		wordBits	= (unsigned int) _mm_movemask_epi8(_mm_or_si128(letters, high));
+		triggerBits	= (unsigned int) _mm_movemask_epi8(triggers);
+		*word		|= wordBits << i;
+		*stop		|= (wordBits | triggerBits) << i;
+	}
+}
+
+__attribute__((target("avx2")))
+static void classifyAVX2(const char* text, uint64_t* word, uint64_t* stop) {
+	__m256i bytes, letters, high, triggers;
+	uint64_t wordBits, triggerBits;
+	int i;
+
+	*word = *stop = 0;
+	for (i = 0; i < 64; i += 32) {
+		bytes		= _mm256_loadu_si256((const __m256i*) (text + i));
+		letters		= _mm256_cmpgt_epi8(_mm256_set1_epi8(-102), _mm256_add_epi8(_mm256_or_si256(bytes,
+			_mm256_set1_epi8(0x20)), _mm256_set1_epi8(31)));
+		high		= _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), bytes),
+			_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-128)));
+		triggers	= _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('{')),
+			_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('<'))), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('[')));
+
+		wordBits	= (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(letters, high));
+		triggerBits	= (unsigned int) _mm256_movemask_epi8(triggers);
+		*word		|= wordBits << i;
+		*stop		|= (wordBits | triggerBits) << i;
+	}
+}
+
+#endif /* SCAN_X86 */
+
+/* Classifies the 64 bytes from text on, the last block of a page is padded. */
+void scanBlock(Scan* scan, const char* text) {
+	char padded[64];
+	unsigned long remaining = scan->end - text;
+
+	scan->block = text;
+	if (remaining >= 64) {
+		classify(text, &scan->word, &scan->stop);
+		return;
+	}
+
+	/* Zero bytes are plain delimiters, so only stop needs fixing up. */
+	memset(padded, 0, sizeof(padded));
+	memcpy(padded, text, remaining);
+	classify(padded, &scan->word, &scan->stop);
+	scan->stop |= ~(uint64_t) 0 << remaining;
+}
+
+/* Has to be called before any scanning, i.e. before the tokenizer threads start. */
+void scanInit(int vectorized) {
+	unsigned int c;
+
+	/* See scanWordByte for what a delimiter is. */
+	for (c = 0; c < 256; ++c) {
+		if (scanWordByte(c)) {
+			classes[c] = CLASS_WORD;
+		}
+		else if (c == '{' || c == '<' || c == '[') {
+			classes[c] = CLASS_TRIGGER;
+		}
+	}
+
+	classify = classifyScalar;
+
+#ifdef SCAN_X86
+	if (!vectorized) {
+		return;
+	}
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		classify = classifyAVX2;
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		classify = classifySSE2;
+	}
+#endif
+}
@@ -0,0 +1,75 @@
+/**
+ * scan.h
+ */
+
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdint.h>
+
+/* Classification of the 64 bytes from block on, bit i describes block[i]. Bytes from end on stop any scan. */
+typedef struct {
+	const char* block;
+	const char* end;
+	/* Word bytes, i.e. anything but delimiters. */
+	uint64_t word;
+	/* Word bytes and the delimiters that start markup: {, < and [. */
+	uint64_t stop;
+} Scan;
+
+/*
+Delimiters are any spaces, tabs, control characters, etc.
+Specifically: 0 <= c <= 64 && 91 <= c <= 96 && 123 <= c <= 128
+We assume any UTF-8 encoded character with code point > 128 is NOT a delimiter.
+*/
+static inline int scanWordByte(unsigned char c) {
+	return !(c <= 64 || (c >= 91 && c <= 96) || (c >= 123 && c <= 128));
+}
+
+void scanInit(int vectorized);
+void scanBlock(Scan* scan, const char* text);
+
+/* Returns the first delimiter at or after text, or end. */
+static inline const char* scanWord(Scan* scan, const char* text) {
+	uint64_t bits;
+
+	while (text < scan->end) {
+		if (text < scan->block || text >= scan->block + 64) {
+			scanBlock(scan, text);
+		}
+
+		bits = ~scan->word >> (text - scan->block);
+		if (bits != 0) {
+			text += __builtin_ctzll(bits);
+			return text < scan->end ? text : scan->end;
+		}
+
+		text = scan->block + 64;
+	}
+
+	return scan->end;
+}
+
+/* Returns the first word byte or markup delimiter at or after text, or end. */
+static inline const char* scanDelimiters(Scan* scan, const char* text) {
+	uint64_t bits;
+
+	while (text < scan->end) {
+		if (text < scan->block || text >= scan->block + 64) {
+			scanBlock(scan, text);
+		}
+
+		bits = scan->stop >> (text - scan->block);
+		if (bits != 0) {
+			text += __builtin_ctzll(bits);
+			return text < scan->end ? text : scan->end;
+		}
+
+		text = scan->block + 64;
+	}
+
+	return scan->end;
+}
+
+
+#endif /* SCAN_H_ */
@@ -0,0 +1,528 @@
+/**
+ * search.c
+ *
+ * Exhaustive search of the similarity index (see similarity.h) for the k documents most similar to a query. Rows are
+ * scored a block at a time, with AVX2 and FMA if the CPU has them, and only the scores that beat the worst of the k
+ * best so far go into a bounded heap, so there is no sort over all documents. A searcher splits the rows over a pool
+ * of threads, each with a heap of its own, and merges the heaps at the end.
+ *
+ * An int8 index is scored with integer dot products against the query quantized to int16, a quarter of the memory
+ * traffic of float32. Its ranking is approximate, so a searcher can take a few hundred candidates from it and
+ * re-rank them against an exact index of the same documents.
+ *
+ * Building the library for the query side:
+ * gcc -O2 -Wall -pedantic --std=c99 -pthread -shared -fPIC -o libsearch.so search.c similarity.c queue.c matrix.c \
+ *	output.c ivf.c -lm
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "search.h"
+#include "queue.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+/* Rows scored before the scores are selected from. */
+#define SEARCH_BLOCK_ROWS 256
+
+/* Largest value of a quantized query, small enough that int32 sums of int8 products cannot overflow. */
+#define SEARCH_QUERY_RANGE 4096
+
+/* Scores amount rows, stride bytes apart, against a query of length values, int16 for int8 rows and float else. */
+typedef void (*Score)(const char* rows, unsigned long stride, unsigned long amount, const void* query,
+	unsigned long length, float* scores);
+
+/* Rows of a searcher thread, and the best of them. */
+typedef struct {
+	struct Searcher* searcher;
+	unsigned long begin;
+	unsigned long end;
+	SearchResult* results;
+	unsigned int amount;
+} SearchTask;
+
+struct Searcher {
+	const SimilarityIndex* index;
+	unsigned int threads;
+	pthread_t* workers;
+	SearchTask* tasks;
+	Queue* pending;
+	Queue* done;
+	/* Queries are answered one at a time, each by all threads. */
+	pthread_mutex_t lock;
+	unsigned int capacity;
+
+	/* The current query. */
+	const float* query;
+	unsigned int k;
+
+	/* Re-ranking, see searcherRerank. */
+	const SimilarityIndex* exact;
+	unsigned int candidates;
+	SearchResult* merged;
+};
+
+static void scoreFloatScalar(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const float* query = (const float*) values;
+	const float* row;
+	unsigned long i, j;
+	float sum;
+
+	for (i = 0; i < amount; ++i) {
+		row = (const float*) (rows + i * stride);
+		for (j = 0, sum = 0; j < length; ++j) {
+			sum += row[j] * query[j];
+		}
+		scores[i] = sum;
+	}
+}
+
+static void scoreHalfScalar(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const float* query = (const float*) values;
+	const uint16_t* row;
+	unsigned long i, j;
+	float sum;
+
+	for (i = 0; i < amount; ++i) {
+		row = (const uint16_t*) (rows + i * stride);
+		for (j = 0, sum = 0; j < length; ++j) {
+			sum += similarityFromHalf(row[j]) * query[j];
+		}
+		scores[i] = sum;
+	}
+}
+
+static void scoreInt8Scalar(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const int16_t* query = (const int16_t*) values;
+	const int8_t* row;
+	unsigned long i, j;
+	int32_t sum;
+
+	for (i = 0; i < amount; ++i) {
+		row = (const int8_t*) (rows + i * stride);
+		for (j = 0, sum = 0; j < length; ++j) {
+			sum += row[j] * query[j];
+		}
+		scores[i] = sum;
+	}
+}
+
+static Score scoreFloat = scoreFloatScalar;
+static Score scoreHalf = scoreHalfScalar;
+static Score scoreInt8 = scoreInt8Scalar;
+
+#ifdef SEARCH_X86
+
+__attribute__((target("avx2")))
+static inline float sum256(__m256 sum) {
+	__m128 half;
+
+	half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_movehdup_ps(half));
+
+	return _mm_cvtss_f32(half);
+}
+
+/* Rows and query are padded with zeros to a multiple of 16 values, see SIMILARITY_ROW_ALIGNMENT. */
+__attribute__((target("avx2,fma")))
+static void scoreFloatAVX2(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const float* query = (const float*) values;
+	const float* row;
+	__m256 sum0, sum1;
+	unsigned long i, j;
+
+	for (i = 0; i < amount; ++i) {
+		row		= (const float*) (rows + i * stride);
+		sum0	= _mm256_setzero_ps();
+		sum1	= _mm256_setzero_ps();
+		for (j = 0; j < length; j += 16) {
+			sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j), _mm256_loadu_ps(query + j), sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(row + j + 8), _mm256_loadu_ps(query + j + 8), sum1);
+		}
+		scores[i] = sum256(_mm256_add_ps(sum0, sum1));
+	}
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static void scoreHalfAVX2(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const float* query = (const float*) values;
+	const uint16_t* row;
+	__m256 sum0, sum1;
+	unsigned long i, j;
+
+	for (i = 0; i < amount; ++i) {
+		row		= (const uint16_t*) (rows + i * stride);
+		sum0	= _mm256_setzero_ps();
+		sum1	= _mm256_setzero_ps();
+		for (j = 0; j < length; j += 16) {
+			sum0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (row + j))),
+				_mm256_loadu_ps(query + j), sum0);
+			sum1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (row + j + 8))),
+				_mm256_loadu_ps(query + j + 8), sum1);
+		}
+		scores[i] = sum256(_mm256_add_ps(sum0, sum1));
+	}
+}
+
+/* Rows and query are padded with zeros to a multiple of 16 values, see SIMILARITY_INT8_ALIGNMENT. */
+__attribute__((target("avx2")))
+static void scoreInt8AVX2(const char* rows, unsigned long stride, unsigned long amount, const void* values,
+	unsigned long length, float* scores) {
+	const int16_t* query = (const int16_t*) values;
+	const int8_t* row;
+	__m256i sum;
+	__m128i half;
+	unsigned long i, j;
+
+	for (i = 0; i < amount; ++i) {
+		row = (const int8_t*) (rows + i * stride);
+		sum = _mm256_setzero_si256();
+		for (j = 0; j < length; j += 16) {
+			sum = _mm256_add_epi32(sum, _mm256_madd_epi16(
+				_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (row + j))),
+				_mm256_loadu_si256((const __m256i*) (query + j))));
+		}
+
+		half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4e));
+		half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xb1));
+		scores[i] = _mm_cvtsi128_si32(half);
+	}
+}
+
+#endif /* SEARCH_X86 */
+
+/* Has to be called before any search. */
+void searchInit(int vectorized) {
+	scoreFloat	= scoreFloatScalar;
+	scoreHalf	= scoreHalfScalar;
+	scoreInt8	= scoreInt8Scalar;
+
+#ifdef SEARCH_X86
+	if (!vectorized) {
+		return;
+	}
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scoreInt8 = scoreInt8AVX2;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		scoreFloat = scoreFloatAVX2;
+		if (__builtin_cpu_supports("f16c")) {
+			scoreHalf = scoreHalfAVX2;
+		}
+	}
+#endif
+}
+
+/* Less similar, or as similar but further down the index, so that ties do not depend on the amount of threads. */
+static inline int worse(const SearchResult* a, const SearchResult* b) {
+	return a->similarity < b->similarity || (a->similarity == b->similarity && a->row > b->row);
+}
+
+/* Offers a result to a heap of at most k results with the worst on top. Returns the new size of the heap. */
+static unsigned int offer(SearchResult* heap, unsigned int size, unsigned int k, const SearchResult* result) {
+	unsigned int i, child;
+
+	if (size < k) {
+		for (i = size; i > 0 && worse(result, &heap[(i - 1) / 2]); i = (i - 1) / 2) {
+			heap[i] = heap[(i - 1) / 2];
+		}
+		heap[i] = *result;
+
+		return size + 1;
+	}
+
+	if (!worse(&heap[0], result)) {
+		return size;
+	}
+
+	for (i = 0; (child = i * 2 + 1) < size; i = child) {
+		if (child + 1 < size && worse(&heap[child + 1], &heap[child])) {
+			++child;
+		}
+		if (!worse(&heap[child], result)) {
+			break;
+		}
+		heap[i] = heap[child];
+	}
+	heap[i] = *result;
+
+	return size;
+}
+
+/* Best first. */
+static int compareResults(const void* a, const void* b) {
+	return worse((const SearchResult*) a, (const SearchResult*) b) ? 1 : -1;
+}
+
+/*
+Scales the query to unit length and pads it with zeros like the rows, quantized for int8 so that the int8 score times
+scale is the similarity. Sets length to the values to score.
+*/
+static void* prepareQuery(const SimilarityIndex* index, const float* query, unsigned long* length, float* scale) {
+	unsigned long i;
+	double norm = 0, largest = 0;
+	void* padded;
+
+	*length	= index->header.rowStride / similarityValueSize(index->header.valueType);
+	padded	= calloc(*length, sizeof(float));
+	for (i = 0; i < index->header.dimensions; ++i) {
+		norm += (double) query[i] * query[i];
+		if (fabs(query[i]) > largest) {
+			largest = fabs(query[i]);
+		}
+	}
+	norm = norm > 0 ? 1 / sqrt(norm) : 0;
+
+	if (index->header.valueType != SIMILARITY_INT8) {
+		for (i = 0; i < index->header.dimensions; ++i) {
+			((float*) padded)[i] = query[i] * norm;
+		}
+		*scale = 1;
+
+		return padded;
+	}
+
+	for (i = 0; i < index->header.dimensions; ++i) {
+		((int16_t*) padded)[i] = largest > 0 ? lrint(query[i] * SEARCH_QUERY_RANGE / largest) : 0;
+	}
+	*scale = largest * norm / SEARCH_QUERY_RANGE;
+
+	return padded;
+}
+
+/* Similarities of amount rows from row on to a query from prepareQuery. */
+static void scoreRows(const SimilarityIndex* index, const void* query, unsigned long length, float scale,
+	unsigned long row, unsigned long amount, float* scores) {
+	unsigned long i;
+
+	switch (index->header.valueType) {
+	case SIMILARITY_INT8:
+		scoreInt8(similarityRow(index, row), index->header.rowStride, amount, query, length, scores);
+		for (i = 0; i < amount; ++i) {
+			scores[i] *= index->scales[row + i] * scale;
+		}
+		break;
+	case SIMILARITY_FLOAT16:
+		scoreHalf(similarityRow(index, row), index->header.rowStride, amount, query, length, scores);
+		break;
+	default:
+		scoreFloat(similarityRow(index, row), index->header.rowStride, amount, query, length, scores);
+	}
+}
+
+/*
+Finds the k rows most similar to the query, which is in topic space and need not be of unit length, in amount ranges
+of rows: ranges[2 i] up to ranges[2 i + 1]. Deleted documents are skipped. The results are sorted, best first;
+returns their amount.
+*/
+unsigned int searchRanges(const SimilarityIndex* index, const float* query, const unsigned long* ranges,
+	unsigned int amount, unsigned int k, SearchResult* results) {
+	unsigned long length, block, rows, i;
+	unsigned int size = 0;
+	unsigned int range;
+	float scores[SEARCH_BLOCK_ROWS];
+	float scale;
+	void* padded;
+	SearchResult result;
+
+	if (k == 0 || amount == 0) {
+		return 0;
+	}
+
+	padded = prepareQuery(index, query, &length, &scale);
+	for (range = 0; range < amount; ++range) {
+		for (block = ranges[range * 2]; block < ranges[range * 2 + 1]; block += rows) {
+			rows = ranges[range * 2 + 1] - block < SEARCH_BLOCK_ROWS ? ranges[range * 2 + 1] - block :
+				SEARCH_BLOCK_ROWS;
+			scoreRows(index, padded, length, scale, block, rows, scores);
+
+			for (i = 0; i < rows; ++i) {
+				if ((size == k && scores[i] < results[0].similarity) || similarityDeleted(index, block + i)) {
+					continue;
+				}
+
+				result.row			= block + i;
+				result.similarity	= scores[i];
+				size				= offer(results, size, k, &result);
+			}
+		}
+	}
+
+	free(padded);
+	qsort(results, size, sizeof(SearchResult), compareResults);
+
+	return size;
+}
+
+/* Finds the k rows from begin up to end most similar to the query, see searchRanges. */
+unsigned int searchRows(const SimilarityIndex* index, const float* query, unsigned long begin, unsigned long end,
+	unsigned int k, SearchResult* results) {
+	unsigned long range[2];
+
+	range[0] = begin;
+	range[1] = end;
+
+	return searchRanges(index, query, range, 1, k, results);
+}
+
+/*
+Scores amount candidates, say from an int8 index, again against the exact index of the same documents and keeps the
+k best of them, sorted best first. Returns their amount.
+*/
+unsigned int searchRerank(const SimilarityIndex* exact, const float* query, SearchResult* candidates,
+	unsigned int amount, unsigned int k) {
+	unsigned long length;
+	unsigned int i;
+	float scale;
+	void* padded;
+
+	padded = prepareQuery(exact, query, &length, &scale);
+	for (i = 0; i < amount; ++i) {
+		scoreRows(exact, padded, length, scale, candidates[i].row, 1, &candidates[i].similarity);
+	}
+	free(padded);
+
+	qsort(candidates, amount, sizeof(SearchResult), compareResults);
+
+	return amount < k ? amount : k;
+}
+
+static void* searcherThread(void* data) {
+	Searcher* searcher = (Searcher*) data;
+	SearchTask* task;
+
+	while ((task = queuePop(searcher->pending)) != NULL) {
+		task->amount = searchRows(searcher->index, searcher->query, task->begin, task->end, searcher->k,
+			task->results);
+		queuePush(searcher->done, task);
+	}
+
+	return NULL;
+}
+
+/* Searches the index on threads of its own, every query is split over all of them. */
+Searcher* searcherInit(const SimilarityIndex* index, unsigned int threads) {
+	Searcher* searcher;
+	unsigned long part, i;
+
+	searcher			= calloc(1, sizeof(Searcher));
+	searcher->index		= index;
+	searcher->threads	= threads > 0 ? threads : 1;
+	searcher->workers	= malloc(sizeof(pthread_t) * searcher->threads);
+	searcher->tasks		= calloc(searcher->threads, sizeof(SearchTask));
+	searcher->pending	= queueInit(searcher->threads);
+	searcher->done		= queueInit(searcher->threads);
+	pthread_mutex_init(&searcher->lock, NULL);
+
+	/* Whole blocks per thread. */
+	part = (index->header.rows + searcher->threads - 1) / searcher->threads;
+	part = (part + SEARCH_BLOCK_ROWS - 1) / SEARCH_BLOCK_ROWS * SEARCH_BLOCK_ROWS;
+	for (i = 0; i < searcher->threads; ++i) {
+		searcher->tasks[i].searcher	= searcher;
+		searcher->tasks[i].begin	= i * part < index->header.rows ? i * part : index->header.rows;
+		searcher->tasks[i].end		= (i + 1) * part < index->header.rows ? (i + 1) * part : index->header.rows;
+	}
+
+	for (i = 0; i < searcher->threads; ++i) {
+		if (pthread_create(&searcher->workers[i], NULL, searcherThread, searcher) != 0) {
+			searcher->threads = i;
+			searcherDestroy(searcher);
+			return NULL;
+		}
+	}
+
+	return searcher;
+}
+
+/*
+Re-ranks the best candidates of every query against exact, an index of the same documents in float32 or float16,
+see searchRerank. A NULL exact index turns re-ranking off.
+*/
+void searcherRerank(Searcher* searcher, const SimilarityIndex* exact, unsigned int candidates) {
+	pthread_mutex_lock(&searcher->lock);
+	searcher->exact			= exact;
+	searcher->candidates	= candidates;
+	pthread_mutex_unlock(&searcher->lock);
+}
+
+/* Finds the k documents most similar to the query, see searchRows. May be called from any amount of threads. */
+unsigned int searcherQuery(Searcher* searcher, const float* query, unsigned int k, SearchResult* results) {
+	SearchTask* task;
+	unsigned int wanted = k;
+	unsigned int size = 0;
+	unsigned int i, j;
+
+	pthread_mutex_lock(&searcher->lock);
+
+	if (searcher->exact != NULL && searcher->candidates > k) {
+		wanted = searcher->candidates;
+	}
+
+	if (wanted > searcher->capacity) {
+		for (i = 0; i < searcher->threads; ++i) {
+			searcher->tasks[i].results = realloc(searcher->tasks[i].results, sizeof(SearchResult) * wanted);
+		}
+		searcher->merged	= realloc(searcher->merged, sizeof(SearchResult) * wanted);
+		searcher->capacity	= wanted;
+	}
+
+	searcher->query	= query;
+	searcher->k		= wanted;
+	for (i = 0; i < searcher->threads; ++i) {
+		queuePush(searcher->pending, &searcher->tasks[i]);
+	}
+
+	for (i = 0; i < searcher->threads; ++i) {
+		task = queuePop(searcher->done);
+		for (j = 0; j < task->amount; ++j) {
+			size = offer(searcher->merged, size, wanted, &task->results[j]);
+		}
+	}
+
+	if (searcher->exact != NULL) {
+		size = searchRerank(searcher->exact, query, searcher->merged, size, k);
+	}
+	else {
+		qsort(searcher->merged, size, sizeof(SearchResult), compareResults);
+	}
+	memcpy(results, searcher->merged, sizeof(SearchResult) * size);
+
+	pthread_mutex_unlock(&searcher->lock);
+
+	return size;
+}
+
+void searcherDestroy(Searcher* searcher) {
+	unsigned int i;
+
+	queueClose(searcher->pending);
+	for (i = 0; i < searcher->threads; ++i) {
+		pthread_join(searcher->workers[i], NULL);
+	}
+
+	for (i = 0; i < searcher->threads; ++i) {
+		free(searcher->tasks[i].results);
+	}
+
+	pthread_mutex_destroy(&searcher->lock);
+	free(searcher->merged);
+	queueDestroy(searcher->pending);
+	queueDestroy(searcher->done);
+	free(searcher->tasks);
+	free(searcher->workers);
+	free(searcher);
+}
@@ -0,0 +1,31 @@
+/**
+ * search.h
+ */
+
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include "similarity.h"
+
+typedef struct {
+	/* Row of the index, i.e. document ID - 1. */
+	unsigned long row;
+	float similarity;
+} SearchResult;
+
+typedef struct Searcher Searcher;
+
+void			searchInit(int vectorized);
+unsigned int	searchRanges(const SimilarityIndex* index, const float* query, const unsigned long* ranges,
+					unsigned int amount, unsigned int k, SearchResult* results);
+unsigned int	searchRows(const SimilarityIndex* index, const float* query, unsigned long begin, unsigned long end,
+					unsigned int k, SearchResult* results);
+unsigned int	searchRerank(const SimilarityIndex* exact, const float* query, SearchResult* candidates,
+					unsigned int amount, unsigned int k);
+Searcher*		searcherInit(const SimilarityIndex* index, unsigned int threads);
+void			searcherRerank(Searcher* searcher, const SimilarityIndex* exact, unsigned int candidates);
+unsigned int	searcherQuery(Searcher* searcher, const float* query, unsigned int k, SearchResult* results);
+void			searcherDestroy(Searcher* searcher);
+
+
+#endif /* SEARCH_H_ */
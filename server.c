@@ -0,0 +1,984 @@
+/*
+Native query server, the counterpart of ir-uwsgi.py
+- Answers GET /api/?query=... just like ir-uwsgi.py: the 21 documents most similar to the query that are not deleted,
+  as a JSON list of [title, "similarity"], or [row, "similarity"] for documents without a title. Any other path gets
+  the query page, a request without a query gets 404 and [].
+- Normalizes the query like the tokenizer did the documents (--fold-case, --stopwords, --stem), weighs its terms by
+  tf-idf with the document frequencies of the word IDs and projects them onto the topic vectors of the terms of lsi.
+- Instead of the topics and word IDs, takes the term table of lsi --terms, which holds the topic vectors weighed by
+  their idfs and finds the terms with a perfect hash, so a query is a lookup and an axpy per term.
+- Searches the similarity index of lsi --index exhaustively, or the ivf index of lsi --ivf (--probes N).
+- One thread waits for connections and requests with epoll, a pool of worker threads (--threads N) answers them.
+  Connections are kept alive unless the client asks otherwise.
+- The word IDs, idfs, topics, term table and indices are loaded or mapped once and shared read-only by all workers.
+
+Compiling:
+gcc -O2 -Wall -pedantic --std=c99 -pthread -o server server.c vocabulary.c arena.c buffer.c normalize.c tfidf.c \
+	matrix.c output.c queue.c similarity.c search.c ivf.c terms.c -lm
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "buffer.h"
+#include "hash.h"
+#include "queue.h"
+#include "vocabulary.h"
+#include "normalize.h"
+#include "tfidf.h"
+#include "matrix.h"
+#include "similarity.h"
+#include "search.h"
+#include "ivf.h"
+#include "terms.h"
+
+/* Longest request header, longer requests are refused. */
+#define SERVER_REQUEST_SIZE 8192
+#define SERVER_RESULTS 21
+#define SERVER_EVENTS 256
+/* Requests waiting for a worker, per worker. */
+#define SERVER_BACKLOG 64
+/* Milliseconds to stop accepting connections for when out of file descriptors. */
+#define SERVER_BACKOFF 100
+
+#define SERVER_COMMON_HEADERS "Access-Control-Allow-Origin: *\r\n" \
+	"Access-Control-Allow-Headers: Requested-With,Content-Type\r\n"
+
+/* The page of html.py. */
+static const char* page =
+	"<!DOCTYPE html PUBLIC \"-//W3C//DTD XHTML 1.0 Transitional//EN\" "
+	"\"http://www.w3.org/TR/xhtml1/DTD/xhtml1-transitional.dtd\">\n"
+	"<html xmlns=\"http://www.w3.org/1999/xhtml\">\n"
+	"  <head>\n"
+	"    <title>IR-LSI Interface</title>\n"
+	"    <script type=\"text/javascript\" src=\"http://code.jquery.com/jquery-1.7.1.min.js\"></script>\n"
+	"    <script type=\"text/javascript\">\n"
+	"function getQuerystring(key, default_)\n"
+	"{\n"
+	"  if (default_==null) default_=\"\";\n"
+	"  key = key.replace(/[\\[]/,\"\\\\[\").replace(/[\\]]/,\"\\\\]\");\n"
+	"  var regex = new RegExp(\"[\\?&]\"+key+\"=([^&#]*)\");\n"
+	"  var qs = regex.exec(window.location.href);\n"
+	"  if(qs == null)\n"
+	"    return default_;\n"
+	"  else\n"
+	"    return qs[1];\n"
+	"}\n"
+	"\n"
+	"function renderResults(data) {\n"
+	"    for (var id in data) {\n"
+	"        html = '<a href =\"http://en.wikipedia.org/wiki/'+data[id][0]+'\">'+data[id][0]+'</a></br>';\n"
+	"        $('#div').append(html);\n"
+	"    }\n"
+	"}\n"
+	"\n"
+	"query = getQuerystring('q')\n"
+	"if (query != ''){\n"
+	"    $.ajax({url: \"http://www.opentripplanner.nl:5678/api/?query=\"+query, success: renderResults, "
+	"dataType: \"json\"});\n"
+	"}\n"
+	"    </script>\n"
+	"  </head>\n"
+	"  <body>\n"
+	"    <form>\n"
+	"      <input type=\"text\" name=\"q\" /><input type=\"submit\" value=\"Zoeken\" />\n"
+	"    </form>\n"
+	"     <div id=\"div\"></div>\n"
+	"  </body>\n"
+	"</html>";
+
+/* Everything a query needs, shared read-only by the workers. */
+typedef struct {
+	Vocabulary* vocabulary;
+	/* ID in the word ID file of every token ID of the vocabulary, which numbers the tokens anew. */
+	unsigned long* wordIDs;
+	double* idfs;
+	unsigned long amountIdfs;
+	/* Topic vector of every term, i.e. row word ID - 1. */
+	DenseMatrix* topics;
+	/* If not NULL, the term table that replaces the vocabulary, idfs and topics. */
+	TermTable* terms;
+	SimilarityIndex* index;
+	IvfIndex* ivf;
+	unsigned int probes;
+	unsigned long rows;
+	unsigned long dimensions;
+	/* Title of every row, NULL if it has none. */
+	char** titles;
+	Buffer* titleData;
+	unsigned long amountTitles;
+	/* Rows of deleted docIDs, on top of those deleted in the index. */
+	uint8_t* deleted;
+	unsigned long amountDeleted;
+	int normalize;
+} Model;
+
+typedef struct {
+	int fd;
+	/* The request, zero terminated, and whatever came after it. */
+	char request[SERVER_REQUEST_SIZE];
+	unsigned int size;
+	Buffer* response;
+	unsigned long sent;
+	int keepAlive;
+	/* Whether the client is done sending, so only the requests read already are left to answer. */
+	int closed;
+} Connection;
+
+typedef struct {
+	Model* model;
+	int listener;
+	int epoll;
+	Queue* pending;
+	/* Milliseconds since the epoch of CLOCK_MONOTONIC until which the listener is disarmed, 0 if armed. */
+	long paused;
+} Server;
+
+/* Scratch space of a worker thread. */
+typedef struct {
+	char terms[SERVER_REQUEST_SIZE + 1];
+	char text[SERVER_REQUEST_SIZE];
+	uint32_t columns[SERVER_REQUEST_SIZE / 2];
+	uint32_t counts[SERVER_REQUEST_SIZE / 2];
+	float weights[SERVER_REQUEST_SIZE / 2];
+	float* query;
+	SearchResult* results;
+	unsigned int capacity;
+	Buffer* body;
+} Worker;
+
+int help() {
+	printf("Syntax: server [--port N] [--threads N] [--probes N] [--fold-case] [--stopwords] [--stem] "
+		"[--words wordid.txt] [--titles docid.txt] [--deleted deleted.txt] [topic or term table input] "
+		"[similarity or ivf index input]\n");
+	return 0;
+}
+
+/* Reads the title of every document ID of a docID file, lines of ID and title. */
+static int readTitles(Model* model, const char* path) {
+	FILE* file;
+	Buffer* content;
+	char buffer[65536];
+	char* line;
+	char* end;
+	char* title;
+	unsigned long size, id;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	content = bufferInit();
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		bufferAdd(content, buffer, size);
+	}
+	bufferAdd(content, "", 1);
+	fclose(file);
+
+	/* The titles point into the content, which is kept. */
+	model->titleData	= content;
+	model->amountTitles	= model->rows;
+	model->titles		= calloc(model->amountTitles + 1, sizeof(char*));
+	for (line = content->buffer; *line != 0; line = end + 1) {
+		end = strchr(line, '\n');
+		if (end == NULL) {
+			break;
+		}
+		*end = 0;
+
+		id		= strtoul(line, &title, 10);
+		title	= strchr(title, '\t');
+		if (id == 0 || title == NULL) {
+			continue;
+		}
+		if (strchr(title + 1, '\t') != NULL) {
+			*strchr(title + 1, '\t') = 0;
+		}
+
+		if (id > model->amountTitles) {
+			model->titles = realloc(model->titles, sizeof(char*) * (id * 2 + 1));
+			memset(model->titles + model->amountTitles, 0, sizeof(char*) * (id * 2 + 1 - model->amountTitles));
+			model->amountTitles = id * 2;
+		}
+		model->titles[id - 1] = title + 1;
+	}
+
+	return 0;
+}
+
+/* Sets the bits of the rows of the document IDs in a deleted docID file, if there is one. */
+static int readDeleted(Model* model, const char* path) {
+	FILE* file;
+	unsigned long documentID, position, row;
+
+	model->deleted = calloc(model->rows / 8 + 1, 1);
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return errno == ENOENT ? 0 : -1;
+	}
+
+	while (fscanf(file, "%lu", &documentID) == 1) {
+		if (documentID > 0 && documentID <= model->rows) {
+			model->deleted[(documentID - 1) / 8] |= 1 << ((documentID - 1) % 8);
+		}
+	}
+
+	fclose(file);
+
+	/* Searches skip the rows deleted in the index anyway, only the others need more results to make up for them. */
+	for (position = 0; position < model->rows; ++position) {
+		row = model->ivf != NULL ? model->ivf->rows[position] : position;
+		if (model->ivf != NULL ? similarityDeleted(&model->ivf->documents, position) :
+			similarityDeleted(model->index, position)) {
+			model->deleted[row / 8] &= ~(1 << (row % 8));
+		}
+		else if ((model->deleted[row / 8] >> (row % 8)) & 1) {
+			++model->amountDeleted;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Reads the vocabulary and idfs of the word IDs and maps the topics. The idfs are over the documents of the run that
+wrote the word IDs, as the model weighed its documents, not over the rows of the index, which grow with every update.
+*/
+static int loadWords(Model* model, const char* wordIDPath, const char* topicPath) {
+	unsigned long* mapping;
+	unsigned long amount, id, documents;
+
+	model->topics = denseOpen(topicPath);
+	if (model->topics == NULL || model->topics->header.columns != model->dimensions) {
+		fprintf(stderr, "Cannot open topics %s of %lu dimensions.\n", topicPath, model->dimensions);
+		return -1;
+	}
+
+	documents = tfidfDocuments(wordIDPath);
+	if (documents == 0) {
+		fprintf(stderr, "Cannot read the amount of documents of the word IDs %s.\n", wordIDPath);
+		return -1;
+	}
+
+	/* Tokens are numbered anew in order of their IDs, which only differs if IDs are missing. */
+	model->vocabulary	= vocabularyInit();
+	mapping				= vocabularyMap(model->vocabulary, wordIDPath, 0, &amount);
+	model->idfs			= tfidfIdfs(wordIDPath, documents, &model->amountIdfs);
+	if (mapping == NULL || model->idfs == NULL) {
+		fprintf(stderr, "Cannot read word IDs %s.\n", wordIDPath);
+		free(mapping);
+		return -1;
+	}
+
+	model->wordIDs = calloc(vocabularySize(model->vocabulary) + 1, sizeof(unsigned long));
+	for (id = 1; id <= amount; ++id) {
+		if (mapping[id] != 0) {
+			model->wordIDs[mapping[id]] = id;
+		}
+	}
+	free(mapping);
+
+	return 0;
+}
+
+static int loadModel(Model* model, const char* wordIDPath, const char* docIDPath, const char* deletedPath,
+	const char* topicPath, const char* indexPath) {
+	unsigned long documents;
+
+	model->ivf = ivfOpen(indexPath);
+	if (model->ivf != NULL) {
+		model->rows			= model->ivf->header.rows;
+		model->dimensions	= model->ivf->header.dimensions;
+	}
+	else {
+		model->index = similarityOpen(indexPath);
+		if (model->index == NULL) {
+			fprintf(stderr, "Cannot open index %s.\n", indexPath);
+			return -1;
+		}
+		model->rows			= model->index->header.rows;
+		model->dimensions	= model->index->header.dimensions;
+	}
+
+	if (normalizeInit() != 0) {
+		fprintf(stderr, "Cannot hash the stopwords.\n");
+		return -1;
+	}
+
+	model->terms = termsOpen(topicPath);
+	if (model->terms != NULL) {
+		if (model->terms->header.dimensions != model->dimensions) {
+			fprintf(stderr, "Term table %s is not of %lu dimensions.\n", topicPath, model->dimensions);
+			return -1;
+		}
+
+		/* The idfs of the table are those of the word IDs it was written from, which a new full build changes. */
+		documents = tfidfDocuments(wordIDPath);
+		if (documents != 0 && model->terms->header.documents != documents) {
+			fprintf(stderr, "Term table %s is of %lu documents, the word IDs %s of %lu.\n", topicPath,
+				(unsigned long) model->terms->header.documents, wordIDPath, documents);
+			return -1;
+		}
+		model->amountIdfs = model->terms->header.terms;
+	}
+	else if (loadWords(model, wordIDPath, topicPath) != 0) {
+		return -1;
+	}
+
+	if (readTitles(model, docIDPath) != 0) {
+		fprintf(stderr, "Cannot read titles %s.\n", docIDPath);
+		return -1;
+	}
+
+	if (readDeleted(model, deletedPath) != 0) {
+		fprintf(stderr, "Cannot read deleted documents %s.\n", deletedPath);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int hexValue(char c) {
+	return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 :
+		-1;
+}
+
+/* Decodes a part of a query string like unquote_plus into text, which it cannot outgrow. Returns its length. */
+static unsigned int unquote(const char* begin, const char* end, char* text) {
+	unsigned int length = 0;
+
+	for (; begin < end; ++begin) {
+		if (*begin == '+') {
+			text[length++] = ' ';
+		}
+		else if (*begin == '%' && end - begin > 2 && hexValue(begin[1]) >= 0 && hexValue(begin[2]) >= 0) {
+			text[length++] = hexValue(begin[1]) * 16 + hexValue(begin[2]);
+			begin += 2;
+		}
+		else {
+			text[length++] = *begin;
+		}
+	}
+
+	return length;
+}
+
+/*
+Finds the first non-empty query parameter of a query string, split on & and ; like parse_qs, and decodes it into
+text. Returns its length, -1 if there is none.
+*/
+static int queryParameter(const char* begin, const char* end, char* text) {
+	const char* pair;
+	const char* equals;
+	/* Room for "query" with every letter escaped, a name never decodes to more than it takes. */
+	char name[5 * 3];
+
+	for (pair = begin; pair < end; pair = begin + 1) {
+		for (begin = pair; begin < end && *begin != '&' && *begin != ';'; ++begin);
+		for (equals = pair; equals < begin && *equals != '='; ++equals);
+
+		if (equals == begin || equals + 1 == begin || equals - pair > (long) sizeof(name)) {
+			continue;
+		}
+
+		if (unquote(pair, equals, name) == 5 && memcmp(name, "query", 5) == 0) {
+			return unquote(equals + 1, begin, text);
+		}
+	}
+
+	return -1;
+}
+
+/* Appends a string as JSON does with only ASCII, i.e. as simplejson.dumps does by default. */
+static void jsonString(Buffer* buffer, const unsigned char* string) {
+	char escape[16];
+	unsigned long code;
+	unsigned int length, i;
+
+	bufferAdd(buffer, "\"", 1);
+	while (*string != 0) {
+		if (*string == '"' || *string == '\\') {
+			escape[0] = '\\';
+			escape[1] = *string++;
+			bufferAdd(buffer, escape, 2);
+			continue;
+		}
+
+		if (*string >= ' ' && *string < 0x7f) {
+			bufferAdd(buffer, (const char*) string++, 1);
+			continue;
+		}
+
+		/* Anything else by code point, invalid UTF-8 as the replacement character. */
+		length	= *string < 0x80 ? 1 : *string >= 0xf0 ? 4 : *string >= 0xe0 ? 3 : *string >= 0xc0 ? 2 : 0;
+		code	= length == 1 ? *string : length == 0 ? 0xfffd : *string & (0x3f >> (length - 1));
+		for (i = 1; i < length && (string[i] & 0xc0) == 0x80; ++i) {
+			code = code << 6 | (string[i] & 0x3f);
+		}
+		if (i < length || length == 0 || code > 0x10ffff) {
+			code	= 0xfffd;
+			length	= i > 0 ? i : 1;
+		}
+		string += length;
+
+		switch (code) {
+		case '\n':
+			bufferAdd(buffer, "\\n", 2);
+			break;
+		case '\r':
+			bufferAdd(buffer, "\\r", 2);
+			break;
+		case '\t':
+			bufferAdd(buffer, "\\t", 2);
+			break;
+		case '\b':
+			bufferAdd(buffer, "\\b", 2);
+			break;
+		case '\f':
+			bufferAdd(buffer, "\\f", 2);
+			break;
+		default:
+			if (code >= 0x10000) {
+				code -= 0x10000;
+				bufferAdd(buffer, escape, sprintf(escape, "\\u%04lx\\u%04lx", 0xd800 + (code >> 10),
+					0xdc00 + (code & 0x3ff)));
+			}
+			else {
+				bufferAdd(buffer, escape, sprintf(escape, "\\u%04lx", code));
+			}
+		}
+	}
+	bufferAdd(buffer, "\"", 1);
+}
+
+/* A similarity as str() of a Python float does, i.e. 12 significant digits that always look like a float. */
+static unsigned int formatSimilarity(char* text, float similarity) {
+	unsigned int length = sprintf(text, "%.12g", similarity);
+
+	if (strpbrk(text, ".en") == NULL) {
+		length += sprintf(text + length, ".0");
+	}
+
+	return length;
+}
+
+/* Word ID of a term, 0 if the model does not know it. */
+static unsigned long findWordID(const Model* model, const char* term, unsigned int length) {
+	TokenDesc* desc;
+	uint64_t hash = hashToken(term, length);
+	unsigned long id;
+
+	if (model->terms != NULL) {
+		return termsFind(model->terms, term, length, hash);
+	}
+
+	desc	= vocabularyFindHashed(model->vocabulary, term, length, hash);
+	id		= desc != NULL ? model->wordIDs[desc->id] : 0;
+
+	return id <= model->amountIdfs && id <= model->topics->header.rows ? id : 0;
+}
+
+/* Answers a query with the JSON list of its results in the body of the worker. */
+static void answerQuery(const Model* model, Worker* worker, const char* text, unsigned int length) {
+	unsigned long amount = 0;
+	unsigned long id, column, kept, i, j;
+	unsigned int k, found, written;
+	char* term;
+	char* end;
+	const float* topic;
+	char number[64];
+
+	normalizeText(text, length, model->normalize, worker->terms);
+
+	/* The bow of the query, columns are word ID - 1. */
+	for (term = worker->terms; *term != 0; term = *end != 0 ? end + 1 : end) {
+		end = strchr(term, ' ');
+		if (end == NULL) {
+			end = term + strlen(term);
+		}
+
+		id = findWordID(model, term, end - term);
+		if (id == 0) {
+			continue;
+		}
+
+		column = id - 1;
+		for (i = 0; i < amount && worker->columns[i] != column; ++i);
+		if (i == amount) {
+			worker->columns[amount]	= column;
+			worker->counts[amount]	= 0;
+			++amount;
+		}
+		++worker->counts[i];
+	}
+
+	/*
+	Without known terms the query is empty, equally similar to every document, as with gensim. The rows of a term
+	table are weighed by the idfs already; the tf-idf vector is not scaled to unit length, as the search scales the
+	query anyway.
+	*/
+	if (model->terms != NULL) {
+		memset(worker->query, 0, model->terms->header.rowStride);
+		for (i = 0; i < amount; ++i) {
+			termsAdd(model->terms, worker->columns[i] + 1, worker->counts[i], worker->query);
+		}
+	}
+	else {
+		kept = tfidfWeigh(worker->columns, worker->counts, worker->weights, amount, model->idfs);
+		memset(worker->query, 0, sizeof(float) * model->dimensions);
+		for (i = 0; i < kept; ++i) {
+			topic = model->topics->rows + (unsigned long) worker->columns[i] * model->dimensions;
+			for (j = 0; j < model->dimensions; ++j) {
+				worker->query[j] += worker->weights[i] * topic[j];
+			}
+		}
+	}
+
+	k = SERVER_RESULTS + model->amountDeleted;
+	if (k > worker->capacity) {
+		worker->results		= realloc(worker->results, sizeof(SearchResult) * k);
+		worker->capacity	= k;
+	}
+
+	if (model->ivf != NULL) {
+		found = ivfQuery(model->ivf, worker->query, model->probes, k, worker->results);
+	}
+	else {
+		found = searchRows(model->index, worker->query, 0, model->rows, k, worker->results);
+	}
+
+	bufferReset(worker->body);
+	bufferAdd(worker->body, "[", 1);
+	for (i = 0, written = 0; i < found && written < SERVER_RESULTS; ++i) {
+		if ((model->deleted[worker->results[i].row / 8] >> (worker->results[i].row % 8)) & 1) {
+			continue;
+		}
+
+		bufferAdd(worker->body, written > 0 ? ", [" : "[", written > 0 ? 3 : 1);
+		if (worker->results[i].row < model->amountTitles && model->titles[worker->results[i].row] != NULL) {
+			jsonString(worker->body, (const unsigned char*) model->titles[worker->results[i].row]);
+		}
+		else {
+			bufferAdd(worker->body, number, sprintf(number, "%lu", worker->results[i].row));
+		}
+		bufferAdd(worker->body, ", \"", 3);
+		bufferAdd(worker->body, number, formatSimilarity(number, worker->results[i].similarity));
+		bufferAdd(worker->body, "\"]", 2);
+		++written;
+	}
+	bufferAdd(worker->body, "]", 1);
+}
+
+/* Whether a header of the request, of a lower case name, holds a value, case insensitively. */
+static int headerHolds(const char* request, const char* name, const char* value) {
+	const char* line;
+	const char* end;
+	unsigned int length = strlen(name);
+	unsigned int valueLength = strlen(value);
+
+	for (line = strstr(request, "\r\n"); line != NULL && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+		if (strncasecmp(line + 2, name, length) != 0 || line[2 + length] != ':') {
+			continue;
+		}
+
+		end = strstr(line + 2, "\r\n");
+		for (line += 3 + length; line + valueLength <= end; ++line) {
+			if (strncasecmp(line, value, valueLength) == 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+static void respond(Connection* connection, const char* status, const char* contentType, const char* body,
+	unsigned long length) {
+	char header[512];
+
+	bufferReset(connection->response);
+	bufferAdd(connection->response, header, snprintf(header, sizeof(header),
+		"HTTP/1.1 %s\r\nContent-Type: %s\r\n" SERVER_COMMON_HEADERS "Content-length: %lu\r\nConnection: %s\r\n\r\n",
+		status, contentType, length, connection->keepAlive ? "keep-alive" : "close"));
+	bufferAdd(connection->response, body, length);
+	connection->sent = 0;
+}
+
+/* Answers the request at the start of the connection, which is complete, and drops it from the connection. */
+static void answer(const Model* model, Worker* worker, Connection* connection) {
+	char* end = strstr(connection->request, "\r\n\r\n");
+	char* line = connection->request;
+	char* lineEnd;
+	char* target;
+	char* targetEnd;
+	char* path;
+	char* queryString;
+	unsigned int consumed = end + 4 - connection->request;
+	int length;
+
+	/* Keep-alive is the default from HTTP/1.1 on. */
+	end[2]		= 0;
+	lineEnd		= strstr(line, "\r\n");
+	connection->keepAlive = lineEnd - line > 9 && memcmp(lineEnd - 9, " HTTP/1.1", 9) == 0 ?
+		!headerHolds(line, "connection", "close") : headerHolds(line, "connection", "keep-alive");
+	if (connection->closed && strstr(end + 4, "\r\n\r\n") == NULL) {
+		connection->keepAlive = 0;
+	}
+
+	target		= strchr(line, ' ');
+	targetEnd	= target != NULL ? strpbrk(target + 1, " \r") : NULL;
+	if (target == NULL || targetEnd == NULL) {
+		connection->keepAlive = 0;
+		respond(connection, "400 Bad Request", "text/plain", "[]", 2);
+	}
+	else {
+		/* The path from / on, without scheme and host if the target has them. */
+		path = target + 1;
+		if (*path != '/' && strstr(path, "://") != NULL && strstr(path, "://") < targetEnd) {
+			path = strchr(strstr(path, "://") + 3, '/');
+			path = path != NULL && path < targetEnd ? path : targetEnd;
+		}
+
+		for (queryString = path; queryString < targetEnd && *queryString != '?'; ++queryString);
+		if (queryString - path < 4 || memcmp(path, "/api", 4) != 0 || (path[4] != '/' && path + 4 != queryString)) {
+			respond(connection, "200 OK", "text/html", page, strlen(page));
+		}
+		else {
+			length = queryString < targetEnd ? queryParameter(queryString + 1, targetEnd, worker->text) : -1;
+			if (length < 0) {
+				respond(connection, "404 File Not Found", "text/plain", "[]", 2);
+			}
+			else {
+				answerQuery(model, worker, worker->text, length);
+				respond(connection, "200 OK", "text/plain", worker->body->buffer, worker->body->currentsize);
+			}
+		}
+	}
+
+	memmove(connection->request, connection->request + consumed, connection->size - consumed + 1);
+	connection->size -= consumed;
+}
+
+/* Waits for the connection to become readable or writable, on any thread. */
+static void rearm(Server* server, Connection* connection, uint32_t events) {
+	struct epoll_event event;
+
+	event.events	= events | EPOLLONESHOT;
+	event.data.ptr	= connection;
+	epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event);
+}
+
+static void closeConnection(Connection* connection) {
+	close(connection->fd);
+	bufferDestroy(connection->response);
+	free(connection);
+}
+
+/* Sends what is left of the response. Returns 1 once all of it is sent, 0 if it waits for the socket, -1 if closed. */
+static int sendResponse(Server* server, Connection* connection) {
+	ssize_t written;
+
+	while (connection->sent < connection->response->currentsize) {
+		written = send(connection->fd, connection->response->buffer + connection->sent,
+			connection->response->currentsize - connection->sent, MSG_NOSIGNAL);
+		if (written > 0) {
+			connection->sent += written;
+		}
+		else if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			rearm(server, connection, EPOLLOUT);
+			return 0;
+		}
+		else {
+			closeConnection(connection);
+			return -1;
+		}
+	}
+
+	bufferReset(connection->response);
+	connection->sent = 0;
+
+	return 1;
+}
+
+/*
+Closes the connection after a response or waits for its next request. Returns 1 without waiting if the next request
+came along with the last one already.
+*/
+static int finish(Server* server, Connection* connection) {
+	if (!connection->keepAlive) {
+		closeConnection(connection);
+		return 0;
+	}
+
+	if (strstr(connection->request, "\r\n\r\n") != NULL) {
+		return 1;
+	}
+
+	rearm(server, connection, EPOLLIN);
+	return 0;
+}
+
+/*
+Reads what there is of a request, and hands it to the workers once it is complete. A client that is done sending
+still gets the answers to the complete requests it sent.
+*/
+static void readRequest(Server* server, Connection* connection) {
+	ssize_t amount;
+
+	while (connection->size < SERVER_REQUEST_SIZE - 1 && !connection->closed) {
+		amount = read(connection->fd, connection->request + connection->size,
+			SERVER_REQUEST_SIZE - 1 - connection->size);
+		if (amount > 0) {
+			connection->size += amount;
+		}
+		else if (amount < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (amount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		else if (amount == 0) {
+			connection->closed = 1;
+		}
+		else {
+			closeConnection(connection);
+			return;
+		}
+	}
+	connection->request[connection->size] = 0;
+
+	if (strstr(connection->request, "\r\n\r\n") != NULL) {
+		queuePush(server->pending, connection);
+	}
+	else if (connection->size < SERVER_REQUEST_SIZE - 1 && !connection->closed) {
+		rearm(server, connection, EPOLLIN);
+	}
+	else {
+		closeConnection(connection);
+	}
+}
+
+static long milliseconds() {
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+static void acceptConnections(Server* server) {
+	struct epoll_event event;
+	Connection* connection;
+	int fd;
+
+	while ((fd = accept(server->listener, NULL, NULL)) >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+		connection				= calloc(1, sizeof(Connection));
+		connection->fd			= fd;
+		connection->response	= bufferInit();
+
+		event.events	= EPOLLIN | EPOLLONESHOT;
+		event.data.ptr	= connection;
+		if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+			closeConnection(connection);
+		}
+	}
+
+	/* The listener stays readable while connections wait, so it waits out the backoff instead of spinning. */
+	if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+		event.events	= 0;
+		event.data.ptr	= NULL;
+		epoll_ctl(server->epoll, EPOLL_CTL_MOD, server->listener, &event);
+		server->paused	= milliseconds() + SERVER_BACKOFF;
+	}
+}
+
+static void* workerThread(void* data) {
+	Server* server = (Server*) data;
+	Connection* connection;
+	Worker* worker;
+
+	worker			= calloc(1, sizeof(Worker));
+	worker->query	= calloc(server->model->terms != NULL ? server->model->terms->header.rowStride / sizeof(float) :
+		server->model->dimensions + 1, sizeof(float));
+	worker->body	= bufferInit();
+
+	while ((connection = queuePop(server->pending)) != NULL) {
+		do {
+			answer(server->model, worker, connection);
+		} while (sendResponse(server, connection) == 1 && finish(server, connection) == 1);
+	}
+
+	bufferDestroy(worker->body);
+	free(worker->results);
+	free(worker->query);
+	free(worker);
+
+	return NULL;
+}
+
+static int listenOn(unsigned int port) {
+	struct sockaddr_in address;
+	int fd, enable = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family		= AF_INET;
+	address.sin_addr.s_addr	= htonl(INADDR_ANY);
+	address.sin_port		= htons(port);
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) != 0 ||
+		bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return fd;
+}
+
+int main(int argc, char** argv) {
+	Model model;
+	Server server;
+	pthread_t* workers;
+	struct epoll_event event;
+	struct epoll_event events[SERVER_EVENTS];
+	Connection* connection;
+	const char* wordIDPath = "wordid.txt";
+	const char* docIDPath = "docid.txt";
+	const char* deletedPath = "deleted.txt";
+	unsigned int port = 5678;
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	unsigned int i;
+	int argument, amount;
+	long wait;
+
+	memset(&model, 0, sizeof(model));
+	model.probes = 16;
+
+	for (argument = 1; argument < argc && strncmp(argv[argument], "--", 2) == 0; ++argument) {
+		if (strcmp(argv[argument], "--port") == 0 && argument + 1 < argc) {
+			port = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--threads") == 0 && argument + 1 < argc) {
+			threads = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--probes") == 0 && argument + 1 < argc) {
+			model.probes = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--fold-case") == 0) {
+			model.normalize |= NORMALIZE_FOLD;
+		}
+		else if (strcmp(argv[argument], "--stopwords") == 0) {
+			model.normalize |= NORMALIZE_STOPWORDS;
+		}
+		else if (strcmp(argv[argument], "--stem") == 0) {
+			model.normalize |= NORMALIZE_STEM;
+		}
+		else if (strcmp(argv[argument], "--words") == 0 && argument + 1 < argc) {
+			wordIDPath = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--titles") == 0 && argument + 1 < argc) {
+			docIDPath = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--deleted") == 0 && argument + 1 < argc) {
+			deletedPath = argv[++argument];
+		}
+		else {
+			return help();
+		}
+	}
+
+	if (argc - argument != 2 || threads == 0) {
+		return help();
+	}
+
+	searchInit(1);
+	if (loadModel(&model, wordIDPath, docIDPath, deletedPath, argv[argument], argv[argument + 1]) != 0) {
+		return -1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	server.model	= &model;
+	server.paused	= 0;
+	server.listener	= listenOn(port);
+	server.epoll	= epoll_create1(0);
+	server.pending	= queueInit(threads * SERVER_BACKLOG);
+	if (server.listener < 0 || server.epoll < 0) {
+		perror("Cannot listen");
+		return -1;
+	}
+
+	event.events	= EPOLLIN;
+	event.data.ptr	= NULL;
+	epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &event);
+
+	workers = malloc(sizeof(pthread_t) * threads);
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&workers[i], NULL, workerThread, &server) != 0) {
+			perror("Cannot start worker");
+			return -1;
+		}
+	}
+
+	printf("Documents: %lu, terms: %lu%s, %s, threads: %u, port: %u\n", model.rows, model.amountIdfs,
+		model.terms != NULL ? " in a term table" : "", model.ivf != NULL ? "ivf index" : "exhaustive search", threads,
+		port);
+	fflush(stdout);
+
+	for (;;) {
+		wait	= server.paused > 0 ? server.paused - milliseconds() : -1;
+		amount	= epoll_wait(server.epoll, events, SERVER_EVENTS, server.paused > 0 ? (wait > 0 ? wait : 0) : -1);
+		if (amount < 0 && errno != EINTR) {
+			perror("Cannot wait for connections");
+			return -1;
+		}
+
+		if (server.paused > 0 && milliseconds() >= server.paused) {
+			event.events	= EPOLLIN;
+			event.data.ptr	= NULL;
+			epoll_ctl(server.epoll, EPOLL_CTL_MOD, server.listener, &event);
+			server.paused	= 0;
+		}
+
+		for (i = 0; (int) i < amount; ++i) {
+			connection = events[i].data.ptr;
+			if (connection == NULL) {
+				acceptConnections(&server);
+			}
+			else if (connection->sent < connection->response->currentsize) {
+				if (sendResponse(&server, connection) == 1 && finish(&server, connection) == 1) {
+					queuePush(server.pending, connection);
+				}
+			}
+			else {
+				readRequest(&server, connection);
+			}
+		}
+	}
+
+	return 0;
+}
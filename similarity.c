@@ -0,0 +1,339 @@
+/**
+ * similarity.c
+ *
+ * Writes and maps the similarity index, see similarity.h. The index is written from the documents of lsi, i.e. U S,
+ * which only differ from U by the scale of every topic; scaling rows to unit length makes a dot product with a unit
+ * query its cosine similarity, as with gensim's MatrixSimilarity.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "similarity.h"
+#include "matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SIMILARITY_BUFFER_SIZE (8 * 1024 * 1024)
+
+static int isLittleEndian() {
+	uint16_t value = 1;
+	return *(uint8_t*) &value == 1;
+}
+
+static unsigned long alignUp(unsigned long value, unsigned long alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+/* Writes zeros from position up to end. */
+static int writePadding(FILE* file, unsigned long position, unsigned long end) {
+	for (; position < end; ++position) {
+		if (fputc(0, file) == EOF) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Sets the row stride and the offsets of an index of header->rows rows of header->valueType. */
+static void layout(SimilarityHeader* header) {
+	header->rowStride		= alignUp(header->dimensions * similarityValueSize(header->valueType),
+		header->valueType == SIMILARITY_INT8 ? SIMILARITY_INT8_ALIGNMENT : SIMILARITY_ROW_ALIGNMENT);
+	header->vectorsOffset	= SIMILARITY_ALIGNMENT;
+	header->deletedOffset	= alignUp(header->vectorsOffset + header->rows * header->rowStride, SIMILARITY_ROW_ALIGNMENT);
+	header->scalesOffset	= 0;
+
+	/* The scales are kept apart from the rows, which stay multiples of 16 bytes. */
+	if (header->valueType == SIMILARITY_INT8) {
+		header->scalesOffset	= header->deletedOffset;
+		header->deletedOffset	= alignUp(header->scalesOffset + header->rows * sizeof(float), SIMILARITY_ROW_ALIGNMENT);
+	}
+}
+
+/* Sets the bits of the documents in the deleted docID file, one document ID per line. */
+static int readDeleted(const char* path, uint8_t* deleted, unsigned long rows, unsigned long* amount) {
+	FILE* file;
+	unsigned long documentID;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	*amount = 0;
+	while (fscanf(file, "%lu", &documentID) == 1) {
+		if (documentID == 0 || documentID > rows) {
+			fprintf(stderr, "Deleted document %lu is not one of the %lu documents.\n", documentID, rows);
+			fclose(file);
+			return -1;
+		}
+
+		if (!((deleted[(documentID - 1) / 8] >> ((documentID - 1) % 8)) & 1)) {
+			deleted[(documentID - 1) / 8] |= 1 << ((documentID - 1) % 8);
+			++*amount;
+		}
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+/* Writes the index of the dense documents, marking those in the deleted docID file as deleted unless it is NULL. */
+int similarityWrite(const char* documentPath, const char* deletedPath, const char* indexPath, uint32_t valueType) {
+	DenseMatrix* documents;
+	SimilarityHeader header;
+	FILE* file;
+	const float* document;
+	uint8_t* deleted;
+	char* row;
+	char padding[SIMILARITY_ALIGNMENT];
+	unsigned long rows, dimensions, i, j;
+	unsigned long amountDeleted = 0;
+	double norm, largest;
+	float* scales;
+	int result = 0;
+
+	if (!isLittleEndian()) {
+		return -1;
+	}
+
+	documents = denseOpen(documentPath);
+	if (documents == NULL) {
+		return -1;
+	}
+
+	rows		= documents->header.rows;
+	dimensions	= documents->header.columns;
+	deleted		= calloc(rows / 8 + 1, 1);
+	if (deletedPath != NULL && readDeleted(deletedPath, deleted, rows, &amountDeleted) != 0) {
+		free(deleted);
+		denseClose(documents);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SIMILARITY_MAGIC, sizeof(header.magic));
+	header.version			= SIMILARITY_VERSION;
+	header.valueType		= valueType;
+	header.rows				= rows;
+	header.dimensions		= dimensions;
+	header.amountDeleted	= amountDeleted;
+	layout(&header);
+
+	file = fopen(indexPath, "wb");
+	if (file == NULL) {
+		free(deleted);
+		denseClose(documents);
+		return -1;
+	}
+	setvbuf(file, NULL, _IOFBF, SIMILARITY_BUFFER_SIZE);
+
+	memset(padding, 0, sizeof(padding));
+	memcpy(padding, &header, sizeof(header));
+	if (fwrite(padding, sizeof(padding), 1, file) != 1) {
+		result = -1;
+	}
+
+	row		= calloc(header.rowStride, 1);
+	scales	= calloc(rows + 1, sizeof(float));
+	for (i = 0; i < rows && result == 0; ++i) {
+		document = documents->rows + i * dimensions;
+
+		for (j = 0, norm = 0, largest = 0; j < dimensions; ++j) {
+			norm += (double) document[j] * document[j];
+			if (fabs(document[j]) > largest) {
+				largest = fabs(document[j]);
+			}
+		}
+		norm = norm > 0 ? 1 / sqrt(norm) : 0;
+
+		/* Scaled so the largest value of the row is 127. */
+		scales[i] = largest * norm / 127;
+
+		for (j = 0; j < dimensions; ++j) {
+			if (valueType == SIMILARITY_INT8) {
+				((int8_t*) row)[j] = largest > 0 ? lrint(document[j] * 127 / largest) : 0;
+			}
+			else if (valueType == SIMILARITY_FLOAT16) {
+				((uint16_t*) row)[j] = similarityToHalf(document[j] * norm);
+			}
+			else {
+				((float*) row)[j] = document[j] * norm;
+			}
+		}
+
+		if (fwrite(row, header.rowStride, 1, file) != 1) {
+			result = -1;
+		}
+	}
+
+	if (result == 0 && writePadding(file, header.vectorsOffset + rows * header.rowStride,
+		header.scalesOffset > 0 ? header.scalesOffset : header.deletedOffset) != 0) {
+		result = -1;
+	}
+
+	if (result == 0 && header.scalesOffset > 0 && (fwrite(scales, sizeof(float), rows, file) != rows ||
+		writePadding(file, header.scalesOffset + rows * sizeof(float), header.deletedOffset) != 0)) {
+		result = -1;
+	}
+
+	if (result == 0 && fwrite(deleted, rows / 8 + 1, 1, file) != 1) {
+		result = -1;
+	}
+
+	if (fclose(file) != 0) {
+		result = -1;
+	}
+
+	free(row);
+	free(scales);
+	free(deleted);
+	denseClose(documents);
+
+	return result;
+}
+
+/*
+Writes rows order[0], order[1], ... up to order[rows - 1] of source as an index of its own at the current position of
+file, which should be a multiple of SIMILARITY_ALIGNMENT. The deleted bits move along with the rows.
+*/
+int similarityWriteRows(FILE* file, const SimilarityIndex* source, const uint64_t* order, unsigned long rows) {
+	SimilarityHeader header;
+	char padding[SIMILARITY_ALIGNMENT];
+	uint8_t* deleted;
+	unsigned long i;
+	int result = 0;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SIMILARITY_MAGIC, sizeof(header.magic));
+	header.version		= SIMILARITY_VERSION;
+	header.valueType	= source->header.valueType;
+	header.rows			= rows;
+	header.dimensions	= source->header.dimensions;
+	layout(&header);
+
+	deleted = calloc(rows / 8 + 1, 1);
+	for (i = 0; i < rows; ++i) {
+		if (similarityDeleted(source, order[i])) {
+			deleted[i / 8] |= 1 << (i % 8);
+			++header.amountDeleted;
+		}
+	}
+
+	memset(padding, 0, sizeof(padding));
+	memcpy(padding, &header, sizeof(header));
+	if (fwrite(padding, sizeof(padding), 1, file) != 1) {
+		result = -1;
+	}
+
+	/* Strides of the source and the copy are the same, as are the row paddings. */
+	for (i = 0; i < rows && result == 0; ++i) {
+		if (fwrite(similarityRow(source, order[i]), header.rowStride, 1, file) != 1) {
+			result = -1;
+		}
+	}
+
+	if (result == 0 && writePadding(file, header.vectorsOffset + rows * header.rowStride,
+		header.scalesOffset > 0 ? header.scalesOffset : header.deletedOffset) != 0) {
+		result = -1;
+	}
+
+	for (i = 0; i < rows && result == 0 && header.scalesOffset > 0; ++i) {
+		if (fwrite(&source->scales[order[i]], sizeof(float), 1, file) != 1) {
+			result = -1;
+		}
+	}
+
+	if (result == 0 && header.scalesOffset > 0 &&
+		writePadding(file, header.scalesOffset + rows * sizeof(float), header.deletedOffset) != 0) {
+		result = -1;
+	}
+
+	if (result == 0 && fwrite(deleted, rows / 8 + 1, 1, file) != 1) {
+		result = -1;
+	}
+
+	free(deleted);
+
+	return result;
+}
+
+/*
+Points index at the index of size bytes at data, which stays owned by the caller. Returns -1 if it is not a valid
+index.
+*/
+int similarityView(SimilarityIndex* index, const void* data, unsigned long size) {
+	SimilarityHeader* header = &index->header;
+
+	if (size < SIMILARITY_ALIGNMENT) {
+		return -1;
+	}
+
+	memcpy(header, data, sizeof(SimilarityHeader));
+	if (memcmp(header->magic, SIMILARITY_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != SIMILARITY_VERSION || header->valueType > SIMILARITY_INT8 ||
+		header->rowStride < header->dimensions * similarityValueSize(header->valueType) ||
+		header->rowStride % (header->valueType == SIMILARITY_INT8 ? SIMILARITY_INT8_ALIGNMENT :
+			SIMILARITY_ROW_ALIGNMENT) != 0 || header->vectorsOffset % SIMILARITY_ROW_ALIGNMENT != 0 ||
+		header->vectorsOffset + header->rows * header->rowStride > header->deletedOffset ||
+		(header->valueType == SIMILARITY_INT8 && (header->scalesOffset < header->vectorsOffset +
+			header->rows * header->rowStride || header->scalesOffset + header->rows * 4 > header->deletedOffset)) ||
+		header->deletedOffset + header->rows / 8 + 1 > size) {
+		return -1;
+	}
+
+	index->vectors	= (const char*) data + header->vectorsOffset;
+	index->deleted	= (const uint8_t*) data + header->deletedOffset;
+	index->scales	= header->valueType == SIMILARITY_INT8 ?
+		(const float*) ((const char*) data + header->scalesOffset) : NULL;
+
+	return 0;
+}
+
+/* Maps an index read-only, so processes that map the same index share it in the page cache. */
+SimilarityIndex* similarityOpen(const char* path) {
+	SimilarityIndex* index;
+	struct stat status;
+	int fd;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (unsigned long) status.st_size < SIMILARITY_ALIGNMENT) {
+		close(fd);
+		return NULL;
+	}
+
+	index		= calloc(1, sizeof(SimilarityIndex));
+	index->size	= status.st_size;
+	index->data	= mmap(NULL, index->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (index->data == MAP_FAILED) {
+		free(index);
+		return NULL;
+	}
+
+	if (similarityView(index, index->data, index->size) != 0) {
+		similarityClose(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+void similarityClose(SimilarityIndex* index) {
+	munmap(index->data, index->size);
+	free(index);
+}
@@ -0,0 +1,124 @@
+/**
+ * similarity.h
+ */
+
+#ifndef SIMILARITY_H_
+#define SIMILARITY_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Similarity index of the documents in topic space, meant to be mapped read-only and shared by every query process.
+Little endian:
+- the header below, padded to SIMILARITY_ALIGNMENT,
+- the document vectors scaled to unit length, float32, float16 or int8, one row per document. Every row is padded
+  with zeros to rowStride bytes, a multiple of SIMILARITY_ROW_ALIGNMENT so rows start on a cache line, or for int8
+  a multiple of SIMILARITY_INT8_ALIGNMENT to keep the rows compact,
+- for int8 only, at scalesOffset, a float32 scale per row: the vector is the int8 values times the scale,
+- a bitmap of the deleted documents, bit i % 8 of byte i / 8 for row i.
+Row i is document ID i + 1. Rows of empty documents are all zeros, those of deleted ones keep their vector.
+*/
+#define SIMILARITY_MAGIC "IRLSISIM"
+#define SIMILARITY_VERSION 1
+#define SIMILARITY_FLOAT32 0
+#define SIMILARITY_FLOAT16 1
+#define SIMILARITY_INT8 2
+#define SIMILARITY_ALIGNMENT 4096
+#define SIMILARITY_ROW_ALIGNMENT 64
+#define SIMILARITY_INT8_ALIGNMENT 16
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t valueType;
+	uint64_t rows;
+	uint64_t dimensions;
+	/* Bytes from one row to the next. */
+	uint64_t rowStride;
+	uint64_t vectorsOffset;
+	uint64_t deletedOffset;
+	uint64_t amountDeleted;
+	/* 0 unless int8. */
+	uint64_t scalesOffset;
+} SimilarityHeader;
+
+/* A memory mapped similarity index. */
+typedef struct {
+	SimilarityHeader header;
+	const char* vectors;
+	/* NULL unless int8. */
+	const float* scales;
+	const uint8_t* deleted;
+
+	void* data;
+	unsigned long size;
+} SimilarityIndex;
+
+/* Bytes per value of a valueType. */
+static inline unsigned int similarityValueSize(uint32_t valueType) {
+	return valueType == SIMILARITY_FLOAT32 ? 4 : valueType == SIMILARITY_FLOAT16 ? 2 : 1;
+}
+
+static inline const void* similarityRow(const SimilarityIndex* index, unsigned long row) {
+	return index->vectors + row * index->header.rowStride;
+}
+
+static inline int similarityDeleted(const SimilarityIndex* index, unsigned long row) {
+	return (index->deleted[row / 8] >> (row % 8)) & 1;
+}
+
+/* IEEE half precision, rounded to nearest even. */
+static inline uint16_t similarityToHalf(float value) {
+	uint32_t bits, sign;
+
+	memcpy(&bits, &value, sizeof(bits));
+	sign	= (bits >> 16) & 0x8000;
+	bits	&= 0x7fffffff;
+
+	/* Anything that rounds to 65520 or more is infinite. */
+	if (bits >= 0x477ff000) {
+		return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+
+	/* Subnormals are multiples of 2^-24. */
+	if (bits < 0x38800000) {
+		memcpy(&value, &bits, sizeof(bits));
+		return sign | (uint16_t) lrintf(value * 16777216.0f);
+	}
+
+	/* Rebias the exponent from 127 to 15 and round the mantissa. */
+	bits += 0xc8000fff + ((bits >> 13) & 1);
+	return sign | (bits >> 13);
+}
+
+static inline float similarityFromHalf(uint16_t half) {
+	uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits;
+	float value;
+
+	if (exponent == 0) {
+		value = mantissa / 16777216.0f;
+		return sign ? -value : value;
+	}
+
+	bits = sign | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23) | (mantissa << 13);
+	memcpy(&value, &bits, sizeof(bits));
+
+	return value;
+}
+
+int					similarityWrite(const char* documentPath, const char* deletedPath, const char* indexPath,
+						uint32_t valueType);
+int					similarityWriteRows(FILE* file, const SimilarityIndex* source, const uint64_t* order,
+						unsigned long rows);
+int					similarityView(SimilarityIndex* index, const void* data, unsigned long size);
+SimilarityIndex*	similarityOpen(const char* path);
+void				similarityClose(SimilarityIndex* index);
+
+
+#endif /* SIMILARITY_H_ */
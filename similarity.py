@@ -0,0 +1,205 @@
+import ctypes
+import os
+import struct
+import numpy
+
+HEADER = '<8sIIQQQQQQQ'
+IVF_HEADER = '<8sIIQQQQQQQ'
+ALIGNMENT = 4096
+ROW_ALIGNMENT = 64
+INT8_ALIGNMENT = 16
+FLOAT32, FLOAT16, INT8 = 0, 1, 2
+# Rows scored at a time, so a float16 index is not converted as a whole.
+BLOCK_ROWS = 65536
+
+class SearchResult(ctypes.Structure):
+	_fields_ = [('row', ctypes.c_ulong), ('similarity', ctypes.c_float)]
+
+def align(value, alignment):
+	return (value + alignment - 1) // alignment * alignment
+
+def dense(vec, num_features):
+	if isinstance(vec, numpy.ndarray):
+		return vec.astype(numpy.float32)
+	result = numpy.zeros(num_features, dtype=numpy.float32)
+	for feature, value in vec:
+		result[feature] = value
+	return result
+
+# Maps the similarity index of lsi --index, see similarity.h for the layout. The
+# mapping is read-only, so every worker that opens the same index shares a single
+# copy in the page cache, and opening it takes no time at all. Indexing it with a
+# query in topic space gives the cosine similarity of every document, like
+# gensim's MatrixSimilarity. top() finds the best documents with the search
+# library (see search.c) on threads of its own if it is there, with numpy if not.
+# The ranking of an int8 index is approximate; given exact, the file name of a
+# float index of the same documents, top() re-ranks the best candidates of it.
+# An index within a larger file, like those of an IvfIndex, starts at offset.
+class SimilarityIndex(object):
+	def __init__(self, fname, library='libsearch.so', threads=1, exact=None, candidates=200, offset=0):
+		with open(fname, 'rb') as f:
+			f.seek(offset)
+			header = f.read(struct.calcsize(HEADER))
+		magic, version, valueType, rows, dimensions, rowStride, vectorsOffset, deletedOffset, amountDeleted, \
+			scalesOffset = struct.unpack(HEADER, header)
+		if magic != b'IRLSISIM' or version != 1 or valueType > INT8:
+			raise ValueError('%s is not a similarity index' % fname)
+		dtype = numpy.dtype(['<f4', '<f2', 'i1'][valueType])
+		self.num_features = dimensions
+		self.vectors = numpy.memmap(fname, dtype=dtype, mode='r', offset=offset + vectorsOffset,
+			shape=(rows, rowStride // dtype.itemsize))[:, :dimensions]
+		self.scales = None
+		if valueType == INT8:
+			self.scales = numpy.memmap(fname, dtype='<f4', mode='r', offset=offset + scalesOffset, shape=(rows,))
+		bitmap = numpy.memmap(fname, dtype='u1', mode='r', offset=offset + deletedOffset, shape=(rows // 8 + 1,))
+		self.deleted = set(int(byte) * 8 + bit for byte in numpy.nonzero(bitmap)[0] for bit in range(8)
+			if (bitmap[byte] >> bit) & 1)
+		self.searcher = None
+		self.exact = SimilarityIndex(exact, library=None) if exact else None
+		self.candidates = candidates
+		if library and os.path.exists(library):
+			self.library = ctypes.CDLL(os.path.abspath(library))
+			self.library.searchInit(1)
+			self.library.similarityOpen.restype = ctypes.c_void_p
+			self.library.similarityOpen.argtypes = [ctypes.c_char_p]
+			self.library.searcherInit.restype = ctypes.c_void_p
+			self.library.searcherInit.argtypes = [ctypes.c_void_p, ctypes.c_uint]
+			self.library.searcherQuery.restype = ctypes.c_uint
+			self.library.searcherQuery.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_float), ctypes.c_uint,
+				ctypes.POINTER(SearchResult)]
+			index = self.library.similarityOpen(fname.encode('utf-8'))
+			if not index:
+				raise ValueError('%s is not a similarity index' % fname)
+			self.searcher = self.library.searcherInit(index, threads)
+			if exact:
+				self.library.searcherRerank.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint]
+				exactIndex = self.library.similarityOpen(exact.encode('utf-8'))
+				if not exactIndex:
+					raise ValueError('%s is not a similarity index' % exact)
+				self.library.searcherRerank(self.searcher, exactIndex, candidates)
+
+	def __len__(self):
+		return self.vectors.shape[0]
+
+	def __getitem__(self, query):
+		query = dense(query, self.num_features)
+		norm = numpy.sqrt(numpy.dot(query, query))
+		if norm > 0:
+			query /= norm
+		sims = numpy.empty(len(self), dtype=numpy.float32)
+		for begin in range(0, len(self), BLOCK_ROWS):
+			sims[begin:begin + BLOCK_ROWS] = numpy.dot(
+				self.vectors[begin:begin + BLOCK_ROWS].astype(numpy.float32), query)
+			if self.scales is not None:
+				sims[begin:begin + BLOCK_ROWS] *= self.scales[begin:begin + BLOCK_ROWS]
+		return sims
+
+	# The k most similar documents that are not deleted, as (row, similarity), best first.
+	def top(self, query, k):
+		query = dense(query, self.num_features)
+		if self.searcher is not None:
+			results = (SearchResult * k)()
+			amount = self.library.searcherQuery(self.searcher, query.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+				k, results)
+			return [(results[i].row, results[i].similarity) for i in range(amount)]
+		wanted = max(k, self.candidates) if self.exact is not None else k
+		sims = self[query]
+		sims[list(self.deleted)] = -numpy.inf
+		best = numpy.argpartition(-sims, wanted)[:wanted] if wanted < len(sims) else numpy.arange(len(sims))
+		best = [row for row in best if row not in self.deleted]
+		if self.exact is not None:
+			rows = sorted(best)
+			norm = numpy.sqrt(numpy.dot(query, query))
+			sims = dict(zip(rows, numpy.dot(self.exact.vectors[rows].astype(numpy.float32),
+				query / norm if norm > 0 else query)))
+		return sorted(((int(row), float(sims[row])) for row in best),
+			key=lambda item: (-item[1], item[0]))[:k]
+
+	# Writes the documents of a corpus in topic space, e.g. lsi[corpus], as an index.
+	@staticmethod
+	def serialize(fname, corpus, num_features, float16=False, int8=False):
+		valueType = INT8 if int8 else FLOAT16 if float16 else FLOAT32
+		dtype = numpy.dtype(['<f4', '<f2', 'i1'][valueType])
+		alignment = INT8_ALIGNMENT if int8 else ROW_ALIGNMENT
+		rowStride = (num_features * dtype.itemsize + alignment - 1) // alignment * alignment
+		row = numpy.zeros(rowStride // dtype.itemsize, dtype=dtype)
+		scales = []
+		rows = 0
+		with open(fname, 'wb') as f:
+			f.write(b'\0' * ALIGNMENT)
+			for doc in corpus:
+				vec = dense(doc, num_features).astype(numpy.float64)
+				norm = numpy.sqrt(numpy.dot(vec, vec))
+				largest = numpy.abs(vec).max() if num_features > 0 else 0
+				if int8:
+					row[:num_features] = numpy.rint(vec * 127 / largest) if largest > 0 else 0
+					scales.append(largest / norm / 127 if norm > 0 else 0)
+				else:
+					row[:num_features] = vec / norm if norm > 0 else 0
+				f.write(row.tobytes())
+				rows += 1
+			deletedOffset = align(ALIGNMENT + rows * rowStride, ROW_ALIGNMENT)
+			scalesOffset = 0
+			if int8:
+				scalesOffset, deletedOffset = deletedOffset, align(deletedOffset + rows * 4, ROW_ALIGNMENT)
+				f.write(b'\0' * (scalesOffset - f.tell()))
+				f.write(numpy.array(scales, dtype='<f4').tobytes())
+			f.write(b'\0' * (deletedOffset - f.tell() + rows // 8 + 1))
+			f.seek(0)
+			f.write(struct.pack(HEADER, b'IRLSISIM', 1, valueType, rows, num_features, rowStride,
+				ALIGNMENT, deletedOffset, 0, scalesOffset))
+
+# Maps the inverted file index of lsi --ivf, see ivf.h. top() only scans the
+# documents of the probes centroids closest to the query, so it is approximate;
+# more probes find more of the exact results in more time.
+class IvfIndex(object):
+	def __init__(self, fname, library='libsearch.so', probes=16):
+		with open(fname, 'rb') as f:
+			header = f.read(struct.calcsize(IVF_HEADER))
+		magic, version, reserved, lists, rows, dimensions, centroidsOffset, listsOffset, rowsOffset, \
+			documentsOffset = struct.unpack(IVF_HEADER, header)
+		if magic != b'IRLSIIVF' or version != 1:
+			raise ValueError('%s is not an ivf index' % fname)
+		self.num_features = dimensions
+		self.probes = probes
+		self.centroids = SimilarityIndex(fname, library=None, offset=centroidsOffset)
+		self.documents = SimilarityIndex(fname, library=None, offset=documentsOffset)
+		self.lists = numpy.memmap(fname, dtype='<u8', mode='r', offset=listsOffset, shape=(lists + 1,))
+		self.rows = numpy.memmap(fname, dtype='<u8', mode='r', offset=rowsOffset, shape=(rows,))
+		# Rows of the deleted documents, the bitmap of the documents is by position in the lists.
+		self.deleted = set(int(self.rows[p]) for p in self.documents.deleted)
+		self.ivf = None
+		if library and os.path.exists(library):
+			self.library = ctypes.CDLL(os.path.abspath(library))
+			self.library.searchInit(1)
+			self.library.ivfOpen.restype = ctypes.c_void_p
+			self.library.ivfOpen.argtypes = [ctypes.c_char_p]
+			self.library.ivfQuery.restype = ctypes.c_uint
+			self.library.ivfQuery.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_float), ctypes.c_uint,
+				ctypes.c_uint, ctypes.POINTER(SearchResult)]
+			self.ivf = self.library.ivfOpen(fname.encode('utf-8'))
+			if not self.ivf:
+				raise ValueError('%s is not an ivf index' % fname)
+
+	def __len__(self):
+		return len(self.rows)
+
+	# The k most similar documents that are not deleted among those of the probes
+	# closest lists, as (row, similarity), best first.
+	def top(self, query, k, probes=None):
+		query = dense(query, self.num_features)
+		probes = min(probes or self.probes, len(self.lists) - 1)
+		if self.ivf is not None:
+			results = (SearchResult * k)()
+			amount = self.library.ivfQuery(self.ivf, query.ctypes.data_as(ctypes.POINTER(ctypes.c_float)), probes,
+				k, results)
+			return [(results[i].row, results[i].similarity) for i in range(amount)]
+		closest = [row for row, similarity in self.centroids.top(query, probes)]
+		positions = numpy.concatenate([numpy.arange(self.lists[i], self.lists[i + 1]) for i in closest])
+		positions = numpy.array([p for p in positions if p not in self.documents.deleted], dtype=numpy.int64)
+		norm = numpy.sqrt(numpy.dot(query, query))
+		sims = numpy.dot(self.documents.vectors[positions].astype(numpy.float32), query / norm if norm > 0 else query)
+		if self.documents.scales is not None:
+			sims *= self.documents.scales[positions]
+		return sorted(((int(self.rows[p]), float(sim)) for p, sim in zip(positions, sims)),
+			key=lambda item: (-item[1], item[0]))[:k]
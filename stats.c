@@ -0,0 +1,143 @@
+/**
+ * stats.c
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char* timerNames[STATS_TIMERS] = { "decompress", "parse", "wait", "tokenize", "output" };
+
+/* Path "-" reports to stderr. */
+Stats* statsInit(const char* path, double interval) {
+	Stats* stats;
+
+	stats = calloc(1, sizeof(Stats));
+	if (strcmp(path, "-") == 0) {
+		stats->file = stderr;
+	}
+	else {
+		stats->file = fopen(path, "w");
+		if (stats->file == NULL) {
+			free(stats);
+			return NULL;
+		}
+	}
+
+	stats->interval		= interval;
+	stats->start		= statsNow();
+	stats->lastReport	= stats->start;
+	pthread_mutex_init(&stats->lock, NULL);
+
+	return stats;
+}
+
+double statsNow() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static unsigned int bucket(unsigned long value) {
+	unsigned int i;
+
+	for (i = 0; value != 0 && i < STATS_BUCKETS - 1; ++i) {
+		value >>= 1;
+	}
+
+	return i;
+}
+
+void statsTime(Stats* stats, int timer, double seconds) {
+	pthread_mutex_lock(&stats->lock);
+	stats->seconds[timer] += seconds;
+	pthread_mutex_unlock(&stats->lock);
+}
+
+void statsDecompressed(Stats* stats, unsigned long bytes) {
+	pthread_mutex_lock(&stats->lock);
+	stats->bytesDecompressed += bytes;
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/* A written page, its text size, amount of tokens and of distinct tokens, i.e. its entries in the bow. */
+void statsPage(Stats* stats, unsigned long bytes, unsigned long tokens, unsigned long distinct) {
+	pthread_mutex_lock(&stats->lock);
+	++stats->pages;
+	stats->entries += distinct;
+	++stats->pageBytes[bucket(bytes)];
+	++stats->pageTokens[bucket(tokens)];
+	pthread_mutex_unlock(&stats->lock);
+}
+
+void statsVocabulary(Stats* stats, unsigned long tokens, unsigned long buckets, unsigned long resizes) {
+	pthread_mutex_lock(&stats->lock);
+	stats->tokens	= tokens;
+	stats->buckets	= buckets;
+	stats->resizes	= resizes;
+	pthread_mutex_unlock(&stats->lock);
+}
+
+static void writeHistogram(FILE* file, const char* name, const unsigned long* counts) {
+	unsigned int i, last;
+
+	/* Trailing empty buckets are left out. */
+	for (last = STATS_BUCKETS; last > 1 && counts[last - 1] == 0; --last);
+
+	fprintf(file, ",\"%s\":[", name);
+	for (i = 0; i < last; ++i) {
+		fprintf(file, i == 0 ? "%lu" : ",%lu", counts[i]);
+	}
+	fputc(']', file);
+}
+
+/* Writes a line once the interval has passed since the last one, or if it is the final line. */
+void statsReport(Stats* stats, int final) {
+	double now = statsNow();
+	double elapsed;
+	int i;
+
+	if (!final && now - stats->lastReport < stats->interval) {
+		return;
+	}
+
+	pthread_mutex_lock(&stats->lock);
+
+	elapsed				= now - stats->start;
+	stats->lastReport	= now;
+
+	fprintf(stats->file, "{\"elapsed\":%.3f,\"final\":%s,\"bytesDecompressed\":%lu,\"pages\":%lu,\"entries\":%lu",
+		elapsed, final ? "true" : "false", stats->bytesDecompressed, stats->pages, stats->entries);
+	fprintf(stats->file, ",\"megabytesPerSecond\":%.3f", elapsed > 0 ? stats->bytesDecompressed / elapsed / 1e6 : 0);
+
+	fputs(",\"seconds\":{", stats->file);
+	for (i = 0; i < STATS_TIMERS; ++i) {
+		fprintf(stats->file, "%s\"%s\":%.3f", i == 0 ? "" : ",", timerNames[i], stats->seconds[i]);
+	}
+	fputc('}', stats->file);
+
+	fprintf(stats->file, ",\"tokens\":{\"size\":%lu,\"buckets\":%lu,\"loadFactor\":%.3f,\"resizes\":%lu}",
+		stats->tokens, stats->buckets, stats->buckets ? (double) stats->tokens / stats->buckets : 0,
+		stats->resizes);
+
+	writeHistogram(stats->file, "pageBytes", stats->pageBytes);
+	writeHistogram(stats->file, "pageTokens", stats->pageTokens);
+	fputs("}\n", stats->file);
+	fflush(stats->file);
+
+	pthread_mutex_unlock(&stats->lock);
+}
+
+void statsDestroy(Stats* stats) {
+	if (stats->file != stderr) {
+		fclose(stats->file);
+	}
+
+	pthread_mutex_destroy(&stats->lock);
+	free(stats);
+}
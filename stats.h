@@ -0,0 +1,56 @@
+/**
+ * stats.h
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* Timers, seconds spent per stage. Tokenizing and writing may be done by other threads than parsing. */
+#define STATS_DECOMPRESS 0
+#define STATS_PARSE 1
+#define STATS_WAIT 2
+#define STATS_TOKENIZE 3
+#define STATS_OUTPUT 4
+#define STATS_TIMERS 5
+
+/* Histogram bucket i counts the values from 2^(i - 1) up to 2^i, bucket 0 counts zeros. */
+#define STATS_BUCKETS 33
+
+/*
+Counters of a tokenizer run, reported as a JSON object per line. The counters are updated from several threads, so
+they are protected by a lock; the updates happen per chunk or per page, not per token.
+*/
+typedef struct {
+	FILE* file;
+	double interval;
+	double start;
+	double lastReport;
+	pthread_mutex_t lock;
+
+	double seconds[STATS_TIMERS];
+	unsigned long bytesDecompressed;
+	unsigned long pages;
+	unsigned long entries;
+	unsigned long pageBytes[STATS_BUCKETS];
+	unsigned long pageTokens[STATS_BUCKETS];
+
+	/* The global word list. */
+	unsigned long tokens;
+	unsigned long buckets;
+	unsigned long resizes;
+} Stats;
+
+Stats*	statsInit(const char* path, double interval);
+double	statsNow();
+void	statsTime(Stats* stats, int timer, double seconds);
+void	statsDecompressed(Stats* stats, unsigned long bytes);
+void	statsPage(Stats* stats, unsigned long bytes, unsigned long tokens, unsigned long distinct);
+void	statsVocabulary(Stats* stats, unsigned long tokens, unsigned long buckets, unsigned long resizes);
+void	statsReport(Stats* stats, int final);
+void	statsDestroy(Stats* stats);
+
+
+#endif /* STATS_H_ */
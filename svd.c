@@ -0,0 +1,627 @@
+/**
+ * svd.c
+ *
+ * Randomized truncated SVD after Halko, Martinsson and Tropp, the way gensim's stochastic_svd does it: the range of
+ * A^T is sampled with a random projection, sharpened by power iterations and orthonormalized, after which only a
+ * small dense eigenproblem is left. Only terms by samples matrices are kept, the documents are streamed.
+ *
+ * The sparse products run on a pool of threads per block of rows: first the rows are split between the threads,
+ * then the columns of the dense result, so every thread updates its own cache lines and the result does not depend
+ * on the amount of threads.
+ *
+ * For matrices that do not fit in memory, blocks of documents are decomposed one at a time and merged into the
+ * decomposition so far, like gensim's distributed LsiModel merges the decompositions of its workers.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "svd.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rows of the sparse matrix per block. */
+#define SVD_BLOCK_ROWS 16384
+/* Column slices of the threads are a multiple of a cache line of doubles. */
+#define SVD_SLICE 8
+#define SVD_PI 3.14159265358979323846
+
+/* LAPACK and BLAS, with Fortran calling conventions: arguments by reference and matrices column major. */
+extern void dgelqf_(const int* m, const int* n, double* a, const int* lda, double* tau, double* work, const int* lwork,
+	int* info);
+extern void dorglq_(const int* m, const int* n, const int* k, double* a, const int* lda, const double* tau,
+	double* work, const int* lwork, int* info);
+extern void dsyev_(const char* jobz, const char* uplo, const int* n, double* a, const int* lda, double* w,
+	double* work, const int* lwork, int* info);
+extern void dgemm_(const char* transa, const char* transb, const int* m, const int* n, const int* k,
+	const double* alpha, const double* a, const int* lda, const double* b, const int* ldb, const double* beta,
+	double* c, const int* ldc);
+
+#define PASS_RANGE 0
+#define PASS_GRAM 1
+#define PASS_PROJECT 2
+
+/* A pass over the sparse matrix A, documents by terms. */
+typedef struct {
+	int type;
+	const CsrMatrix* matrix;
+	unsigned long terms;
+	unsigned long samples;
+	uint64_t seed;
+	unsigned int threads;
+
+	/* Rows of the current block. */
+	unsigned long rowBegin;
+	unsigned long rowEnd;
+	/* The block times basis, a row of samples per document. Random if there is no basis yet. */
+	double* products;
+	const double* basis;
+
+	/* PASS_RANGE adds A^T products to range, terms by samples. */
+	double* range;
+	/* PASS_GRAM adds products^T products to gram, samples by samples. */
+	double* gram;
+	/* PASS_PROJECT converts the products of the block to floats. */
+	float* projected;
+} Pass;
+
+typedef struct {
+	Pass* pass;
+	unsigned int thread;
+} Worker;
+
+static uint64_t mix(uint64_t x) {
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* Standard normal number for a row and column of the random projection, the same whichever thread asks. */
+static double gaussian(uint64_t seed, unsigned long row, unsigned long column) {
+	uint64_t bits = mix(seed ^ mix(((uint64_t) row << 20) ^ column));
+	double u1 = ((bits >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double u2 = (mix(bits) >> 11) * (1.0 / 9007199254740992.0);
+
+	return sqrt(-2 * log(u1)) * cos(2 * SVD_PI * u2);
+}
+
+/* The part [*begin, *end) of amount that thread gets, in multiples of step. */
+static void share(unsigned long amount, unsigned long step, unsigned int thread, unsigned int threads,
+	unsigned long* begin, unsigned long* end) {
+	unsigned long size = (amount + threads - 1) / threads;
+
+	size	= (size + step - 1) / step * step;
+	*begin	= thread * size < amount ? thread * size : amount;
+	*end	= *begin + size < amount ? *begin + size : amount;
+}
+
+/* Runs function on every thread of the pass and waits for all of them. */
+static int runThreads(Pass* pass, void* (*function)(void*)) {
+	pthread_t* threads;
+	Worker* workers;
+	unsigned int i, started;
+	int result = 0;
+
+	if (pass->threads == 1) {
+		Worker worker = { pass, 0 };
+		function(&worker);
+		return 0;
+	}
+
+	threads	= malloc(sizeof(pthread_t) * pass->threads);
+	workers	= malloc(sizeof(Worker) * pass->threads);
+	for (started = 0; started < pass->threads; ++started) {
+		workers[started].pass	= pass;
+		workers[started].thread	= started;
+		if (pthread_create(&threads[started], NULL, function, &workers[started]) != 0) {
+			result = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+	free(workers);
+
+	return result;
+}
+
+/* The products of a share of the rows of the block. */
+static void* multiplyThread(void* data) {
+	Worker* worker = (Worker*) data;
+	Pass* pass = worker->pass;
+	const CsrMatrix* matrix = pass->matrix;
+	const float* values = (const float*) matrix->values;
+	unsigned long samples = pass->samples;
+	unsigned long begin, end, row, i, j;
+	double* product;
+	const double* basisRow;
+	double value;
+
+	share(pass->rowEnd - pass->rowBegin, 1, worker->thread, pass->threads, &begin, &end);
+	for (row = pass->rowBegin + begin; row < pass->rowBegin + end; ++row) {
+		product = pass->products + (row - pass->rowBegin) * samples;
+
+		if (pass->basis == NULL) {
+			for (j = 0; j < samples; ++j) {
+				product[j] = gaussian(pass->seed, row, j);
+			}
+			continue;
+		}
+
+		memset(product, 0, sizeof(double) * samples);
+		for (i = matrix->indptr[row]; i < matrix->indptr[row + 1]; ++i) {
+			value		= values[i];
+			basisRow	= pass->basis + (unsigned long) matrix->indices[i] * samples;
+			for (j = 0; j < samples; ++j) {
+				product[j] += value * basisRow[j];
+			}
+		}
+
+		if (pass->type == PASS_PROJECT) {
+			for (j = 0; j < samples; ++j) {
+				pass->projected[(row - pass->rowBegin) * samples + j] = product[j];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Adds the block to a share of the columns of range or gram. */
+static void* accumulateThread(void* data) {
+	Worker* worker = (Worker*) data;
+	Pass* pass = worker->pass;
+	const CsrMatrix* matrix = pass->matrix;
+	const float* values = (const float*) matrix->values;
+	unsigned long samples = pass->samples;
+	unsigned long begin, end, row, i, j, k;
+	const double* product;
+	double* target;
+	double value;
+
+	share(samples, SVD_SLICE, worker->thread, pass->threads, &begin, &end);
+	if (begin == end) {
+		return NULL;
+	}
+
+	for (row = pass->rowBegin; row < pass->rowEnd; ++row) {
+		product = pass->products + (row - pass->rowBegin) * samples;
+
+		if (pass->type == PASS_RANGE) {
+			for (i = matrix->indptr[row]; i < matrix->indptr[row + 1]; ++i) {
+				value	= values[i];
+				target	= pass->range + (unsigned long) matrix->indices[i] * samples;
+				for (j = begin; j < end; ++j) {
+					target[j] += value * product[j];
+				}
+			}
+		}
+		else {
+			for (k = 0; k < samples; ++k) {
+				value	= product[k];
+				target	= pass->gram + k * samples;
+				for (j = begin; j < end; ++j) {
+					target[j] += value * product[j];
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Streams the whole matrix through the pass, block by block. Calls done after every block if it is set. */
+static int runPass(Pass* pass, int (*done)(Pass*, void*), void* data) {
+	unsigned long rows = pass->matrix->header.rows;
+
+	for (pass->rowBegin = 0; pass->rowBegin < rows; pass->rowBegin = pass->rowEnd) {
+		pass->rowEnd = pass->rowBegin + SVD_BLOCK_ROWS < rows ? pass->rowBegin + SVD_BLOCK_ROWS : rows;
+
+		if (runThreads(pass, multiplyThread) != 0) {
+			return -1;
+		}
+
+		if (pass->type != PASS_PROJECT && runThreads(pass, accumulateThread) != 0) {
+			return -1;
+		}
+
+		if (done != NULL && done(pass, data) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+Orthonormalizes the columns of a terms by samples matrix, row major, in place. Stores the samples by samples upper
+triangular R of matrix = Q R in r, column major, unless it is NULL.
+*/
+static int orthonormalize(double* matrix, unsigned long terms, unsigned long samples, double* r) {
+	int m = samples;
+	int n = terms;
+	int lwork = -1;
+	int query;
+	int info;
+	double size;
+	double* tau;
+	unsigned long i, j;
+	double* work;
+
+	tau = malloc(sizeof(double) * samples);
+
+	/* Row major terms by samples is column major samples by terms, whose rows LQ orthonormalizes. */
+	dgelqf_(&m, &n, matrix, &m, tau, &size, &lwork, &info);
+	lwork = size;
+	query = -1;
+	dorglq_(&m, &n, &m, matrix, &m, tau, &size, &query, &info);
+	if (size > lwork) {
+		lwork = size;
+	}
+
+	work = malloc(sizeof(double) * lwork);
+	dgelqf_(&m, &n, matrix, &m, tau, work, &lwork, &info);
+	if (info == 0 && r != NULL) {
+		/* R is the transpose of the L left in the lower triangle. */
+		memset(r, 0, sizeof(double) * samples * samples);
+		for (i = 0; i < samples; ++i) {
+			for (j = i; j < samples; ++j) {
+				r[i + j * samples] = matrix[j + i * samples];
+			}
+		}
+	}
+
+	if (info == 0) {
+		dorglq_(&m, &n, &m, matrix, &m, tau, work, &lwork, &info);
+	}
+
+	free(tau);
+	free(work);
+
+	return info == 0 ? 0 : -1;
+}
+
+/*
+Eigenvectors of the symmetric samples by samples gram, the largest topics first. Sets sigma to the square roots of
+their eigenvalues and returns the eigenvectors as columns of a samples by topics column major matrix.
+*/
+static double* decompose(double* gram, unsigned long samples, unsigned long topics, double* sigma) {
+	int n = samples;
+	int lwork = -1;
+	int info;
+	double size;
+	double* eigenvalues;
+	double* work;
+	double* vectors;
+	unsigned long i, column;
+
+	eigenvalues = malloc(sizeof(double) * samples);
+	dsyev_("V", "U", &n, gram, &n, eigenvalues, &size, &lwork, &info);
+	lwork	= size;
+	work	= malloc(sizeof(double) * lwork);
+	dsyev_("V", "U", &n, gram, &n, eigenvalues, work, &lwork, &info);
+	free(work);
+
+	if (info != 0) {
+		free(eigenvalues);
+		return NULL;
+	}
+
+	/* Eigenvalues come in ascending order. */
+	vectors = malloc(sizeof(double) * samples * topics);
+	for (i = 0; i < topics; ++i) {
+		column		= samples - 1 - i;
+		sigma[i]	= eigenvalues[column] > 0 ? sqrt(eigenvalues[column]) : 0;
+		memcpy(vectors + i * samples, gram + column * samples, sizeof(double) * samples);
+	}
+
+	free(eigenvalues);
+
+	return vectors;
+}
+
+/* Computes the first topics singular values and right singular vectors of a matrix of float weights. */
+int svdCompute(const CsrMatrix* matrix, const SvdOptions* options, Svd* svd) {
+	Pass pass;
+	double* swap;
+	double* vectors;
+	unsigned long limit;
+	unsigned int i;
+	int m, n, k;
+	const double one = 1;
+	const double zero = 0;
+
+	if (matrix->header.valueType != CSR_FLOATS) {
+		return -1;
+	}
+
+	memset(&pass, 0, sizeof(pass));
+	pass.matrix		= matrix;
+	pass.terms		= matrix->header.columns;
+	pass.seed		= options->seed;
+	pass.threads	= options->threads > 0 ? options->threads : 1;
+
+	/* There are no more directions than the smaller side of the matrix. */
+	limit			= pass.terms < matrix->header.rows ? pass.terms : matrix->header.rows;
+	pass.samples	= options->topics + options->oversample < limit ? options->topics + options->oversample : limit;
+	svd->topics		= options->topics < pass.samples ? options->topics : pass.samples;
+	svd->terms		= pass.terms;
+	svd->sigma		= NULL;
+	svd->vectors	= NULL;
+	if (svd->topics == 0) {
+		return -1;
+	}
+
+	pass.products	= malloc(sizeof(double) * SVD_BLOCK_ROWS * pass.samples);
+	pass.range		= calloc(pass.terms * pass.samples, sizeof(double));
+	swap			= malloc(sizeof(double) * pass.terms * pass.samples);
+
+	/* Range of A^T from a random projection, then each power iteration multiplies by A^T A once more. */
+	if (options->progress) {
+		printf("Sampling the range, samples: %lu\n", pass.samples);
+	}
+	pass.type = PASS_RANGE;
+	for (i = 0; i <= options->powerIterations; ++i) {
+		if (i > 0) {
+			if (options->progress) {
+				printf("Power iteration %u of %u\n", i, options->powerIterations);
+			}
+			pass.basis	= pass.range;
+			pass.range	= swap;
+			swap		= (double*) pass.basis;
+			memset(pass.range, 0, sizeof(double) * pass.terms * pass.samples);
+		}
+
+		if (runPass(&pass, NULL, NULL) != 0 || orthonormalize(pass.range, pass.terms, pass.samples, NULL) != 0) {
+			free(pass.products);
+			free(pass.range);
+			free(swap);
+			return -1;
+		}
+	}
+	free(swap);
+
+	/* A Q is small enough in the samples dimension for (A Q)^T A Q to be decomposed directly. */
+	if (options->progress) {
+		printf("Decomposing\n");
+	}
+	pass.type	= PASS_GRAM;
+	pass.basis	= pass.range;
+	pass.gram	= calloc(pass.samples * pass.samples, sizeof(double));
+	svd->sigma	= malloc(sizeof(double) * svd->topics);
+	vectors		= NULL;
+	if (runPass(&pass, NULL, NULL) == 0) {
+		vectors = decompose(pass.gram, pass.samples, svd->topics, svd->sigma);
+	}
+
+	free(pass.gram);
+	free(pass.products);
+	if (vectors == NULL) {
+		free(pass.range);
+		svdDestroy(svd);
+		return -1;
+	}
+
+	/* V = Q W, in column major terms V^T = W^T Q^T. */
+	svd->vectors	= malloc(sizeof(double) * pass.terms * svd->topics);
+	m				= svd->topics;
+	n				= pass.terms;
+	k				= pass.samples;
+	dgemm_("T", "N", &m, &n, &k, &one, vectors, &k, pass.range, &k, &zero, svd->vectors, &m);
+
+	free(vectors);
+	free(pass.range);
+
+	return 0;
+}
+
+/* Merges the decomposition of another block of documents into svd, keeping at most topics topics. */
+static int merge(Svd* svd, Svd* block, unsigned long topics) {
+	int k = svd->topics;
+	int kb = block->topics;
+	int n = k + kb;
+	int terms = svd->terms;
+	int t;
+	const double one = 1;
+	const double minusOne = -1;
+	const double zero = 0;
+	double* overlap;
+	double* r;
+	double* middle;
+	double* gram;
+	double* rotation;
+	double* sigma;
+	double* vectors;
+	int i, j;
+
+	/* The part of the block in the span of svd, overlap = V^T Vb, and the part outside of it, Vb - V overlap. */
+	overlap = malloc(sizeof(double) * k * kb);
+	dgemm_("N", "T", &k, &kb, &terms, &one, svd->vectors, &k, block->vectors, &kb, &zero, overlap, &k);
+	dgemm_("T", "N", &kb, &terms, &k, &minusOne, overlap, &k, svd->vectors, &k, &one, block->vectors, &kb);
+
+	r = malloc(sizeof(double) * kb * kb);
+	if (orthonormalize(block->vectors, terms, kb, r) != 0) {
+		free(overlap);
+		free(r);
+		return -1;
+	}
+
+	/* [V S, Vb Sb] = [V, Q] middle, with middle = [[S, overlap Sb], [0, R Sb]]. */
+	middle = calloc(n * n, sizeof(double));
+	for (i = 0; i < k; ++i) {
+		middle[i + i * n] = svd->sigma[i];
+	}
+	for (j = 0; j < kb; ++j) {
+		for (i = 0; i < k; ++i) {
+			middle[i + (k + j) * n] = overlap[i + j * k] * block->sigma[j];
+		}
+		for (i = 0; i <= j; ++i) {
+			middle[k + i + (k + j) * n] = r[i + j * kb] * block->sigma[j];
+		}
+	}
+	free(overlap);
+	free(r);
+
+	gram = malloc(sizeof(double) * n * n);
+	dgemm_("N", "T", &n, &n, &n, &one, middle, &n, middle, &n, &zero, gram, &n);
+	free(middle);
+
+	t			= topics < (unsigned long) n ? (int) topics : n;
+	sigma		= malloc(sizeof(double) * t);
+	rotation	= decompose(gram, n, t, sigma);
+	free(gram);
+	if (rotation == NULL) {
+		free(sigma);
+		return -1;
+	}
+
+	/* The new V = [V, Q] rotation, in column major terms V^T rotation_top + Q^T rotation_bottom. */
+	vectors = malloc(sizeof(double) * terms * t);
+	dgemm_("T", "N", &t, &terms, &k, &one, rotation, &n, svd->vectors, &k, &zero, vectors, &t);
+	dgemm_("T", "N", &t, &terms, &kb, &one, rotation + k, &n, block->vectors, &kb, &one, vectors, &t);
+	free(rotation);
+
+	svdDestroy(svd);
+	svd->topics		= t;
+	svd->sigma		= sigma;
+	svd->vectors	= vectors;
+
+	return 0;
+}
+
+/* Keeps only the first topics topics. */
+static void truncate(Svd* svd, unsigned long topics) {
+	unsigned long i;
+
+	if (topics >= svd->topics) {
+		return;
+	}
+
+	for (i = 0; i < svd->terms; ++i) {
+		memmove(svd->vectors + i * topics, svd->vectors + i * svd->topics, sizeof(double) * topics);
+	}
+	svd->topics = topics;
+}
+
+/*
+Documents per block for svdStream to stay below maxMemory bytes: the decomposition so far, the one of the block and
+the mapped window of the block. Returns 0 if even a small block does not fit.
+*/
+unsigned long svdBlockRows(const CsrHeader* header, const SvdOptions* options, unsigned long maxMemory) {
+	unsigned long terms = header->columns;
+	unsigned long kept = options->topics + options->oversample;
+	unsigned long samples = kept + options->oversample < terms ? kept + options->oversample : terms;
+	unsigned long compute, mergeSize, fixed, perRow, rows;
+
+	/* Both go on top of the decomposition so far, see svdCompute and merge. */
+	compute		= 8 * (2 * terms * samples + SVD_BLOCK_ROWS * samples + samples * samples);
+	mergeSize	= 8 * (2 * terms * kept + 12 * kept * kept);
+	fixed		= 8 * terms * kept + (compute > mergeSize ? compute : mergeSize);
+	perRow		= 8 + (header->rows > 0 ? 8 * header->entries / header->rows + 8 : 8);
+
+	if (maxMemory <= fixed) {
+		return 0;
+	}
+
+	rows = (maxMemory - fixed) / perRow;
+	if (rows < samples) {
+		return 0;
+	}
+
+	return rows < header->rows ? rows : header->rows;
+}
+
+/*
+Decomposes the matrix one block of rows at a time, mapping only the block, and merges the decompositions. Memory
+use does not depend on the amount of documents, see svdBlockRows. The oversampled topics are kept until the end, the
+merges lose less of the smaller topics that way.
+*/
+int svdStream(CsrReader* reader, const CsrHeader* header, unsigned long blockRows, const SvdOptions* options,
+	Svd* svd) {
+	SvdOptions blockOptions = *options;
+	CsrMatrix window;
+	Svd block;
+	unsigned long begin, end;
+
+	svd->topics		= 0;
+	svd->terms		= header->columns;
+	svd->sigma		= NULL;
+	svd->vectors	= NULL;
+	blockOptions.progress = 0;
+	blockOptions.topics += options->oversample;
+
+	for (begin = 0; begin < header->rows; begin = end) {
+		end = begin + blockRows < header->rows ? begin + blockRows : header->rows;
+		if (options->progress) {
+			printf("Decomposing documents %lu up to %lu of %lu\n", begin + 1, end, (unsigned long) header->rows);
+		}
+
+		if (csrReaderRows(reader, begin, end, &window) != 0 || svdCompute(&window, &blockOptions, &block) != 0) {
+			svdDestroy(svd);
+			return -1;
+		}
+
+		if (svd->vectors == NULL) {
+			*svd = block;
+			continue;
+		}
+
+		if (merge(svd, &block, blockOptions.topics) != 0) {
+			svdDestroy(&block);
+			svdDestroy(svd);
+			return -1;
+		}
+		svdDestroy(&block);
+	}
+
+	if (svd->vectors == NULL) {
+		return -1;
+	}
+
+	truncate(svd, options->topics);
+	return 0;
+}
+
+static int writeProjected(Pass* pass, void* data) {
+	return denseWriterRows((DenseWriter*) data, pass->projected, pass->rowEnd - pass->rowBegin);
+}
+
+/* Writes the documents in topic space, A V = U S, as rows of floats. */
+int svdProject(const CsrMatrix* matrix, const Svd* svd, DenseWriter* documents, unsigned int threads) {
+	Pass pass;
+	int result;
+
+	if (matrix->header.valueType != CSR_FLOATS || matrix->header.columns != svd->terms) {
+		return -1;
+	}
+
+	memset(&pass, 0, sizeof(pass));
+	pass.type		= PASS_PROJECT;
+	pass.matrix		= matrix;
+	pass.terms		= svd->terms;
+	pass.samples	= svd->topics;
+	pass.threads	= threads > 0 ? threads : 1;
+	pass.basis		= svd->vectors;
+	pass.products	= malloc(sizeof(double) * SVD_BLOCK_ROWS * pass.samples);
+	pass.projected	= malloc(sizeof(float) * SVD_BLOCK_ROWS * pass.samples);
+
+	result = runPass(&pass, writeProjected, documents);
+
+	free(pass.products);
+	free(pass.projected);
+
+	return result;
+}
+
+void svdDestroy(Svd* svd) {
+	free(svd->sigma);
+	free(svd->vectors);
+	svd->sigma		= NULL;
+	svd->vectors	= NULL;
+}
@@ -0,0 +1,40 @@
+/**
+ * svd.h
+ */
+
+#ifndef SVD_H_
+#define SVD_H_
+
+#include <stdint.h>
+#include "matrix.h"
+
+typedef struct {
+	unsigned long topics;
+	/* Extra dimensions of the random projection, gensim's extra_samples. */
+	unsigned long oversample;
+	unsigned int powerIterations;
+	unsigned int threads;
+	uint64_t seed;
+	/* Prints the steps if set. */
+	int progress;
+} SvdOptions;
+
+/* Truncated SVD of a documents by terms matrix, A ~ U S V^T. */
+typedef struct {
+	unsigned long topics;
+	unsigned long terms;
+	/* S, descending. */
+	double* sigma;
+	/* V, a row of topics per term, i.e. gensim's projection.u. */
+	double* vectors;
+} Svd;
+
+int				svdCompute(const CsrMatrix* matrix, const SvdOptions* options, Svd* svd);
+unsigned long	svdBlockRows(const CsrHeader* header, const SvdOptions* options, unsigned long maxMemory);
+int				svdStream(CsrReader* reader, const CsrHeader* header, unsigned long blockRows,
+					const SvdOptions* options, Svd* svd);
+int				svdProject(const CsrMatrix* matrix, const Svd* svd, DenseWriter* documents, unsigned int threads);
+void			svdDestroy(Svd* svd);
+
+
+#endif /* SVD_H_ */
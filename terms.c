@@ -0,0 +1,443 @@
+/**
+ * terms.c
+ *
+ * Writes and maps the term table of terms.h. The rows are the topic vectors of lsi, i.e. V, times the idf of the
+ * term, so the sum of the rows of the terms of a query times their counts is its tf-idf vector folded into topic
+ * space, up to the length of the tf-idf vector, which a cosine search does not care about. The terms are found with a
+ * perfect hash like the stopwords of normalize.c: a bucket picks a displacement, which picks a slot that holds one
+ * term only, so a lookup reads one displacement, one slot and compares one term.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "terms.h"
+#include "hash.h"
+#include "matrix.h"
+#include "tfidf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Slots per term at least, and terms per bucket at most, on average. */
+#define TERMS_LOAD 2
+#define TERMS_DISPLACEMENTS (1 << 24)
+#define TERMS_BUFFER_SIZE (8 * 1024 * 1024)
+
+/* The terms of a word ID file by word ID, zero based. */
+typedef struct {
+	char* text;
+	unsigned long textSize;
+	uint64_t* begins;
+	uint32_t* lengths;
+	double* idfs;
+	unsigned long amount;
+} Words;
+
+static int isLittleEndian() {
+	uint16_t value = 1;
+	return *(uint8_t*) &value == 1;
+}
+
+static inline unsigned long termsSlot(uint64_t hash, uint32_t displacement, uint64_t slots) {
+	return hashMultiply(hash, HASH_SECRET1 + displacement) & (slots - 1);
+}
+
+static inline unsigned long termsBucket(uint64_t hash, uint32_t bucketBits) {
+	return hash >> (64 - bucketBits);
+}
+
+/* Reads the terms and idfs of a word ID file, lines of ID, term and document occurence in no particular order. */
+static int readWords(const char* path, unsigned long documents, Words* words) {
+	FILE* file;
+	unsigned long size = 0;
+	unsigned long textCapacity = 0;
+	unsigned long id, length;
+	char* line = NULL;
+	char* term;
+	char* occurence;
+	size_t capacity = 0;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	memset(words, 0, sizeof(Words));
+	while (getline(&line, &capacity, file) > 0) {
+		id			= strtoul(line, &term, 10);
+		occurence	= strrchr(line, '\t');
+		if (id == 0 || *term != '\t' || occurence == NULL || occurence == term) {
+			continue;
+		}
+		++term;
+		length = occurence - term;
+
+		if (id > size) {
+			size			= id * 2;
+			words->begins	= realloc(words->begins, sizeof(uint64_t) * size);
+			words->lengths	= realloc(words->lengths, sizeof(uint32_t) * size);
+			words->idfs		= realloc(words->idfs, sizeof(double) * size);
+			memset(words->lengths + words->amount, 0, sizeof(uint32_t) * (size - words->amount));
+			memset(words->idfs + words->amount, 0, sizeof(double) * (size - words->amount));
+		}
+
+		if (words->textSize + length > textCapacity) {
+			textCapacity	= (words->textSize + length) * 2;
+			words->text		= realloc(words->text, textCapacity);
+		}
+		memcpy(words->text + words->textSize, term, length);
+
+		words->begins[id - 1]	= words->textSize;
+		words->lengths[id - 1]	= length;
+		words->idfs[id - 1]		= tfidfIdf(strtoul(occurence + 1, NULL, 10), documents);
+		words->textSize			+= length;
+		if (id > words->amount) {
+			words->amount = id;
+		}
+	}
+
+	free(line);
+	fclose(file);
+
+	return 0;
+}
+
+static void freeWords(Words* words) {
+	free(words->text);
+	free(words->begins);
+	free(words->lengths);
+	free(words->idfs);
+}
+
+/*
+Places every term in a slot of its own, the largest buckets first since they are the hardest to place. Returns -1 if
+a bucket cannot be placed, which only happens for a term that is in the word ID file twice.
+*/
+static int place(const Words* words, const TermsHeader* header, uint32_t* displacements, uint32_t* slots) {
+	unsigned long buckets = 1ul << header->bucketBits;
+	uint64_t* hashes;
+	uint64_t* starts;
+	uint32_t* order;
+	unsigned long* placed;
+	unsigned long id, bucket, size, largest, slot, amount, i;
+	uint32_t displacement;
+	int result = 0;
+
+	hashes	= calloc(words->amount + 1, sizeof(uint64_t));
+	starts	= calloc(buckets + 1, sizeof(uint64_t));
+	order	= malloc(sizeof(uint32_t) * (words->amount + 1));
+	for (id = 1; id <= words->amount; ++id) {
+		if (words->lengths[id - 1] > 0) {
+			hashes[id] = hashToken(words->text + words->begins[id - 1], words->lengths[id - 1]);
+			++starts[termsBucket(hashes[id], header->bucketBits) + 1];
+		}
+	}
+
+	/* The word IDs of every bucket, by counting. */
+	for (bucket = 0, largest = 0; bucket < buckets; ++bucket) {
+		if (starts[bucket + 1] > largest) {
+			largest = starts[bucket + 1];
+		}
+		starts[bucket + 1] += starts[bucket];
+	}
+	for (id = 1; id <= words->amount; ++id) {
+		if (words->lengths[id - 1] > 0) {
+			order[starts[termsBucket(hashes[id], header->bucketBits)]++] = id;
+		}
+	}
+	for (bucket = buckets; bucket > 0; --bucket) {
+		starts[bucket] = starts[bucket - 1];
+	}
+	starts[0] = 0;
+
+	placed = malloc(sizeof(unsigned long) * (largest + 1));
+	for (size = largest; size > 0 && result == 0; --size) {
+		for (bucket = 0; bucket < buckets && result == 0; ++bucket) {
+			if (starts[bucket + 1] - starts[bucket] != size) {
+				continue;
+			}
+
+			for (displacement = 0; displacement < TERMS_DISPLACEMENTS; ++displacement) {
+				for (i = starts[bucket], amount = 0; i < starts[bucket + 1]; ++i) {
+					slot = termsSlot(hashes[order[i]], displacement, header->slots);
+					if (slots[slot] != 0) {
+						break;
+					}
+
+					slots[slot]			= order[i];
+					placed[amount++]	= slot;
+				}
+
+				if (i == starts[bucket + 1]) {
+					break;
+				}
+
+				while (amount > 0) {
+					slots[placed[--amount]] = 0;
+				}
+			}
+
+			if (displacement == TERMS_DISPLACEMENTS) {
+				result = -1;
+			}
+			displacements[bucket] = displacement;
+		}
+	}
+
+	free(placed);
+	free(order);
+	free(starts);
+	free(hashes);
+
+	return result;
+}
+
+static int pad(FILE* file, unsigned long alignment) {
+	long position = ftell(file);
+
+	for (; position >= 0 && (unsigned long) position % alignment != 0; ++position) {
+		if (fputc(0, file) == EOF) {
+			return -1;
+		}
+	}
+
+	return position >= 0 ? 0 : -1;
+}
+
+/*
+Writes the term table of the terms of the word ID file and the topic vectors of lsi, with the idfs of the given amount
+of documents.
+*/
+int termsWrite(const char* wordIDPath, const char* topicPath, unsigned long documents, const char* termsPath) {
+	DenseMatrix* topics;
+	TermsHeader header;
+	Words words;
+	FILE* file;
+	uint32_t* displacements;
+	uint32_t* slots;
+	uint64_t* offsets;
+	float* row;
+	char padding[TERMS_ALIGNMENT];
+	unsigned long buckets, dimensions, id, j;
+	int result = 0;
+
+	if (!isLittleEndian()) {
+		return -1;
+	}
+
+	topics = denseOpen(topicPath);
+	if (topics == NULL) {
+		return -1;
+	}
+
+	if (readWords(wordIDPath, documents, &words) != 0) {
+		denseClose(topics);
+		return -1;
+	}
+
+	dimensions = topics->header.columns;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TERMS_MAGIC, sizeof(header.magic));
+	header.version		= TERMS_VERSION;
+	header.terms		= words.amount;
+	header.dimensions	= dimensions;
+	header.documents	= documents;
+	header.rowStride	= (dimensions * sizeof(float) + TERMS_ROW_ALIGNMENT - 1) / TERMS_ROW_ALIGNMENT *
+		TERMS_ROW_ALIGNMENT;
+	for (header.bucketBits = 1; (1ul << header.bucketBits) * TERMS_LOAD < words.amount; ++header.bucketBits);
+	for (header.slots = 2; header.slots < words.amount * TERMS_LOAD; header.slots *= 2);
+
+	buckets			= 1ul << header.bucketBits;
+	displacements	= calloc(buckets, sizeof(uint32_t));
+	slots			= calloc(header.slots, sizeof(uint32_t));
+	if (place(&words, &header, displacements, slots) != 0) {
+		fprintf(stderr, "Cannot hash the terms of %s, is a term in there twice?\n", wordIDPath);
+		result = -1;
+	}
+
+	printf("Terms: %lu, dimensions: %lu, documents: %lu, slots: %lu\n", words.amount, dimensions, documents,
+		(unsigned long) header.slots);
+
+	file = result == 0 ? fopen(termsPath, "wb") : NULL;
+	if (file == NULL) {
+		result = -1;
+	}
+	else {
+		setvbuf(file, NULL, _IOFBF, TERMS_BUFFER_SIZE);
+
+		memset(padding, 0, sizeof(padding));
+		if (fwrite(padding, sizeof(padding), 1, file) != 1) {
+			result = -1;
+		}
+
+		/* Terms beyond the topics, which the model has not seen, have rows of zeros like missing word IDs. */
+		header.rowsOffset = ftell(file);
+		row = malloc(header.rowStride);
+		for (id = 1; id <= words.amount && result == 0; ++id) {
+			memset(row, 0, header.rowStride);
+			for (j = 0; j < dimensions && id <= topics->header.rows; ++j) {
+				row[j] = words.idfs[id - 1] * topics->rows[(id - 1) * dimensions + j];
+			}
+
+			if (fwrite(row, header.rowStride, 1, file) != 1) {
+				result = -1;
+			}
+		}
+		free(row);
+
+		header.displacementsOffset = ftell(file);
+		if (result == 0 && fwrite(displacements, sizeof(uint32_t), buckets, file) != buckets) {
+			result = -1;
+		}
+
+		if (result == 0 && pad(file, TERMS_ROW_ALIGNMENT) != 0) {
+			result = -1;
+		}
+
+		header.slotsOffset = ftell(file);
+		if (result == 0 && (fwrite(slots, sizeof(uint32_t), header.slots, file) != header.slots ||
+			pad(file, TERMS_ROW_ALIGNMENT) != 0)) {
+			result = -1;
+		}
+
+		/* Terms are written in order of their IDs. */
+		offsets		= malloc(sizeof(uint64_t) * (words.amount + 1));
+		offsets[0]	= 0;
+		for (id = 1; id <= words.amount; ++id) {
+			offsets[id] = offsets[id - 1] + words.lengths[id - 1];
+		}
+
+		header.wordsOffset = ftell(file);
+		if (result == 0 && (fwrite(offsets, sizeof(uint64_t), words.amount + 1, file) != words.amount + 1 ||
+			pad(file, TERMS_ROW_ALIGNMENT) != 0)) {
+			result = -1;
+		}
+		free(offsets);
+
+		header.textOffset = ftell(file);
+		for (id = 1; id <= words.amount && result == 0; ++id) {
+			if (words.lengths[id - 1] > 0 &&
+				fwrite(words.text + words.begins[id - 1], words.lengths[id - 1], 1, file) != 1) {
+				result = -1;
+			}
+		}
+
+		if (result == 0 && (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)) {
+			result = -1;
+		}
+
+		if (fclose(file) != 0) {
+			result = -1;
+		}
+	}
+
+	free(displacements);
+	free(slots);
+	freeWords(&words);
+	denseClose(topics);
+
+	return result;
+}
+
+/* Maps a term table read-only, so processes that map the same table share it in the page cache. */
+TermTable* termsOpen(const char* path) {
+	TermTable* table;
+	TermsHeader* header;
+	struct stat status;
+	unsigned long id, slot;
+	int fd;
+
+	if (!isLittleEndian()) {
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || (unsigned long) status.st_size < TERMS_ALIGNMENT) {
+		close(fd);
+		return NULL;
+	}
+
+	table		= calloc(1, sizeof(TermTable));
+	table->size	= status.st_size;
+	table->data	= mmap(NULL, table->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (table->data == MAP_FAILED) {
+		free(table);
+		return NULL;
+	}
+
+	header = &table->header;
+	memcpy(header, table->data, sizeof(TermsHeader));
+	if (memcmp(header->magic, TERMS_MAGIC, sizeof(header->magic)) != 0 || header->version != TERMS_VERSION ||
+		header->bucketBits == 0 || header->bucketBits > 32 || header->slots == 0 ||
+		(header->slots & (header->slots - 1)) != 0 || header->rowStride < header->dimensions * sizeof(float) ||
+		header->rowStride % TERMS_ROW_ALIGNMENT != 0 || header->rowsOffset % TERMS_ROW_ALIGNMENT != 0 ||
+		header->rowsOffset + header->terms * header->rowStride > header->displacementsOffset ||
+		header->displacementsOffset + (sizeof(uint32_t) << header->bucketBits) > header->slotsOffset ||
+		header->slotsOffset + header->slots * sizeof(uint32_t) > header->wordsOffset ||
+		header->wordsOffset + (header->terms + 1) * sizeof(uint64_t) > header->textOffset ||
+		header->textOffset > table->size) {
+		termsClose(table);
+		return NULL;
+	}
+
+	table->rows				= (const char*) table->data + header->rowsOffset;
+	table->displacements	= (const uint32_t*) ((const char*) table->data + header->displacementsOffset);
+	table->slots			= (const uint32_t*) ((const char*) table->data + header->slotsOffset);
+	table->words			= (const uint64_t*) ((const char*) table->data + header->wordsOffset);
+	table->text				= (const char*) table->data + header->textOffset;
+
+	/* Lookups trust the terms and slots from here on. */
+	for (id = 0; id < header->terms && table->words[id] <= table->words[id + 1]; ++id);
+	for (slot = 0; slot < header->slots && table->slots[slot] <= header->terms; ++slot);
+	if (id != header->terms || slot != header->slots ||
+		header->textOffset + table->words[header->terms] > table->size) {
+		termsClose(table);
+		return NULL;
+	}
+
+	return table;
+}
+
+/* Word ID of a term of the given hashToken, 0 if it is not in the table. */
+unsigned long termsFind(const TermTable* table, const char* term, unsigned int length, uint64_t hash) {
+	uint32_t id = table->slots[termsSlot(hash, table->displacements[termsBucket(hash, table->header.bucketBits)],
+		table->header.slots)];
+
+	if (id == 0 || table->words[id] - table->words[id - 1] != length ||
+		memcmp(table->text + table->words[id - 1], term, length) != 0) {
+		return 0;
+	}
+
+	return id;
+}
+
+/*
+Adds weight times the row of a word ID to a vector, which has to be padded to rowStride bytes too. Rows are whole
+cache lines of floats, so the inner loop has a fixed length the compiler vectorizes.
+*/
+void termsAdd(const TermTable* table, unsigned long wordID, float weight, float* vector) {
+	const float* row = termsRow(table, wordID);
+	unsigned long length = table->header.rowStride / sizeof(float);
+	unsigned long i, j;
+
+	for (i = 0; i < length; i += TERMS_ROW_ALIGNMENT / sizeof(float)) {
+		for (j = i; j < i + TERMS_ROW_ALIGNMENT / sizeof(float); ++j) {
+			vector[j] += weight * row[j];
+		}
+	}
+}
+
+void termsClose(TermTable* table) {
+	munmap(table->data, table->size);
+	free(table);
+}
@@ -0,0 +1,73 @@
+/**
+ * terms.h
+ */
+
+#ifndef TERMS_H_
+#define TERMS_H_
+
+#include <stdint.h>
+
+/*
+Term table of the query side, meant to be mapped read-only: the idf weighted topic vector of every term, so that the
+topic vector of a query is the sum of the rows of its terms times their counts, and a perfect hash of the terms.
+Little endian:
+- the header below, padded to TERMS_ALIGNMENT,
+- at rowsOffset, for every word ID up to terms, row word ID - 1: the idf of the term times its topic vector, float32,
+  padded with zeros to rowStride bytes, a multiple of TERMS_ROW_ALIGNMENT. Rows of missing word IDs are all zeros,
+- at displacementsOffset, a uint32 displacement for every bucket, the top bucketBits of the hash of a term (hash.h),
+- at slotsOffset, the word ID in every slot, uint32, zero if empty. The term of a hash is in the slot that the
+  displacement of its bucket picks, if it is a term at all,
+- at wordsOffset, uint64 offsets in the text, one per word ID plus one, so word ID i spans words[i - 1] up to words[i],
+- at textOffset, the terms one after another.
+The idfs are over documents documents, those of the full build that wrote the word IDs (tfidfDocuments). Every
+section starts at a multiple of 64.
+*/
+#define TERMS_MAGIC "IRLSITRM"
+#define TERMS_VERSION 1
+#define TERMS_ALIGNMENT 4096
+#define TERMS_ROW_ALIGNMENT 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t bucketBits;
+	uint64_t terms;
+	uint64_t dimensions;
+	uint64_t documents;
+	/* Bytes from one row to the next. */
+	uint64_t rowStride;
+	/* A power of two. */
+	uint64_t slots;
+	uint64_t rowsOffset;
+	uint64_t displacementsOffset;
+	uint64_t slotsOffset;
+	uint64_t wordsOffset;
+	uint64_t textOffset;
+} TermsHeader;
+
+/* A memory mapped term table. */
+typedef struct {
+	TermsHeader header;
+	const char* rows;
+	const uint32_t* displacements;
+	const uint32_t* slots;
+	const uint64_t* words;
+	const char* text;
+
+	void* data;
+	unsigned long size;
+} TermTable;
+
+static inline const float* termsRow(const TermTable* table, unsigned long wordID) {
+	return (const float*) (table->rows + (wordID - 1) * table->header.rowStride);
+}
+
+int				termsWrite(const char* wordIDPath, const char* topicPath, unsigned long documents,
+					const char* termsPath);
+TermTable*		termsOpen(const char* path);
+unsigned long	termsFind(const TermTable* table, const char* term, unsigned int length, uint64_t hash);
+void			termsAdd(const TermTable* table, unsigned long wordID, float weight, float* vector);
+void			termsClose(TermTable* table);
+
+
+#endif /* TERMS_H_ */
@@ -0,0 +1,717 @@
+/**
+ * tfidf.c
+ *
+ * Weighs a bow the way gensim's TfidfModel does by default: counts times log2 of the inverse document frequency,
+ * normalized to unit length per document. The document frequencies are those the tokenizer wrote to the word IDs.
+ * The bow, Matrix Market or binary, is memory mapped and cut into blocks of whole documents, which are weighed on
+ * a pool of threads and written in order.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "tfidf.h"
+#include "buffer.h"
+#include "matrix.h"
+#include "output.h"
+#include "queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Bytes of a Matrix Market bow per block, rounded up to whole documents. */
+#define BLOCK_BYTES (4 * 1024 * 1024)
+/* Entries of a binary bow per block, rounded up to whole documents. */
+#define BLOCK_ENTRIES (512 * 1024)
+#define BLOCKS_PER_THREAD 4
+
+/* A weighed document, its entries follow those of the document before it in the block. */
+typedef struct {
+	unsigned long row;
+	unsigned long amount;
+} BlockRow;
+
+typedef struct {
+	unsigned long index;
+	/* Lines of a Matrix Market bow, or zero based rows of a binary one. */
+	const char* begin;
+	const char* end;
+	unsigned long rowBegin;
+	unsigned long rowEnd;
+
+	/* The weighed entries as Matrix Market lines, and as rows, columns and weights for the binary output. */
+	Buffer* text;
+	Buffer* rows;
+	Buffer* columns;
+	Buffer* weights;
+	/* Counts of the document being weighed. */
+	Buffer* counts;
+	unsigned long entries;
+	int error;
+} Block;
+
+typedef struct {
+	/* The binary bow, NULL if it is Matrix Market. */
+	CsrMatrix* matrix;
+	unsigned long documents;
+	unsigned long amountTokens;
+	double* idfs;
+
+	Output* tfidf;
+	CsrWriter* csr;
+	unsigned long entries;
+	unsigned long rowsWritten;
+	int error;
+
+	unsigned int threads;
+	pthread_t* workers;
+	pthread_t writer;
+	Block* blocks;
+	unsigned long amountBlocks;
+	Queue* freeBlocks;
+	Queue* filledBlocks;
+	Block** weighedBlocks;
+	unsigned long nextBlock;
+	int finished;
+	pthread_mutex_t lock;
+	pthread_cond_t weighed;
+} Job;
+
+/* Reads the document frequencies of the word IDs into idfs, indexed by token ID - 1. */
+double* tfidfIdfs(const char* wordIDPath, unsigned long documents, unsigned long* amount) {
+	FILE* file;
+	double* idfs = NULL;
+	unsigned long size = 0;
+	unsigned long id;
+	char* line = NULL;
+	char* occurence;
+	size_t capacity = 0;
+
+	file = fopen(wordIDPath, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	/* Lines are ID, token and document occurence, in no particular order. */
+	*amount = 0;
+	while (getline(&line, &capacity, file) > 0) {
+		id			= strtoul(line, NULL, 10);
+		occurence	= strrchr(line, '\t');
+		if (id == 0 || occurence == NULL) {
+			continue;
+		}
+
+		if (id > size) {
+			size	= id * 2;
+			idfs	= realloc(idfs, sizeof(double) * size);
+			memset(idfs + *amount, 0, sizeof(double) * (size - *amount));
+		}
+
+		idfs[id - 1] = tfidfIdf(strtoul(occurence + 1, NULL, 10), documents);
+		if (id > *amount) {
+			*amount = id;
+		}
+	}
+
+	free(line);
+	fclose(file);
+
+	return idfs;
+}
+
+/* The file next to the word IDs that holds the amount of documents their document frequencies are of. */
+static char* documentsPath(const char* wordIDPath) {
+	char* path = malloc(strlen(wordIDPath) + 11);
+
+	sprintf(path, "%s.documents", wordIDPath);
+	return path;
+}
+
+/*
+Reads the amount of documents of the run that wrote the word IDs, which the idfs are over however many documents are
+added later. Returns 0 if it is not known.
+*/
+unsigned long tfidfDocuments(const char* wordIDPath) {
+	char* path = documentsPath(wordIDPath);
+	FILE* file = fopen(path, "r");
+	unsigned long documents = 0;
+
+	free(path);
+	if (file == NULL) {
+		return 0;
+	}
+
+	if (fscanf(file, "%lu", &documents) != 1) {
+		documents = 0;
+	}
+	fclose(file);
+
+	return documents;
+}
+
+/* Stores the amount of documents of the word IDs next to them, see tfidfDocuments. */
+int tfidfWriteDocuments(const char* wordIDPath, unsigned long documents) {
+	char* path = documentsPath(wordIDPath);
+	FILE* file = fopen(path, "w");
+	int result = 0;
+
+	free(path);
+	if (file == NULL) {
+		return -1;
+	}
+
+	if (fprintf(file, "%lu\n", documents) < 0) {
+		result = -1;
+	}
+	if (fclose(file) != 0) {
+		result = -1;
+	}
+
+	return result;
+}
+
+/*
+Weighs the counts of a document, sorted on column or not. Weights that come out too small to matter, i.e. those of
+tokens in every document, are left out and the columns are compacted alongside. Returns the amount of weights kept.
+*/
+unsigned long tfidfWeigh(uint32_t* columns, const uint32_t* counts, float* weights, unsigned long amount,
+	const double* idfs) {
+	unsigned long i, kept;
+	double norm = 0;
+	double weight;
+
+	for (i = 0; i < amount; ++i) {
+		weight	= counts[i] * idfs[columns[i]];
+		norm	+= weight * weight;
+	}
+
+	if (norm == 0) {
+		return 0;
+	}
+
+	norm = 1 / sqrt(norm);
+	for (i = 0, kept = 0; i < amount; ++i) {
+		weight = counts[i] * idfs[columns[i]] * norm;
+		if (fabs(weight) > TFIDF_EPSILON) {
+			columns[kept]	= columns[i];
+			weights[kept]	= weight;
+			++kept;
+		}
+	}
+
+	return kept;
+}
+
+/* Maps a whole file read only, for one sequential pass. */
+static void* mapFile(const char* path, unsigned long* size) {
+	struct stat status;
+	void* data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &status) != 0 || status.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	*size	= status.st_size;
+	data	= mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+
+	posix_madvise(data, *size, POSIX_MADV_SEQUENTIAL);
+	return data;
+}
+
+/* Parses a number after optional blanks. Returns the byte after it, or NULL if there is none. */
+static const char* parseNumber(const char* text, const char* end, unsigned long* number) {
+	while (text < end && (*text == ' ' || *text == '\t')) {
+		++text;
+	}
+
+	if (text == end || *text < '0' || *text > '9') {
+		return NULL;
+	}
+
+	for (*number = 0; text < end && *text >= '0' && *text <= '9'; ++text) {
+		*number = *number * 10 + (*text - '0');
+	}
+
+	return text;
+}
+
+/* Returns the start of the line after the one text is in, or end. */
+static const char* nextLine(const char* text, const char* end) {
+	text = memchr(text, '\n', end - text);
+	return text == NULL ? end : text + 1;
+}
+
+/* Skips the banner and comments of a Matrix Market bow and reads its sizes. Returns the first entry, or NULL. */
+static const char* readHeader(const char* text, const char* end, unsigned long* rows, unsigned long* columns,
+	unsigned long* entries) {
+	while (text < end && *text == '%') {
+		text = nextLine(text, end);
+	}
+
+	if ((text = parseNumber(text, end, rows)) == NULL || (text = parseNumber(text, end, columns)) == NULL ||
+		(text = parseNumber(text, end, entries)) == NULL) {
+		return NULL;
+	}
+
+	return nextLine(text, end);
+}
+
+/*
+Returns the start of the first line after the one text is in that begins another document, or end. The lines of a
+document are consecutive, so blocks cut there hold whole documents.
+*/
+static const char* documentBoundary(const char* text, const char* end) {
+	unsigned long row, next;
+
+	text = nextLine(text, end);
+	if (parseNumber(text, end, &row) == NULL) {
+		return end;
+	}
+
+	do {
+		text = nextLine(text, end);
+	} while (parseNumber(text, end, &next) != NULL && next == row);
+
+	return text;
+}
+
+static void addEntry(Block* block, uint32_t column, uint32_t count) {
+	bufferAdd(block->columns, (const char*) &column, sizeof(uint32_t));
+	bufferAdd(block->counts, (const char*) &count, sizeof(uint32_t));
+}
+
+/* Weighs the entries added since the last document, which are those of document row (one based). */
+static void finishRow(Job* job, Block* block, unsigned long row) {
+	unsigned long amount = block->counts->currentsize / sizeof(uint32_t);
+	unsigned long first = block->columns->currentsize / sizeof(uint32_t) - amount;
+	BlockRow blockRow;
+	uint32_t* columns;
+	float* weights;
+	unsigned long i;
+
+	bufferAllocate(block->weights, amount * sizeof(float));
+	columns	= (uint32_t*) block->columns->buffer + first;
+	weights	= (float*) (block->weights->buffer + block->weights->currentsize);
+	amount	= tfidfWeigh(columns, (const uint32_t*) block->counts->buffer, weights, amount, job->idfs);
+
+	block->columns->currentsize	= (first + amount) * sizeof(uint32_t);
+	block->weights->currentsize	+= amount * sizeof(float);
+	block->entries				+= amount;
+	bufferReset(block->counts);
+
+	blockRow.row	= row;
+	blockRow.amount	= amount;
+	bufferAdd(block->rows, (const char*) &blockRow, sizeof(BlockRow));
+
+	bufferAllocate(block->text, amount * MM_ENTRY_WIDTH);
+	for (i = 0; i < amount; ++i) {
+		block->text->currentsize += mmFormatWeight(block->text->buffer + block->text->currentsize, row,
+			columns[i] + 1, weights[i]);
+	}
+}
+
+static void weighText(Job* job, Block* block) {
+	const char* text = block->begin;
+	unsigned long row, column, count;
+	unsigned long current = 0;
+
+	while (text < block->end) {
+		if ((text = parseNumber(text, block->end, &row)) == NULL ||
+			(text = parseNumber(text, block->end, &column)) == NULL ||
+			(text = parseNumber(text, block->end, &count)) == NULL ||
+			row == 0 || row > job->documents || column == 0 || column > job->amountTokens) {
+			block->error = 1;
+			return;
+		}
+		text = nextLine(text, block->end);
+
+		if (row != current) {
+			if (current != 0) {
+				finishRow(job, block, current);
+			}
+			current = row;
+		}
+
+		addEntry(block, column - 1, count);
+	}
+
+	if (current != 0) {
+		finishRow(job, block, current);
+	}
+}
+
+static void weighBinary(Job* job, Block* block) {
+	const CsrMatrix* matrix = job->matrix;
+	const uint32_t* counts = (const uint32_t*) matrix->values;
+	unsigned long row, i;
+
+	for (row = block->rowBegin; row < block->rowEnd; ++row) {
+		for (i = matrix->indptr[row]; i < matrix->indptr[row + 1]; ++i) {
+			if (matrix->indices[i] >= job->amountTokens) {
+				block->error = 1;
+				return;
+			}
+
+			addEntry(block, matrix->indices[i], counts[i]);
+		}
+
+		finishRow(job, block, row + 1);
+	}
+}
+
+static void* weighThread(void* data) {
+	Job* job = (Job*) data;
+	Block* block;
+
+	while ((block = queuePop(job->filledBlocks)) != NULL) {
+		if (job->matrix != NULL) {
+			weighBinary(job, block);
+		}
+		else {
+			weighText(job, block);
+		}
+
+		pthread_mutex_lock(&job->lock);
+		job->weighedBlocks[block->index % job->amountBlocks] = block;
+		pthread_cond_broadcast(&job->weighed);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	return NULL;
+}
+
+static void writeBlock(Job* job, Block* block) {
+	const BlockRow* rows = (const BlockRow*) block->rows->buffer;
+	unsigned long amount = block->rows->currentsize / sizeof(BlockRow);
+	const uint32_t* columns = (const uint32_t*) block->columns->buffer;
+	const float* weights = (const float*) block->weights->buffer;
+	unsigned long i;
+
+	if (block->error || job->error) {
+		job->error = 1;
+		return;
+	}
+
+	if (outputWrite(job->tfidf, block->text->buffer, block->text->currentsize) != 0) {
+		job->error = 1;
+	}
+	job->entries += block->entries;
+
+	if (job->csr == NULL) {
+		return;
+	}
+
+	for (i = 0; i < amount; ++i) {
+		if (rows[i].row <= job->rowsWritten) {
+			/* Out of order, which the binary output cannot take. */
+			job->error = 1;
+			return;
+		}
+
+		/* Documents without entries are left out of Matrix Market files, but not out of binary ones. */
+		while (job->rowsWritten + 1 < rows[i].row) {
+			csrWriterRow(job->csr, NULL, NULL, 0);
+			++job->rowsWritten;
+		}
+
+		if (csrWriterRow(job->csr, columns, weights, rows[i].amount) != 0) {
+			job->error = 1;
+		}
+		++job->rowsWritten;
+
+		columns += rows[i].amount;
+		weights += rows[i].amount;
+	}
+}
+
+/* Writes the weighed blocks in order, so the output does not depend on the amount of threads. */
+static void* writeThread(void* data) {
+	Job* job = (Job*) data;
+	Block** slot;
+	Block* block;
+
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+
+		slot = &job->weighedBlocks[job->nextBlock % job->amountBlocks];
+		while (*slot == NULL && !job->finished) {
+			pthread_cond_wait(&job->weighed, &job->lock);
+		}
+
+		/* Once finished, all workers are gone and every block left is in place. */
+		block	= *slot;
+		*slot	= NULL;
+		pthread_mutex_unlock(&job->lock);
+
+		if (block == NULL) {
+			break;
+		}
+
+		writeBlock(job, block);
+		++job->nextBlock;
+
+		queuePush(job->freeBlocks, block);
+	}
+
+	return NULL;
+}
+
+static int jobStart(Job* job, unsigned int threads) {
+	Block* block;
+	unsigned long i;
+
+	job->threads		= threads > 0 ? threads : 1;
+	job->amountBlocks	= job->threads * BLOCKS_PER_THREAD + 1;
+	job->blocks			= calloc(job->amountBlocks, sizeof(Block));
+	job->weighedBlocks	= calloc(job->amountBlocks, sizeof(Block*));
+	job->workers		= malloc(sizeof(pthread_t) * job->threads);
+	job->freeBlocks		= queueInit(job->amountBlocks);
+	job->filledBlocks	= queueInit(job->amountBlocks);
+
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->weighed, NULL);
+
+	for (i = 0; i < job->amountBlocks; ++i) {
+		block			= &job->blocks[i];
+		block->text		= bufferInit();
+		block->rows		= bufferInit();
+		block->columns	= bufferInit();
+		block->weights	= bufferInit();
+		block->counts	= bufferInit();
+		queuePush(job->freeBlocks, block);
+	}
+
+	for (i = 0; i < job->threads; ++i) {
+		if (pthread_create(&job->workers[i], NULL, weighThread, job) != 0) {
+			return -1;
+		}
+	}
+
+	return pthread_create(&job->writer, NULL, writeThread, job) == 0 ? 0 : -1;
+}
+
+/* Hands the next block over to the workers, once one is free. */
+static Block* jobBlock(Job* job, unsigned long index) {
+	Block* block = queuePop(job->freeBlocks);
+
+	bufferReset(block->text);
+	bufferReset(block->rows);
+	bufferReset(block->columns);
+	bufferReset(block->weights);
+	bufferReset(block->counts);
+	block->index	= index;
+	block->entries	= 0;
+	block->error	= 0;
+
+	return block;
+}
+
+/* Waits until every block has been written. */
+static void jobFinish(Job* job) {
+	unsigned long i;
+
+	queueClose(job->filledBlocks);
+	for (i = 0; i < job->threads; ++i) {
+		pthread_join(job->workers[i], NULL);
+	}
+
+	pthread_mutex_lock(&job->lock);
+	job->finished = 1;
+	pthread_cond_broadcast(&job->weighed);
+	pthread_mutex_unlock(&job->lock);
+
+	pthread_join(job->writer, NULL);
+}
+
+static void jobDestroy(Job* job) {
+	unsigned long i;
+
+	for (i = 0; i < job->amountBlocks; ++i) {
+		bufferDestroy(job->blocks[i].text);
+		bufferDestroy(job->blocks[i].rows);
+		bufferDestroy(job->blocks[i].columns);
+		bufferDestroy(job->blocks[i].weights);
+		bufferDestroy(job->blocks[i].counts);
+	}
+
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->weighed);
+	queueDestroy(job->freeBlocks);
+	queueDestroy(job->filledBlocks);
+	free(job->weighedBlocks);
+	free(job->workers);
+	free(job->blocks);
+}
+
+/* Cuts the bow into blocks of whole documents for the workers. */
+static void splitBow(Job* job, const char* text, const char* end) {
+	const CsrMatrix* matrix = job->matrix;
+	Block* block;
+	unsigned long index = 0;
+	unsigned long row, next;
+
+	if (matrix != NULL) {
+		for (row = 0; row < job->documents; row = next) {
+			next = row;
+			do {
+				++next;
+			} while (next < job->documents && matrix->indptr[next] - matrix->indptr[row] < BLOCK_ENTRIES);
+
+			block			= jobBlock(job, index++);
+			block->rowBegin	= row;
+			block->rowEnd	= next;
+			queuePush(job->filledBlocks, block);
+		}
+		return;
+	}
+
+	while (text < end) {
+		block			= jobBlock(job, index++);
+		block->begin	= text;
+		block->end		= (unsigned long) (end - text) > BLOCK_BYTES ? documentBoundary(text + BLOCK_BYTES, end) : end;
+		text			= block->end;
+		queuePush(job->filledBlocks, block);
+	}
+}
+
+/*
+Weighs the bow at bowPath, Matrix Market or binary, with the document frequencies of the word IDs. Writes the result
+to tfidfPath as Matrix Market, and as a binary matrix of weights to csrPath unless it is NULL.
+*/
+int tfidfConvert(const char* bowPath, const char* wordIDPath, const char* tfidfPath, const char* csrPath,
+	unsigned int threads) {
+	Job job;
+	void* data = NULL;
+	unsigned long size = 0;
+	const char* text = NULL;
+	const char* end = NULL;
+	unsigned long columns, entries, expected, common, i;
+	int result = 0;
+
+	memset(&job, 0, sizeof(job));
+
+	/* A binary bow is told apart by its header. */
+	job.matrix = csrOpen(bowPath);
+	if (job.matrix != NULL) {
+		if (job.matrix->header.valueType != CSR_COUNTS) {
+			fprintf(stderr, "Binary bow holds weights instead of counts.\n");
+			csrClose(job.matrix);
+			return -1;
+		}
+
+		job.documents	= job.matrix->header.rows;
+		columns			= job.matrix->header.columns;
+		entries			= job.matrix->header.entries;
+	}
+	else {
+		data = mapFile(bowPath, &size);
+		if (data == NULL) {
+			perror("Cannot open bow.\n");
+			return -1;
+		}
+
+		end		= (const char*) data + size;
+		text	= readHeader(data, end, &job.documents, &columns, &entries);
+		if (text == NULL) {
+			fprintf(stderr, "Cannot read bow header.\n");
+			munmap(data, size);
+			return -1;
+		}
+	}
+
+	job.idfs = tfidfIdfs(wordIDPath, job.documents, &job.amountTokens);
+	if (job.idfs == NULL) {
+		perror("Cannot read word IDs.\n");
+		result = -1;
+	}
+
+	/*
+	The weights that are dropped are those of tokens in every document, whose idf is 0, so the amount of entries is
+	known up front. Should the word IDs not match the bow, the header is rewritten at the end.
+	*/
+	for (i = 0, common = 0; result == 0 && i < job.amountTokens; ++i) {
+		if (job.idfs[i] == 0) {
+			++common;
+		}
+	}
+	expected = common * job.documents < entries ? entries - common * job.documents : 0;
+
+	job.tfidf = result == 0 ? outputOpen(tfidfPath) : NULL;
+	if (result == 0 && (job.tfidf == NULL || mmWriteHeader(job.tfidf, job.documents, columns, expected) != 0)) {
+		perror("Cannot open tfidf output.\n");
+		result = -1;
+	}
+
+	if (result == 0 && csrPath != NULL) {
+		job.csr = csrWriterOpen(csrPath, CSR_FLOATS);
+		if (job.csr == NULL) {
+			perror("Cannot open binary tfidf output.\n");
+			result = -1;
+		}
+	}
+
+	if (result == 0) {
+		if (jobStart(&job, threads) != 0) {
+			fprintf(stderr, "Cannot start weighing threads.\n");
+			return -1;
+		}
+
+		splitBow(&job, text, end);
+		jobFinish(&job);
+		jobDestroy(&job);
+
+		if (job.error) {
+			fprintf(stderr, "Cannot weigh bow, it is malformed or does not match the word IDs.\n");
+			result = -1;
+		}
+	}
+
+	if (result == 0) {
+		printf("Weighed documents: %lu, tokens: %lu, entries: %lu\n", job.documents, columns, job.entries);
+	}
+
+	if (job.tfidf != NULL && outputClose(job.tfidf) != 0) {
+		result = -1;
+	}
+
+	if (result == 0 && job.entries != expected && mmRewriteHeader(tfidfPath, job.documents, columns, job.entries) != 0) {
+		result = -1;
+	}
+
+	if (job.csr != NULL) {
+		while (job.rowsWritten < job.documents) {
+			csrWriterRow(job.csr, NULL, NULL, 0);
+			++job.rowsWritten;
+		}
+
+		if (csrWriterClose(job.csr, columns) != 0) {
+			result = -1;
+		}
+	}
+
+	if (job.matrix != NULL) {
+		csrClose(job.matrix);
+	}
+	if (data != NULL) {
+		munmap(data, size);
+	}
+	free(job.idfs);
+
+	return result;
+}
@@ -0,0 +1,28 @@
+/**
+ * tfidf.h
+ */
+
+#ifndef TFIDF_H_
+#define TFIDF_H_
+
+#include <math.h>
+#include <stdint.h>
+
+/* Weights up to this size are left out, as gensim does. */
+#define TFIDF_EPSILON 1e-12
+
+/* The inverse document frequency of a token, log2(documents / occurence) like gensim's df2idf. */
+static inline double tfidfIdf(unsigned long occurence, unsigned long documents) {
+	return occurence == 0 ? 0 : log2((double) documents / occurence);
+}
+
+double*			tfidfIdfs(const char* wordIDPath, unsigned long documents, unsigned long* amount);
+unsigned long	tfidfDocuments(const char* wordIDPath);
+int				tfidfWriteDocuments(const char* wordIDPath, unsigned long documents);
+unsigned long	tfidfWeigh(uint32_t* columns, const uint32_t* counts, float* weights, unsigned long amount,
+					const double* idfs);
+int				tfidfConvert(const char* bowPath, const char* wordIDPath, const char* tfidfPath, const char* csrPath,
+					unsigned int threads);
+
+
+#endif /* TFIDF_H_ */
@@ -1,14 +1,31 @@
 import codecs
+import os
 from gensim import corpora, models
 
 import logging
 logging.basicConfig(format='%(asctime)s : %(levelname)s : %(message)s', level=logging.INFO)
 
-print 'open corpora'
-corpus = corpora.MmCorpus('bow.mm')
 print 'open dictionary'
 dictionary = corpora.Dictionary.load_from_text('wordid.txt')
-print 'generate tfidf'
-tfidf = models.TfidfModel(corpus, id2word=dictionary, normalize=True)
-corpora.MmCorpus.serialize('tfidf.mm', tfidf[corpus], progress_cnt=10000)
+# The newest bow is weighed, unless the tfidf.mm of "tokenizer tfidf" or "tokenizer --tfidf" is newer still.
+bows = [bow for bow in ('bow.csr', 'bow.mm') if os.path.exists(bow)]
+bow = max(bows, key=os.path.getmtime) if bows else 'bow.mm'
+if os.path.exists('tfidf.mm') and (not os.path.exists(bow) or os.path.getmtime('tfidf.mm') >= os.path.getmtime(bow)):
+	print 'keep tfidf.mm of the tokenizer'
+	# No bow is read, the model comes from the document frequencies of the word IDs and the documents of their run.
+	if os.path.exists('wordid.txt.documents'):
+		dictionary.num_docs = int(open('wordid.txt.documents').read())
+	else:
+		dictionary.num_docs = corpora.MmCorpus('tfidf.mm').num_docs
+	tfidf = models.TfidfModel(dictionary=dictionary, normalize=True)
+else:
+	print 'open corpora'
+	if bow == 'bow.csr':
+		from csr import CsrCorpus
+		corpus = CsrCorpus(bow)
+	else:
+		corpus = corpora.MmCorpus(bow)
+	print 'generate tfidf'
+	tfidf = models.TfidfModel(corpus, id2word=dictionary, normalize=True)
+	corpora.MmCorpus.serialize('tfidf.mm', tfidf[corpus], progress_cnt=10000)
 tfidf.save('irlsi.tfidf')
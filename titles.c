@@ -0,0 +1,105 @@
+/**
+ * titles.c
+ *
+ * The document of every title in a docID file, so that a run over new and edited pages (see tokenizer --update) can
+ * tell which earlier documents its pages replace. Later lines win, as a title that was updated before is listed again
+ * with its newer document.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "titles.h"
+#include "arena.h"
+#include "khash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (16 * 1024 * 1024)
+
+KHASH_MAP_INIT_STR(Titles, unsigned long)
+
+struct Titles {
+	khash_t(Titles)* documents;
+	Arena* strings;
+	/* Terminated copy of the title looked up, so that only new titles take room in the arena. */
+	char* lookup;
+	unsigned long lookupSize;
+};
+
+/* Reads the docID file, lines of document ID and title. Sets lastID to the largest document ID in it. */
+Titles* titlesRead(const char* docIDPath, unsigned long* lastID) {
+	Titles* titles;
+	FILE* file;
+	char* line = NULL;
+	char* title;
+	size_t capacity = 0;
+	ssize_t length;
+	unsigned long documentID;
+
+	file = fopen(docIDPath, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	titles				= malloc(sizeof(Titles));
+	titles->documents	= kh_init(Titles);
+	titles->strings		= arenaInit(ARENA_BLOCK_SIZE);
+	titles->lookup		= NULL;
+	titles->lookupSize	= 0;
+
+	*lastID = 0;
+	while ((length = getline(&line, &capacity, file)) > 0) {
+		documentID = strtoul(line, &title, 10);
+		if (documentID == 0 || *title != '\t') {
+			continue;
+		}
+
+		if (line[length - 1] == '\n') {
+			--length;
+		}
+		++title;
+
+		titlesReplace(titles, title, length - (title - line), documentID);
+		if (documentID > *lastID) {
+			*lastID = documentID;
+		}
+	}
+
+	free(line);
+	fclose(file);
+
+	return titles;
+}
+
+/* Makes documentID the document of the title. Returns the document it replaces, 0 for a new title. */
+unsigned long titlesReplace(Titles* titles, const char* title, unsigned long length, unsigned long documentID) {
+	unsigned long replaced = 0;
+	khiter_t bucket;
+	int result;
+
+	if (length + 1 > titles->lookupSize) {
+		titles->lookupSize	= (length + 1) * 2;
+		titles->lookup		= realloc(titles->lookup, titles->lookupSize);
+	}
+	memcpy(titles->lookup, title, length);
+	titles->lookup[length] = '\0';
+
+	bucket = kh_get(Titles, titles->documents, titles->lookup);
+	if (bucket != kh_end(titles->documents)) {
+		replaced = kh_value(titles->documents, bucket);
+	}
+	else {
+		bucket = kh_put(Titles, titles->documents, arenaCopy(titles->strings, title, length), &result);
+	}
+	kh_value(titles->documents, bucket) = documentID;
+
+	return replaced;
+}
+
+void titlesDestroy(Titles* titles) {
+	kh_destroy(Titles, titles->documents);
+	arenaDestroy(titles->strings);
+	free(titles->lookup);
+	free(titles);
+}
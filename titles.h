@@ -0,0 +1,15 @@
+/**
+ * titles.h
+ */
+
+#ifndef TITLES_H_
+#define TITLES_H_
+
+typedef struct Titles Titles;
+
+Titles*			titlesRead(const char* docIDPath, unsigned long* lastID);
+unsigned long	titlesReplace(Titles* titles, const char* title, unsigned long length, unsigned long documentID);
+void			titlesDestroy(Titles* titles);
+
+
+#endif /* TITLES_H_ */
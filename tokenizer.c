@@ -1,124 +1,323 @@
 /*
 Simple tokenizer for wikipedia dump
-- Uses bzip2 library for decompression on the fly
-- Uses the expat xml reader to parse the document.
-- Uses klib/khash for hash maps.
-- Uses own simple buffer implementation to implement strings.
+- Uses bzip2 library for decompression on the fly, optionally decompressing independent blocks in parallel.
+- Uses the expat xml reader to parse the document, or optionally its own scanner that falls back to expat (--fast-xml).
+- Uses klib/khash for the global word list.
+- Uses own simple buffer implementation to implement strings, optionally on huge pages (--huge-pages).
+- Writes the text outputs through own buffered writer with plain integer formatting.
+- Optionally tokenizes pages on a pool of worker threads (--threads N).
+- Finds word boundaries with SSE2/AVX2 when the CPU has them (--scalar to turn that off).
+- Optionally case folds beyond ASCII (--fold-case), drops stopwords (--stopwords) and stems (--stem) tokens.
+- Optionally writes the bow as a binary CSR matrix as well (--csr).
+- Optionally reports throughput, time per stage and table statistics as JSON lines (--stats).
+- Can tokenize a part of a multistream dump (--range), the parts are merged afterwards with "tokenizer merge".
+- Optionally prunes rare and common tokens at the end and numbers the rest by document frequency (--min-df etc.).
+- Optionally writes tf-idf weights instead of counts, from document frequencies of a first pass (--tfidf).
+- Weighs a bow by tf-idf in parallel, from the document frequencies in the word IDs, with "tokenizer tfidf".
+- Can fold a dump of new and edited pages into an earlier run (--update), keeping its word IDs and document IDs. The
+  weights of the new pages are projected into an existing LSI model by lsi --fold-in. Their idfs are over the
+  documents of the earlier run, which it keeps next to its word IDs.
 - The rest is just "hacked" up together in order to make it work :-)
 
 Compiling on FreeBSD:
-gcc -O2 -Wall -pedantic --std=c99 -o tokenizer tokenizer.c buffer.c -lbz2 \
-	-lexpat -L/usr/local/lib/ -I/usr/local/include
+gcc -O2 -Wall -pedantic --std=c99 -pthread -o tokenizer tokenizer.c buffer.c scan.c queue.c bzreader.c output.c \
+	vocabulary.c arena.c matrix.c merge.c stats.c xmlscan.c normalize.c tfidf.c titles.c -lbz2 \
+	-lexpat -lm -L/usr/local/lib/ -I/usr/local/include
 
 */
 
-#include <bzlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
+#include <pthread.h>
 #include <expat.h>
-#include "khash.h"
 #include "buffer.h"
+#include "scan.h"
+#include "hash.h"
+#include "queue.h"
+#include "bzreader.h"
+#include "vocabulary.h"
+#include "output.h"
+#include "matrix.h"
+#include "merge.h"
+#include "stats.h"
+#include "xmlscan.h"
+#include "normalize.h"
+#include "tfidf.h"
+#include "titles.h"
 
-#define MM_HEADER "%%MatrixMarket matrix coordinate real general\n"
+/* Pages in flight per tokenizer thread. */
+#define PAGES_PER_THREAD 4
+
+/* Initial amount of slots of the per document token table, a power of two. */
+#define TERM_SLOTS 4096
+
+/* Tiny documents are sorted by insertion instead of radix sort. */
+#define RADIX_SORT_THRESHOLD 32
 
 typedef struct {
 	unsigned long id;
-	char* token;
-	/* Document occurence. */
 	unsigned long occurence;
-} TokenDesc;
+} TokDocDesc;
 
+/* A distinct token of a page, the token itself is stored in Page.terms. */
 typedef struct {
-	unsigned long id;
+	char* token;
+	/* See hash.h, the global word list reuses it. */
+	uint64_t hash;
+	unsigned int length;
 	unsigned long occurence;
-} TokDocDesc;
+} TermDesc;
+
+/*
+A page travels from the parser to a tokenizer and from there to the writer.
+The buffers are reused for every page that passes through.
+*/
+typedef struct {
+	unsigned long documentID;
+	/* Uncompressed bytes read when the page was parsed. */
+	unsigned long bytesRead;
+	Buffer* title;
+	Buffer* text;
+	
+	/* Lower cased tokens, zero terminated, and their counts in order of first occurence. */
+	Buffer* terms;
+	Buffer* termDescs;
+} Page;
 
 #define STATE_IGNORE 0
 #define STATE_IN_TITLE 1
 #define STATE_IN_TEXT 2
 #define STATE_IN_PAGE 3
 
+/* Slot of the per document token table. It is empty unless its generation is the one of the current page. */
+typedef struct {
+	unsigned int hash;
+	unsigned int term;
+	unsigned int generation;
+} TermSlot;
+
+/*
+State of a single tokenizer; every worker thread has its own.
+The token table is an open addressing table with linear probing, referring to Page.termDescs which holds the counts.
+It is kept for the lifetime of the tokenizer: starting a page only bumps the generation.
+*/
+typedef struct {
+	TermSlot* slots;
+	unsigned int mask;
+	unsigned int generation;
+	/* NORMALIZE_* flags, see normalize.h. */
+	int normalize;
+} TokenizerContext;
+
+/* Tokenizer threads and the hand over of pages between parser, tokenizers and writer. */
+struct Pipeline {
+	unsigned int threads;
+	int normalize;
+	pthread_t* tokenizers;
+	pthread_t writer;
+	
+	Page* pages;
+	Queue* freePages;
+	Queue* parsedPages;
+	
+	/* Tokenized pages, indexed by document ID modulo the amount of pages. */
+	Page** tokenizedPages;
+	unsigned long amountPages;
+	unsigned long nextDocumentID;
+	int finished;
+	pthread_mutex_t lock;
+	pthread_cond_t tokenized;
+	
+	/* NULL unless statistics are kept. */
+	Stats* stats;
+};
+
+/* Where and how to read the dump. */
+typedef struct {
+	const char* index;
+	unsigned int decompressThreads;
+	unsigned long rangeBegin;
+	unsigned long rangeEnd;
+	unsigned int threads;
+	int fastXML;
+	int vectorized;
+} InputOptions;
+
 struct ParsingState {
 	char state;
-	Buffer* title;
-	Buffer* text;
+	Page* page;
+	
+	Output* docBow;
+	Output* docID;
+	/* NULL unless updating an earlier run, see --update. */
+	Output* deleted;
+	Titles* titles;
+	/* NULL unless a binary matrix is written too. */
+	CsrWriter* csr;
+	/* NULL unless statistics are kept. */
+	Stats* stats;
+	
+	/* NORMALIZE_* flags. */
+	int normalize;
+	
+	/* Single threaded mode only. */
+	TokenizerContext context;
+	/* NULL in single threaded mode. */
+	struct Pipeline* pipeline;
+	
+	/* Parser state. */
+	unsigned long documentID;
+	unsigned long totalBytesRead;
+	/* Pages seen, and if above 1 only every sample-th of them is tokenized. */
+	unsigned long pages;
+	unsigned long sample;
 	
-	FILE* docBow;
-	FILE* docID;
+	/* Set in the first pass of --tfidf, which only counts document frequencies. */
+	int countOnly;
+	/* Inverse document frequencies of the first pass, indexed by token ID - 1. NULL unless writing tf-idf. */
+	double* idfs;
+	unsigned long amountIdfs;
+	double unseenIdf;
+	/* Set by --update, tokens that are not in the word list already are left out. */
+	int frozen;
+	
+	/* Writer state. */
+	unsigned long replaced;
+	Vocabulary* vocabulary;
+	unsigned long amountLines;
+	TokDocDesc* tokDocDescs;
+	TokDocDesc* sortBuffer;
+	uint32_t* csrColumns;
+	uint32_t* csrValues;
+	float* csrWeights;
+	unsigned long tokDocDescsSize;
+	int writeError;
 };
 
-KHASH_MAP_INIT_STR(Tokens, TokenDesc*)
-KHASH_MAP_INIT_INT64(TokDoc, TokDocDesc*)
+static void pageInit(Page* page) {
+	page->documentID	= 0;
+	page->title			= bufferInit();
+	page->text			= bufferInit();
+	page->terms			= bufferInit();
+	page->termDescs		= bufferInit();
+}
 
-khash_t(Tokens)* tokens;
+static void pageDestroy(Page* page) {
+	bufferDestroy(page->title);
+	bufferDestroy(page->text);
+	bufferDestroy(page->terms);
+	bufferDestroy(page->termDescs);
+}
 
-long totalBytesRead = 0;
-long amountTokens = 0;
-long documentID = 0;
-long amountLines = 0;
+static void contextInit(TokenizerContext* context, int normalize) {
+	context->slots		= calloc(TERM_SLOTS, sizeof(TermSlot));
+	context->mask		= TERM_SLOTS - 1;
+	context->generation	= 0;
+	context->normalize	= normalize;
+}
+
+static void contextDestroy(TokenizerContext* context) {
+	free(context->slots);
+}
+
+/* Doubles the token table, only the tokens of the current page are kept. */
+static void contextGrow(TokenizerContext* context, Page* page) {
+	TermDesc* termDescs = (TermDesc*) page->termDescs->buffer;
+	unsigned long amount = page->termDescs->currentsize / sizeof(TermDesc);
+	unsigned long i;
+	unsigned int slot;
+	
+	free(context->slots);
+	context->mask		= context->mask * 2 + 1;
+	context->slots		= calloc(context->mask + 1, sizeof(TermSlot));
+	context->generation	= 1;
+	
+	for (i = 0; i < amount; ++i) {
+		for (slot = termDescs[i].hash & context->mask; context->slots[slot].generation != 0; slot = (slot + 1) & context->mask);
+		
+		context->slots[slot].hash		= termDescs[i].hash;
+		context->slots[slot].term		= i;
+		context->slots[slot].generation	= 1;
+	}
+}
 
 /* Cleanup any left overs in order to make sure the title does not copied over to a new page. */
 static inline void resetState(struct ParsingState* state) {
-	bufferReset(state->title);
-	bufferReset(state->text);
+	bufferReset(state->page->title);
+	bufferReset(state->page->text);
 	state->state = STATE_IGNORE;
 }
 
-static inline void token(const char* begin, const char* end,  khash_t(TokDoc)* tokensPerDocument) {
+static inline void token(TokenizerContext* context, Page* page, const char* begin, const char* end) {
 	unsigned int size = end - begin;
-	int i;
-	char* p;
-	char temp[49];
-	khiter_t bucket;
-	TokenDesc* desc;
-	TokDocDesc* tokDocDesc;
-	int result;
-	
-	if (size < 2 || size > 48) {
+	uint64_t hash;
+	unsigned int slot;
+	unsigned int amount;
+	char temp[64];
+	TermSlot* termSlot;
+	TermDesc* desc;
+	
+	if (size < NORMALIZE_MIN_LENGTH || size > NORMALIZE_MAX_LENGTH) {
 		return;
 	}
 	
+	/* Pad with zeros up to 16 bytes, this terminates the token as well. */
+	memset(temp + (size & ~15), 0, 16);
 	memcpy(temp, begin, size);
-	temp[size] = 0;
 	
-	for (i = 0, p = temp; i < size; ++p, ++i) {
-		*p = tolower(*p);
-	}
-	
-	/* Make sure our word is registered in our global word list. */
-	bucket = kh_get(Tokens, tokens, temp);
-	if (bucket == kh_end(tokens)) {
-		desc			= malloc(sizeof(TokenDesc));
-		desc->id		= ++amountTokens;
-		desc->occurence = 0;
-		desc->token		= malloc(size + 1);
-		strcpy(desc->token, temp);
-		bucket = kh_put(Tokens, tokens, desc->token, &result);
-		kh_value(tokens, bucket) = desc;
+	if (context->normalize == 0) {
+		/* Lower case and hash in one go. */
+		hash = hashLowerToken(temp, size);
 	}
 	else {
-		desc = kh_value(tokens, bucket);
+		size = normalizeToken(temp, size, context->normalize, &hash);
+		if (size < NORMALIZE_MIN_LENGTH) {
+			return;
+		}
+		temp[size] = 0;
 	}
 	
-	/* Add the word, if necessary. to the per document word list. */ 
-	bucket = kh_get(TokDoc, tokensPerDocument, desc->id);
-	if (bucket == kh_end(tokensPerDocument)) {
-		bucket		= kh_put(TokDoc, tokensPerDocument, desc->id, &result);
-		tokDocDesc	= malloc(sizeof(TokDocDesc));
-		tokDocDesc->id = desc->id;
-		tokDocDesc->occurence = 0;
-		kh_value(tokensPerDocument, bucket) = tokDocDesc;
+	/*
+	Add the word, if necessary, to the per document word list.
+	The global word list is only consulted by the writer, so that token IDs are handed out in document order.
+	*/
+	for (slot = hash & context->mask; ; slot = (slot + 1) & context->mask) {
+		termSlot = &context->slots[slot];
+		if (termSlot->generation != context->generation) {
+			break;
+		}
 		
-		/* Update document frequency. */
-		++(desc->occurence);
+		if (termSlot->hash == (unsigned int) hash) {
+			desc = ((TermDesc*) page->termDescs->buffer) + termSlot->term;
+			if (desc->length == size && memcmp(desc->token, temp, size) == 0) {
+				++desc->occurence;
+				return;
+			}
+		}
 	}
-	else {
-		tokDocDesc = kh_value(tokensPerDocument, bucket);
+	
+	/* Keep the table at most half full. */
+	amount = page->termDescs->currentsize / sizeof(TermDesc);
+	if (amount >= context->mask / 2) {
+		contextGrow(context, page);
+		for (slot = hash & context->mask; context->slots[slot].generation == context->generation; slot = (slot + 1) & context->mask);
+		termSlot = &context->slots[slot];
 	}
 	
-	++tokDocDesc->occurence;
+	termSlot->hash			= hash;
+	termSlot->term			= amount;
+	termSlot->generation	= context->generation;
+	
+	bufferAllocate(page->termDescs, sizeof(TermDesc));
+	desc = (TermDesc*) (page->termDescs->buffer + page->termDescs->currentsize);
+	page->termDescs->currentsize += sizeof(TermDesc);
+	
+	/* Page.terms is allocated up front, so the token stays in place. */
+	desc->token		= bufferAdd(page->terms, temp, size + 1);
+	desc->length	= size;
+	desc->hash		= hash;
+	desc->occurence	= 1;
 }
 
 /* Skips, recursively, any template regardless of content. */
@@ -217,113 +416,235 @@ const char* removeTags(const char* page, const char* pageEnd) {
 	return pageEnd;
 }
 
-int compare(const void* a, const void* b) {
-	const TokDocDesc* e1 = (TokDocDesc*) a;
-	const TokDocDesc* e2 = (TokDocDesc*) b;
-	if (e1->id > e2->id) return 1;
-	else if (e1->id < e2->id) return -1;
-	else return 0;
+/*
+Sorts on ID, least significant byte first, with as many passes as the largest ID needs.
+Returns either descs or buffer, whichever holds the result.
+*/
+TokDocDesc* sortTokDocDescs(TokDocDesc* descs, TokDocDesc* buffer, unsigned long amount, unsigned long maxID) {
+	unsigned long counts[256];
+	unsigned long i, j, total;
+	unsigned int shift;
+	TokDocDesc* swap;
+	TokDocDesc desc;
+	
+	if (amount < RADIX_SORT_THRESHOLD) {
+		for (i = 1; i < amount; ++i) {
+			desc = descs[i];
+			for (j = i; j > 0 && descs[j - 1].id > desc.id; --j) {
+				descs[j] = descs[j - 1];
+			}
+			descs[j] = desc;
+		}
+		
+		return descs;
+	}
+	
+	for (shift = 0; shift < sizeof(unsigned long) * 8 && (maxID >> shift) != 0; shift += 8) {
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < amount; ++i) {
+			++counts[(descs[i].id >> shift) & 0xff];
+		}
+		
+		for (i = 0, total = 0; i < 256; ++i) {
+			j			= counts[i];
+			counts[i]	= total;
+			total		+= j;
+		}
+		
+		for (i = 0; i < amount; ++i) {
+			buffer[counts[(descs[i].id >> shift) & 0xff]++] = descs[i];
+		}
+		
+		swap	= descs;
+		descs	= buffer;
+		buffer	= swap;
+	}
+	
+	return descs;
 }
 
-void writeFrequencies(struct ParsingState* parseState, khash_t(TokDoc)* tokensPerDocument) {
-	khint_t mapSize;
-	TokDocDesc* tokDocDescs;
-	TokDocDesc* desc;
-	khiter_t bucket;
-	unsigned int i;
+/* Writes the tf-idf weights of a document instead of its counts, see --tfidf. The descs are sorted by ID. */
+void writeWeights(struct ParsingState* parseState, unsigned long documentID, const TokDocDesc* descs,
+	unsigned long amount) {
+	unsigned long amountTokens = vocabularySize(parseState->vocabulary);
+	char line[MM_ENTRY_WIDTH];
+	unsigned long i;
+	
+	/* Tokens the first pass has not seen, as it only looked at a sample, count as seen in a single document. */
+	if (amountTokens > parseState->amountIdfs) {
+		parseState->idfs = realloc(parseState->idfs, sizeof(double) * amountTokens * 2);
+		for (i = parseState->amountIdfs; i < amountTokens * 2; ++i) {
+			parseState->idfs[i] = parseState->unseenIdf;
+		}
+		parseState->amountIdfs = amountTokens * 2;
+	}
+	
+	for (i = 0; i < amount; ++i) {
+		parseState->csrColumns[i]	= descs[i].id - 1;
+		parseState->csrValues[i]	= descs[i].occurence;
+	}
+	
+	amount = tfidfWeigh(parseState->csrColumns, parseState->csrValues, parseState->csrWeights, amount,
+		parseState->idfs);
+	for (i = 0; i < amount; ++i) {
+		outputWrite(parseState->docBow, line, mmFormatWeight(line, documentID, parseState->csrColumns[i] + 1,
+			parseState->csrWeights[i]));
+	}
+	
+	if (parseState->csr != NULL &&
+		csrWriterRow(parseState->csr, parseState->csrColumns, parseState->csrWeights, amount) != 0) {
+		parseState->writeError = 1;
+	}
+	
+	parseState->amountLines += amount;
+}
 
-	/* Write frequencies to doc. Make sure it is sorted. */
-	mapSize = kh_size(tokensPerDocument);
-	tokDocDescs = malloc(sizeof(TokDocDesc) * mapSize);
+/* Registers the tokens of a page in the global word list and writes its frequencies to doc. Make sure it is sorted. */
+void writeFrequencies(struct ParsingState* parseState, Page* page) {
+	unsigned long mapSize;
+	TermDesc* termDescs;
+	TokDocDesc* descs;
+	TokDocDesc* desc;
+	TokenDesc* tokenDesc;
+	unsigned long amount, i;
+	
+	mapSize		= page->termDescs->currentsize / sizeof(TermDesc);
+	termDescs	= (TermDesc*) page->termDescs->buffer;
+	
+	if (mapSize > parseState->tokDocDescsSize) {
+		parseState->tokDocDescsSize	= mapSize;
+		parseState->tokDocDescs		= realloc(parseState->tokDocDescs, sizeof(TokDocDesc) * mapSize);
+		parseState->sortBuffer		= realloc(parseState->sortBuffer, sizeof(TokDocDesc) * mapSize);
+		parseState->csrColumns		= realloc(parseState->csrColumns, sizeof(uint32_t) * mapSize);
+		parseState->csrValues		= realloc(parseState->csrValues, sizeof(uint32_t) * mapSize);
+		parseState->csrWeights		= realloc(parseState->csrWeights, sizeof(float) * mapSize);
+	}
 	
-	for (i = 0, bucket = kh_begin(tokensPerDocument); bucket != kh_end(tokensPerDocument); ++bucket) {
-		if (kh_exist(tokensPerDocument, bucket)) {
-			desc = kh_value(tokensPerDocument, bucket);
-			memcpy(&tokDocDescs[i], desc, sizeof(TokDocDesc));
-			kh_del(TokDoc, tokensPerDocument, bucket);
-			free(desc);
-			++i;
+	for (i = 0, amount = 0; i < mapSize; ++i) {
+		/* Make sure our word is registered in our global word list, unless that is frozen. */
+		if (parseState->frozen) {
+			tokenDesc = vocabularyFindHashed(parseState->vocabulary, termDescs[i].token, termDescs[i].length,
+				termDescs[i].hash);
+			if (tokenDesc == NULL) {
+				continue;
+			}
+		}
+		else {
+			tokenDesc = vocabularyAddHashed(parseState->vocabulary, termDescs[i].token, termDescs[i].length,
+				termDescs[i].hash);
 		}
+		
+		/* Update document frequency. */
+		++(tokenDesc->occurence);
+		
+		parseState->tokDocDescs[amount].id			= tokenDesc->id;
+		parseState->tokDocDescs[amount].occurence	= termDescs[i].occurence;
+		++amount;
 	}
 	
-	qsort(tokDocDescs, mapSize, sizeof(TokDocDesc), compare);
-	for (i = 0; i < mapSize; ++i) {
-		desc = &tokDocDescs[i];
-		fprintf(parseState->docBow, "%lu %lu %lu\n", documentID, desc->id, desc->occurence);
+	if (parseState->countOnly) {
+		return;
 	}
 	
-	free(tokDocDescs);
+	descs = sortTokDocDescs(parseState->tokDocDescs, parseState->sortBuffer, amount,
+		vocabularySize(parseState->vocabulary));
+	if (parseState->idfs != NULL) {
+		writeWeights(parseState, page->documentID, descs, amount);
+		return;
+	}
+	
+	for (i = 0; i < amount; ++i) {
+		desc = &descs[i];
+		mmWriteEntry(parseState->docBow, page->documentID, desc->id, desc->occurence);
+	}
+	
+	if (parseState->csr != NULL) {
+		for (i = 0; i < amount; ++i) {
+			parseState->csrColumns[i]	= descs[i].id - 1;
+			parseState->csrValues[i]	= descs[i].occurence;
+		}
+		
+		if (csrWriterRow(parseState->csr, parseState->csrColumns, parseState->csrValues, amount) != 0) {
+			parseState->writeError = 1;
+		}
+	}
+	
+	parseState->amountLines += amount;
 }
 
-void processDocument(struct ParsingState* parseState) {
-	const char* page;
-	const char* pageEnd;
+/* Splits the text of the page into tokens. Does not touch any global state. */
+void processDocument(TokenizerContext* context, Page* page) {
+	const char* text;
+	const char* textEnd;
 	const char* beginWord;
+	const char* skipped;
+	Scan scan;
 	unsigned char c;
 	unsigned char previous = 0;
-	khash_t(TokDoc)* tokensPerDocument;
 	
-	if (parseState->title->currentsize == 0 || parseState->text->currentsize == 0) {
-		return;
-	}
+	text		= page->text->buffer;
+	textEnd		= text + page->text->currentsize;
+	beginWord	= text;
 	
-	tokensPerDocument	= kh_init(TokDoc);
-	page				= parseState->text->buffer;
-	pageEnd				= page + parseState->text->currentsize;
-	beginWord			= page;
+	/* Every token is at least two bytes long and is stored once, including its terminator. */
+	bufferReset(page->terms);
+	bufferAllocate(page->terms, page->text->currentsize + page->text->currentsize / 2 + 1);
+	bufferReset(page->termDescs);
 	
-	++documentID;
-	if (documentID % 1000 == 0) {
-		printf( "Processing document id: %lu, amount unique tokens: %lu, amount bytes processed: %lu\n", documentID, amountTokens, totalBytesRead);
+	/* Empties the token table, unless the generation wraps around. */
+	if (++context->generation == 0) {
+		memset(context->slots, 0, sizeof(TermSlot) * (context->mask + 1));
+		context->generation = 1;
 	}
 	
-	fprintf(parseState->docID, "%lu\t%.*s\n", documentID, (int) (parseState->title->currentsize), parseState->title->buffer);
+	scan.block	= textEnd;
+	scan.end	= textEnd;
 	
-	while (page < pageEnd) {
-		c = (unsigned char) *page;
-		
+	while (text < textEnd) {
 		/*
-		First check this character is a possible delimiter.
-		Delimiters are any spaces, tabs, control characters, etc.
-		Specifically: 0 <= c <= 64 && 91 <= c <= 96 && 123 <= c <= 126
-		We assume any UTF-8 encoded character with code point > 128 is NOT a delimiter.
-		For an English wikipedia dump, this is most likely true.
+		First skip to the next delimiter, see scanWordByte for what a delimiter is.
+		For an English wikipedia dump, treating any UTF-8 encoded character as part of a word is most likely fine.
 		It also ignores any single ASCII characters that are floating around.
 		*/
-		if (!(c <= 64 || (c >= 91 && c <= 96) || (c >= 123 && c <= 128) || (previous == 0xe2 && c == 0x80))) {
-			++page;
-			previous = c;
-			continue;
+		skipped = scanWord(&scan, text);
+		if (skipped != text) {
+			previous	= (unsigned char) *(skipped - 1);
+			text		= skipped;
+			if (text == textEnd) {
+				break;
+			}
 		}
 		
+		c = (unsigned char) *text;
+		
 		/* UTF-8 hack: possibly delimit on some utf-8 characters. */
 		if (previous == 0xe2 && c == 0x80) {
-			token(beginWord, page - 1, tokensPerDocument);
-			++page;
+			token(context, page, beginWord, text - 1);
+			++text;
 			
 			/* Character makes no sense for further processing. */
 			c = 0;
 		}
 		else {
-			token(beginWord, page, tokensPerDocument);
+			token(context, page, beginWord, text);
 		}
 		
-		++page;
+		++text;
 		
 		if (c == '{' && previous == '{') {
-			page = removeTemplate(page, pageEnd);
+			text = removeTemplate(text, textEnd);
 			previous = 0;
 		}
 		else if (c == '<') {
-			page = removeHTMLTags(page, pageEnd);
+			text = removeHTMLTags(text, textEnd);
 			previous = 0;
 		}
 		else if (previous == '[') {
 			if (c == '[') {
-				page = removeTags(page, pageEnd);
+				text = removeTags(text, textEnd);
 			}
 			else {
-				page = removeAutoLinks(page, pageEnd);
+				text = removeAutoLinks(text, textEnd);
 			}
 			previous = 0;
 		}
@@ -331,13 +652,244 @@ void processDocument(struct ParsingState* parseState) {
 			previous = c;
 		}
 		
-		beginWord = page;
+		beginWord = text;
+		
+		/* Any further delimiters would only end empty tokens, unless they follow a [. */
+		if (previous != '[' && text < textEnd) {
+			skipped = scanDelimiters(&scan, text);
+			if (skipped != text) {
+				previous	= (unsigned char) *(skipped - 1);
+				text		= skipped;
+				beginWord	= text;
+			}
+		}
+	}
+}
+
+/* Writes a tokenized page. Pages have to be written in order of document ID. */
+void writeDocument(struct ParsingState* parseState, Page* page) {
+	TermDesc* termDescs = (TermDesc*) page->termDescs->buffer;
+	unsigned long amount = page->termDescs->currentsize / sizeof(TermDesc);
+	unsigned long buckets, resizes, replaced, tokens, i;
+	double start = 0;
+	
+	if (parseState->stats != NULL) {
+		start = statsNow();
 	}
 	
-	/* Write frequencies already clears tokensPerDocument. */
-	amountLines += kh_size(tokensPerDocument);
-	writeFrequencies(parseState, tokensPerDocument);
-	kh_destroy(TokDoc, tokensPerDocument);
+	if (page->documentID % 1000 == 0) {
+		printf( "Processing document id: %lu, amount unique tokens: %lu, amount bytes processed: %lu\n", page->documentID,
+			vocabularySize(parseState->vocabulary), page->bytesRead);
+	}
+	
+	if (!parseState->countOnly) {
+		outputNumber(parseState->docID, page->documentID);
+		outputChar(parseState->docID, '\t');
+		outputWrite(parseState->docID, page->title->buffer, page->title->currentsize);
+		outputChar(parseState->docID, '\n');
+	}
+	
+	/* An edited page replaces the document of its title, which is marked as deleted rather than renumbered. */
+	if (parseState->titles != NULL) {
+		replaced = titlesReplace(parseState->titles, page->title->buffer, page->title->currentsize, page->documentID);
+		if (replaced != 0) {
+			outputNumber(parseState->deleted, replaced);
+			outputChar(parseState->deleted, '\n');
+			++parseState->replaced;
+		}
+	}
+	writeFrequencies(parseState, page);
+	
+	if (parseState->stats != NULL) {
+		statsTime(parseState->stats, STATS_OUTPUT, statsNow() - start);
+		/* The counts of the distinct tokens add up to the tokens of the page. */
+		for (i = 0, tokens = 0; i < amount; ++i) {
+			tokens += termDescs[i].occurence;
+		}
+		statsPage(parseState->stats, page->text->currentsize, tokens, amount);
+		
+		vocabularyTable(parseState->vocabulary, &buckets, &resizes);
+		statsVocabulary(parseState->stats, vocabularySize(parseState->vocabulary), buckets, resizes);
+	}
+}
+
+void* tokenizerThread(void* data) {
+	struct Pipeline* pipeline = (struct Pipeline*) data;
+	TokenizerContext context;
+	Page* page;
+	double start;
+	
+	contextInit(&context, pipeline->normalize);
+	
+	while ((page = queuePop(pipeline->parsedPages)) != NULL) {
+		if (pipeline->stats != NULL) {
+			start = statsNow();
+			processDocument(&context, page);
+			statsTime(pipeline->stats, STATS_TOKENIZE, statsNow() - start);
+		}
+		else {
+			processDocument(&context, page);
+		}
+		
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->tokenizedPages[page->documentID % pipeline->amountPages] = page;
+		pthread_cond_broadcast(&pipeline->tokenized);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+	
+	contextDestroy(&context);
+	
+	return NULL;
+}
+
+/* Writes the tokenized pages in order of document ID, so the output does not depend on the amount of threads. */
+void* writerThread(void* data) {
+	struct ParsingState* state = (struct ParsingState*) data;
+	struct Pipeline* pipeline = state->pipeline;
+	Page** slot;
+	Page* page;
+	
+	while (1) {
+		pthread_mutex_lock(&pipeline->lock);
+		
+		slot = &pipeline->tokenizedPages[pipeline->nextDocumentID % pipeline->amountPages];
+		while (*slot == NULL && !pipeline->finished) {
+			pthread_cond_wait(&pipeline->tokenized, &pipeline->lock);
+		}
+		
+		/* Once finished, all tokenizers are gone and every page left is in place. */
+		page	= *slot;
+		*slot	= NULL;
+		pthread_mutex_unlock(&pipeline->lock);
+		
+		if (page == NULL) {
+			break;
+		}
+		
+		writeDocument(state, page);
+		++pipeline->nextDocumentID;
+		
+		queuePush(pipeline->freePages, page);
+	}
+	
+	return NULL;
+}
+
+struct Pipeline* pipelineInit(struct ParsingState* state, unsigned int threads) {
+	struct Pipeline* pipeline;
+	unsigned long i;
+	
+	pipeline					= malloc(sizeof(struct Pipeline));
+	pipeline->threads			= threads;
+	pipeline->normalize			= state->normalize;
+	pipeline->amountPages		= threads * PAGES_PER_THREAD + 1;
+	pipeline->pages				= malloc(sizeof(Page) * pipeline->amountPages);
+	pipeline->tokenizedPages	= calloc(pipeline->amountPages, sizeof(Page*));
+	pipeline->tokenizers		= malloc(sizeof(pthread_t) * threads);
+	pipeline->freePages			= queueInit(pipeline->amountPages);
+	pipeline->parsedPages		= queueInit(pipeline->amountPages);
+	pipeline->nextDocumentID	= state->documentID + 1;
+	pipeline->finished			= 0;
+	pipeline->stats				= state->stats;
+	
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->tokenized, NULL);
+	
+	for (i = 0; i < pipeline->amountPages; ++i) {
+		pageInit(&pipeline->pages[i]);
+		queuePush(pipeline->freePages, &pipeline->pages[i]);
+	}
+	
+	state->pipeline	= pipeline;
+	state->page		= queuePop(pipeline->freePages);
+	
+	for (i = 0; i < threads; ++i) {
+		if (pthread_create(&pipeline->tokenizers[i], NULL, tokenizerThread, pipeline) != 0) {
+			return NULL;
+		}
+	}
+	
+	if (pthread_create(&pipeline->writer, NULL, writerThread, state) != 0) {
+		return NULL;
+	}
+	
+	return pipeline;
+}
+
+/* Waits until every parsed page has been written. */
+void pipelineFinish(struct Pipeline* pipeline) {
+	unsigned long i;
+	
+	queueClose(pipeline->parsedPages);
+	for (i = 0; i < pipeline->threads; ++i) {
+		pthread_join(pipeline->tokenizers[i], NULL);
+	}
+	
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->finished = 1;
+	pthread_cond_broadcast(&pipeline->tokenized);
+	pthread_mutex_unlock(&pipeline->lock);
+	
+	pthread_join(pipeline->writer, NULL);
+}
+
+void pipelineDestroy(struct Pipeline* pipeline) {
+	unsigned long i;
+	
+	for (i = 0; i < pipeline->amountPages; ++i) {
+		pageDestroy(&pipeline->pages[i]);
+	}
+	
+	pthread_mutex_destroy(&pipeline->lock);
+	pthread_cond_destroy(&pipeline->tokenized);
+	queueDestroy(pipeline->freePages);
+	queueDestroy(pipeline->parsedPages);
+	free(pipeline->tokenizedPages);
+	free(pipeline->tokenizers);
+	free(pipeline->pages);
+	free(pipeline);
+}
+
+/* Hands a complete page over to be tokenized and written, either directly or through the pipeline. */
+void endPage(struct ParsingState* state) {
+	Page* page = state->page;
+	double start = 0;
+	
+	if (page->title->currentsize == 0 || page->text->currentsize == 0) {
+		return;
+	}
+	
+	if (state->sample > 1 && state->pages++ % state->sample != 0) {
+		return;
+	}
+	
+	page->documentID	= ++state->documentID;
+	page->bytesRead		= state->totalBytesRead;
+	
+	if (state->stats != NULL) {
+		start = statsNow();
+	}
+	
+	if (state->pipeline == NULL) {
+		processDocument(&state->context, page);
+		if (state->stats != NULL) {
+			statsTime(state->stats, STATS_TOKENIZE, statsNow() - start);
+		}
+		
+		writeDocument(state, page);
+	}
+	else {
+		queuePush(state->pipeline->parsedPages, page);
+		state->page = queuePop(state->pipeline->freePages);
+		if (state->stats != NULL) {
+			statsTime(state->stats, STATS_WAIT, statsNow() - start);
+		}
+	}
+	
+	/* This is called from within the parser, which is timed as a whole. */
+	if (state->stats != NULL) {
+		statsTime(state->stats, STATS_PARSE, start - statsNow());
+	}
 }
 
 void beginElementHandler(void* data, const XML_Char* element, const XML_Char **atts) {
@@ -345,14 +897,14 @@ void beginElementHandler(void* data, const XML_Char* element, const XML_Char **a
 	
 	if (state->state != STATE_IGNORE) {
 		if (strcmp(element, "title") == 0) {
-			bufferReset(state->title);
+			bufferReset(state->page->title);
 			state->state = STATE_IN_TITLE;
 		}
 		else if (strcmp(element, "redirect") == 0) {
 			resetState(state);
 		}
 		else if (strcmp(element, "text") == 0) {
-			bufferReset(state->text);
+			bufferReset(state->page->text);
 			state->state = STATE_IN_TEXT;
 		}
 	}
@@ -366,7 +918,7 @@ void endElementHandler(void *data, const char* element) {
 	
 	if (state->state != STATE_IGNORE) {
 		if (strcmp(element, "page") == 0) {
-			processDocument(state);
+			endPage(state);
 			resetState(state);
 		}
 		else if (strcmp(element, "title") == 0 || strcmp(element, "text") == 0) {
@@ -380,161 +932,567 @@ void characterHandler(void* data, const XML_Char* buffer, int length) {
 	
 	switch (state->state) {
 		case STATE_IN_TITLE:
-			bufferAdd(state->title, (char*) buffer, length);
+			bufferAdd(state->page->title, (char*) buffer, length);
 			break;
 		case STATE_IN_TEXT:
 			/* Copy text first before processing it, because the text may be ignored afterwards. */
-			bufferAdd(state->text, (char*) buffer, length);
+			bufferAdd(state->page->text, (char*) buffer, length);
 			break;
 	}
 }
 
+/* Parses the next part of the dump with the scanner if there is one, with expat otherwise. Returns 0 on success. */
+int parse(XML_Parser parser, XmlScanner* scanner, const char* buffer, long size, int final) {
+	if (scanner != NULL) {
+		if (xmlScannerParse(scanner, buffer, size) != 0) {
+			return -1;
+		}
+		
+		return final ? xmlScannerFinish(scanner) : 0;
+	}
+	
+	return XML_Parse(parser, buffer, size, final) ? 0 : -1;
+}
+
 int help() {
-	printf("Syntax: tokenizer [input] [bow output] [word ID output] [docID output]\n");
+	printf("Syntax: tokenizer [--threads N] [--decompress-threads N] [--index multistream index] [--range begin:end] "
+		"[--csr binary bow output] [--scalar] [--fast-xml] [--fold-case] [--stopwords] [--stem] [--huge-pages] "
+		"[--stats file or -] [--stats-interval seconds] [--min-df N] [--max-df-ratio R] [--keep-top N] "
+		"[--tfidf] [--df-sample N] [--update deleted docID output] [--documents N] [input] "
+		"[bow output] [word ID output] [docID output]\n");
+	printf("        With --update, the word IDs and docIDs of an earlier run are extended instead: tf-idf weights of the "
+		"pages in input are written with the document frequencies of the word IDs, over N documents (by default "
+		"those of the run that wrote them, kept in [word ID output].documents), and the documents that the pages "
+		"replace are appended to the deleted docIDs. Use the same token options as the earlier run.\n");
+	printf("        tokenizer merge [--min-df N] [--max-df-ratio R] [--keep-top N] [bow output] [word ID output] "
+		"[docID output] [shard bow] [shard word IDs] [shard docIDs] ...\n");
+	printf("        tokenizer tfidf [--threads N] [--csr binary tfidf output] [bow, text or binary] [word IDs] "
+		"[tfidf output]\n");
 	return 0;
 }
 
-int main(int argc, char** argv) {
-	FILE* wiki;
-	FILE* docBow;
-	FILE* wordID;
-	FILE* docID;
-	
-	XML_Parser parser;
-	int bzError;
-	int bytesRead;
-	unsigned long i;
-	BZFILE* compressed;
-	khiter_t bucket;
-	char spaces[64];
-	char buffer[16384];
-	struct ParsingState state;
+/* Takes the pruning option at argv[*argument], see Pruning. Returns 0 if it is not one. */
+int parsePruning(int argc, char** argv, int* argument, Pruning* pruning) {
+	const char* option = argv[*argument];
 	
-	/* We need input filename, output name for BOW per document and output filename for word IDs in total. */
-	if (argc != 5) {
-		return help();
+	if (*argument + 1 >= argc) {
+		return 0;
 	}
 	
-	tokens = kh_init(Tokens);
-	if (tokens == NULL) {
-		perror("Cannot instantiate map.\n");
+	if (strcmp(option, "--min-df") == 0) {
+		pruning->minOccurence = strtoul(argv[++*argument], NULL, 10);
+	}
+	else if (strcmp(option, "--max-df-ratio") == 0) {
+		pruning->maxRatio = atof(argv[++*argument]);
+	}
+	else if (strcmp(option, "--keep-top") == 0) {
+		pruning->keep = strtoul(argv[++*argument], NULL, 10);
+	}
+	else {
+		return 0;
+	}
+	
+	pruning->enabled = 1;
+	return 1;
+}
+
+/* Parses begin:end, both byte offsets of streams in a multistream dump. Either side may be left out. */
+int parseRange(const char* range, unsigned long* begin, unsigned long* end) {
+	char* separator;
+	
+	*begin = strtoul(range, &separator, 10);
+	if (*separator != ':') {
 		return -1;
 	}
 	
-	wiki = fopen(argv[1], "r");
+	*end = strtoul(separator + 1, &separator, 10);
+	
+	return *separator == 0 && (*end == 0 || *end > *begin) ? 0 : -1;
+}
+
+/* Tokenizes the dump, or the range of it, once. Every page goes through writeDocument. Returns 0 on success. */
+int tokenizeDump(struct ParsingState* state, const char* input, const InputOptions* options) {
+	BzReader* wiki;
+	XML_Parser parser = NULL;
+	XmlScanner* scanner = NULL;
+	long bytesRead;
+	double start, now;
+	const char* buffer;
+	Page page;
+	
+	wiki = bzReaderOpen(input, options->index, options->decompressThreads, options->rangeBegin, options->rangeEnd);
 	if (wiki == NULL) {
 		perror("Cannot open input file.\n");
 		return -1;
 	}
 	
-	docBow = fopen(argv[2], "w");
-	if (docBow == NULL) {
-		perror("Cannot create output file for BOW\n");
+	if (options->fastXML) {
+		scanner = xmlScannerInit(state, beginElementHandler, endElementHandler, characterHandler, options->vectorized);
+	}
+	else {
+		parser = XML_ParserCreate("UTF-8");
+		if (parser == NULL) {
+			perror("Cannot initialize xml parser");
+			return -1;
+		}
+		
+		XML_SetUserData(parser, state);
+		XML_SetElementHandler(parser, beginElementHandler, endElementHandler);
+		XML_SetCharacterDataHandler(parser, characterHandler);
+	}
+	
+	if (options->threads > 0) {
+		if (pipelineInit(state, options->threads) == NULL) {
+			perror("Cannot start tokenizer threads");
+			return -1;
+		}
+	}
+	else {
+		pageInit(&page);
+		state->page						= &page;
+		contextInit(&state->context, state->normalize);
+	}
+	
+	/* A range that does not start at the beginning lacks the opening of the root element. */
+	if (options->rangeBegin > 0 && parse(parser, scanner, "<mediawiki>", 11, 0) != 0) {
+		perror("XML parsing error");
 		return -1;
 	}
 	
-	memset(spaces, 32, sizeof(spaces));
-	spaces[sizeof(spaces) - 1] = '\n';
-	if (fwrite(MM_HEADER, sizeof(MM_HEADER), 1, docBow) == 0) {
-		perror("Cannot write.\n");
+	start = statsNow();
+	while ((bytesRead = bzReaderRead(wiki, &buffer)) > 0) {
+		if (state->stats != NULL) {
+			now = statsNow();
+			statsTime(state->stats, STATS_DECOMPRESS, now - start);
+			statsDecompressed(state->stats, bytesRead);
+			start = now;
+		}
+		
+		state->totalBytesRead += bytesRead;
+		if (parse(parser, scanner, buffer, bytesRead, 0) != 0) {
+			perror("XML parsing error");
+			return -1;
+		}
+		
+		if (state->stats != NULL) {
+			statsTime(state->stats, STATS_PARSE, statsNow() - start);
+			statsReport(state->stats, 0);
+			start = statsNow();
+		}
+	}
+	
+	if (bytesRead < 0) {
+		perror("Cannot decompress input");
+		return -1;
+	}
+	
+	/* Neither does a range that ends before the end of the dump have its closing. */
+	if (options->rangeEnd > 0 && options->rangeEnd < bzReaderSize(wiki) &&
+		parse(parser, scanner, "</mediawiki>", 12, 0) != 0) {
+		perror("XML parsing error");
+		return -1;
+	}
+	
+	if (parse(parser, scanner, NULL, 0, 1) != 0) {
+		perror("XML parsing error");
 		return -1;
 	}
 	
-	if (fwrite(spaces, sizeof(spaces), 1, docBow) == 0) {
-		perror("Cannot write.\n");
+	/* Cleanup any parsing data */
+	start = statsNow();
+	if (state->pipeline != NULL) {
+		pipelineFinish(state->pipeline);
+		pipelineDestroy(state->pipeline);
+		state->pipeline = NULL;
+	}
+	else {
+		pageDestroy(&page);
+		contextDestroy(&state->context);
+	}
+	state->page = NULL;
+	
+	if (scanner != NULL) {
+		printf("Pages parsed by expat: %lu\n", xmlScannerFallbacks(scanner));
+		xmlScannerDestroy(scanner);
+	}
+	else {
+		XML_ParserFree(parser);
+	}
+	bzReaderClose(wiki);
+	
+	if (state->stats != NULL) {
+		statsTime(state->stats, STATS_WAIT, statsNow() - start);
+	}
+	
+	return 0;
+}
+
+/*
+Prepares an update of an earlier run, see --update: reads its word IDs, which are not extended, with their inverse
+document frequencies over documents (if 0, those of the run that wrote the word IDs, see tfidfDocuments) and the
+titles of its docIDs. The docIDs are appended to, continuing after the last one. The last docID is no measure of the
+documents, as every update adds to the docIDs but not to the document frequencies.
+*/
+int openUpdate(struct ParsingState* state, const char* wordIDPath, const char* docIDPath, const char* deletedPath,
+	unsigned long documents) {
+	unsigned long* mapping;
+	unsigned long amount, id;
+	
+	mapping = vocabularyMap(state->vocabulary, wordIDPath, 1, &amount);
+	if (mapping == NULL) {
+		perror("Cannot read word IDs.\n");
 		return -1;
 	}
 	
-	wordID = fopen(argv[3], "w");
-	if (wordID == NULL) {
-		perror("Cannot create output file for word IDs\n");
+	/* Token IDs are the columns of the model, so they have to come out the same. */
+	for (id = 1; id <= amount && mapping[id] == id; ++id);
+	free(mapping);
+	if (id <= amount || amount != vocabularySize(state->vocabulary)) {
+		fprintf(stderr, "Word IDs are not numbered 1 up to %lu.\n", amount);
 		return -1;
 	}
 	
-	docID = fopen(argv[4], "w");
-	if (wordID == NULL) {
-		perror("Cannot create output file for doc IDs\n");
+	state->titles = titlesRead(docIDPath, &state->documentID);
+	if (state->titles == NULL) {
+		perror("Cannot read doc IDs.\n");
 		return -1;
 	}
 	
-	compressed = BZ2_bzReadOpen(&bzError, wiki, 0, 0, NULL, 0);
-	if (compressed == NULL) {
-		perror("Cannot initialize BZIP2\n");
+	if (documents == 0) {
+		documents = tfidfDocuments(wordIDPath);
+		if (documents == 0) {
+			fprintf(stderr, "Cannot read the amount of documents of the word IDs, give them with --documents.\n");
+			return -1;
+		}
+	}
+	
+	state->idfs = tfidfIdfs(wordIDPath, documents, &state->amountIdfs);
+	if (state->idfs == NULL) {
+		perror("Cannot read word IDs.\n");
 		return -1;
 	}
+	state->unseenIdf	= tfidfIdf(1, documents);
+	state->frozen		= 1;
 	
-	parser = XML_ParserCreate("UTF-8");
-	if (parser == NULL) {
-		perror("Cannot initialize xml parser");
+	state->docID	= outputAppend(docIDPath);
+	state->deleted	= outputAppend(deletedPath);
+	if (state->docID == NULL || state->deleted == NULL) {
+		perror("Cannot append to doc IDs.\n");
 		return -1;
 	}
 	
-	XML_SetUserData(parser, &state);
-	XML_SetElementHandler(parser, beginElementHandler, endElementHandler);
-	XML_SetCharacterDataHandler(parser, characterHandler);
+	printf("Updating %lu documents of %lu tokens, weighed as %lu documents\n", state->documentID, amount, documents);
 	
-	memset(&state, 0, sizeof(state));
-	state.title		= bufferInit();
-	state.text		= bufferInit();
-	state.docBow	= docBow;
-	state.docID		= docID;
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	Output* docBow;
+	Output* wordID;
+	Output* docID;
 	
-	while (1) {
-		bytesRead = BZ2_bzRead(&bzError, compressed, buffer, sizeof(buffer));
+	InputOptions options;
+	int fastXML = 0;
+	int normalize = 0;
+	int tfidf = 0;
+	unsigned long sample = 0;
+	unsigned long* occurences;
+	unsigned long amountIdfs, i;
+	int argument;
+	unsigned int threads = 0;
+	unsigned int decompressThreads = 0;
+	int vectorized = 1;
+	unsigned long rangeBegin = 0;
+	unsigned long rangeEnd = 0;
+	const char* index = NULL;
+	const char* csr = NULL;
+	const char* stats = NULL;
+	const char* update = NULL;
+	unsigned long documents = 0;
+	unsigned long firstID = 1;
+	double statsInterval = 10;
+	double start;
+	struct ParsingState state;
+	Pruning pruning;
+	
+	memset(&pruning, 0, sizeof(pruning));
+	
+	if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+		for (argument = 2; argument < argc && strncmp(argv[argument], "--", 2) == 0; ++argument) {
+			if (!parsePruning(argc, argv, &argument, &pruning)) {
+				return help();
+			}
+		}
+		argc -= argument - 2;
+		argv += argument - 2;
 		
-		if (bzError != BZ_OK && bzError != BZ_STREAM_END) {
-			break;
+		if (argc < 8 || (argc - 5) % 3 != 0) {
+			return help();
 		}
 		
-		if (bytesRead == 0) {
-			break;
+		return mergeShards(argv[2], argv[3], argv[4], argv + 5, (argc - 5) / 3, &pruning);
+	}
+	
+	if (argc > 1 && strcmp(argv[1], "tfidf") == 0) {
+		for (argument = 2; argument < argc && strncmp(argv[argument], "--", 2) == 0; ++argument) {
+			if (strcmp(argv[argument], "--threads") == 0 && argument + 1 < argc) {
+				threads = atoi(argv[++argument]);
+			}
+			else if (strcmp(argv[argument], "--csr") == 0 && argument + 1 < argc) {
+				csr = argv[++argument];
+			}
+			else {
+				return help();
+			}
 		}
 		
-		totalBytesRead += bytesRead;
-		if (!XML_Parse(parser, buffer, bytesRead, bzError == BZ_STREAM_END)) {
-			perror("XML parsing error");
+		if (argc - argument != 3) {
+			return help();
+		}
+		
+		return tfidfConvert(argv[argument], argv[argument + 1], argv[argument + 2], csr, threads);
+	}
+	
+	for (argument = 1; argument < argc && strncmp(argv[argument], "--", 2) == 0; ++argument) {
+		if (strcmp(argv[argument], "--threads") == 0 && argument + 1 < argc) {
+			threads = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--decompress-threads") == 0 && argument + 1 < argc) {
+			decompressThreads = atoi(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--index") == 0 && argument + 1 < argc) {
+			index = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--csr") == 0 && argument + 1 < argc) {
+			csr = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--stats") == 0 && argument + 1 < argc) {
+			stats = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--stats-interval") == 0 && argument + 1 < argc) {
+			statsInterval = atof(argv[++argument]);
+		}
+		else if (strcmp(argv[argument], "--scalar") == 0) {
+			vectorized = 0;
+		}
+		else if (strcmp(argv[argument], "--fast-xml") == 0) {
+			fastXML = 1;
+		}
+		else if (strcmp(argv[argument], "--fold-case") == 0) {
+			normalize |= NORMALIZE_FOLD;
+		}
+		else if (strcmp(argv[argument], "--stopwords") == 0) {
+			normalize |= NORMALIZE_STOPWORDS;
+		}
+		else if (strcmp(argv[argument], "--stem") == 0) {
+			normalize |= NORMALIZE_STEM;
+		}
+		else if (strcmp(argv[argument], "--huge-pages") == 0) {
+			bufferUseHugePages(1);
+		}
+		else if (strcmp(argv[argument], "--tfidf") == 0) {
+			tfidf = 1;
+		}
+		else if (strcmp(argv[argument], "--df-sample") == 0 && argument + 1 < argc) {
+			sample = strtoul(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--update") == 0 && argument + 1 < argc) {
+			update = argv[++argument];
+		}
+		else if (strcmp(argv[argument], "--documents") == 0 && argument + 1 < argc) {
+			documents = strtoul(argv[++argument], NULL, 10);
+		}
+		else if (strcmp(argv[argument], "--range") == 0 && argument + 1 < argc) {
+			if (parseRange(argv[++argument], &rangeBegin, &rangeEnd) != 0) {
+				return help();
+			}
+		}
+		else if (!parsePruning(argc, argv, &argument, &pruning)) {
+			return help();
+		}
+	}
+	
+	/* We need input filename, output name for BOW per document and output filename for word IDs in total. */
+	if (argc - argument != 4) {
+		return help();
+	}
+	argv += argument - 1;
+	
+	/* Pruning renumbers and rewrites a bow of counts, after the fact. */
+	if (tfidf && pruning.enabled) {
+		fprintf(stderr, "Pruning does not work with --tfidf, use tokenizer tfidf on the pruned bow instead.\n");
+		return -1;
+	}
+	
+	/* An update weighs by the frozen document frequencies of the earlier run. */
+	if (update != NULL && (tfidf || pruning.enabled)) {
+		fprintf(stderr, "Neither --tfidf nor pruning work with --update, which keeps the earlier word IDs.\n");
+		return -1;
+	}
+	
+	options.index				= index;
+	options.decompressThreads	= decompressThreads;
+	options.rangeBegin			= rangeBegin;
+	options.rangeEnd			= rangeEnd;
+	options.threads				= threads;
+	options.fastXML				= fastXML;
+	options.vectorized			= vectorized;
+	
+	scanInit(vectorized);
+	if (normalizeInit() != 0) {
+		fprintf(stderr, "Cannot hash the stopwords.\n");
+		return -1;
+	}
+	
+	memset(&state, 0, sizeof(state));
+	state.normalize = normalize;
+	state.vocabulary = vocabularyInit();
+	if (state.vocabulary == NULL) {
+		perror("Cannot instantiate map.\n");
+		return -1;
+	}
+	
+	if (update != NULL) {
+		if (openUpdate(&state, argv[3], argv[4], update, documents) != 0) {
 			return -1;
 		}
+		wordID	= NULL;
+		docID	= state.docID;
+		firstID	= state.documentID + 1;
+	}
+	else {
+		wordID = outputOpen(argv[3]);
+		if (wordID == NULL) {
+			perror("Cannot create output file for word IDs\n");
+			return -1;
+		}
+		
+		docID = outputOpen(argv[4]);
+		if (docID == NULL) {
+			perror("Cannot create output file for doc IDs\n");
+			return -1;
+		}
+		state.docID = docID;
 	}
 	
-	/* Cleanup any parsing data */
-	XML_ParserFree(parser);
-	BZ2_bzReadClose(&bzError, compressed);
-	bufferDestroy(state.title);
-	bufferDestroy(state.text);
-	fclose(wiki);
+	/* The header goes in front of the entries once all documents are written and the sizes are known. */
+	docBow = mmBodyOpen(argv[2]);
+	if (docBow == NULL) {
+		perror("Cannot create output file for BOW\n");
+		return -1;
+	}
+	state.docBow = docBow;
+	
+	if (stats != NULL) {
+		state.stats = statsInit(stats, statsInterval);
+		if (state.stats == NULL) {
+			perror("Cannot create statistics file\n");
+			return -1;
+		}
+	}
+	
+	if (csr != NULL) {
+		state.csr = csrWriterOpen(csr, tfidf || update != NULL ? CSR_FLOATS : CSR_COUNTS);
+		if (state.csr == NULL) {
+			perror("Cannot create output file for binary BOW\n");
+			return -1;
+		}
+	}
+	
+	if (tfidf) {
+		/* First pass, only for the document frequencies. */
+		state.countOnly	= 1;
+		state.sample	= sample;
+		if (tokenizeDump(&state, argv[1], &options) != 0) {
+			return -1;
+		}
+		
+		occurences	= vocabularyResetOccurence(state.vocabulary, &amountIdfs);
+		state.idfs	= malloc(sizeof(double) * (amountIdfs + 1));
+		for (i = 1; i <= amountIdfs; ++i) {
+			state.idfs[i - 1] = tfidfIdf(occurences[i], state.documentID);
+		}
+		state.amountIdfs	= amountIdfs;
+		state.unseenIdf		= tfidfIdf(1, state.documentID);
+		free(occurences);
+		
+		printf("Document frequencies of %lu tokens from %lu documents, second pass\n", amountIdfs, state.documentID);
+		state.countOnly			= 0;
+		state.sample			= 0;
+		state.documentID		= 0;
+		state.totalBytesRead	= 0;
+	}
+	
+	if (tokenizeDump(&state, argv[1], &options) != 0) {
+		return -1;
+	}
 	
-	fclose(docID);
+	free(state.tokDocDescs);
+	free(state.sortBuffer);
+	free(state.csrColumns);
+	free(state.csrValues);
+	free(state.csrWeights);
+	free(state.idfs);
+	start = statsNow();
+	
+	if (outputClose(docID) != 0) {
+		perror("Cannot write doc IDs.\n");
+		return -1;
+	}
 	
 	printf("Total uncompressed bytes read: %lu, processed documents: %lu, processed tokens: %lu\n",
-		totalBytesRead, documentID, amountTokens);
+		state.totalBytesRead, state.documentID, vocabularySize(state.vocabulary));
 	
-	fseek(docBow, sizeof(MM_HEADER) - 1, SEEK_SET);
-	fprintf(docBow, "%lu %lu %lu", documentID, amountTokens, amountLines);
-	fclose(docBow);
+	if (update != NULL) {
+		printf("Added documents %lu up to %lu, replacing %lu of them\n", firstID, state.documentID, state.replaced);
+		titlesDestroy(state.titles);
+		if (outputClose(state.deleted) != 0) {
+			perror("Cannot write deleted doc IDs.\n");
+			return -1;
+		}
+	}
 	
-	setbuf(stdout, NULL);
-	printf("Writing word IDs: ");
+	if (state.csr != NULL && (csrWriterClose(state.csr, vocabularySize(state.vocabulary)) != 0 || state.writeError)) {
+		perror("Cannot write binary BOW.\n");
+		return -1;
+	}
 	
-	for (i = 0, bucket = kh_begin(tokens); bucket != kh_end(tokens); ++bucket, ++i) {
-		if (kh_exist(tokens, bucket)) {
-			TokenDesc* desc = kh_value(tokens, bucket);
-			fprintf(wordID, "%lu\t%s\t%lu\n", desc->id, desc->token, desc->occurence);
-			
-			kh_del(Tokens, tokens, bucket);
-			free(desc->token);
-			free(desc);
-			
-			if (i % 10000 == 0) {
-				putchar('.');
-			}
+	/* A pruned bow is written from the entries with the new IDs, so the entries with the old ones are never kept. */
+	if (pruning.enabled) {
+		if (pruneOutputs(state.vocabulary, docBow, argv[2], csr, state.documentID, &pruning) != 0) {
+			perror("Cannot prune BOW.\n");
+			return -1;
 		}
 	}
+	else if (mmBodyClose(docBow, argv[2], state.documentID, vocabularySize(state.vocabulary), state.amountLines) != 0) {
+		perror("Cannot write BOW.\n");
+		return -1;
+	}
 	
-	printf("\n");
-	kh_destroy(Tokens, tokens);
+	/* The word IDs of an update are those it read. */
+	if (wordID != NULL) {
+		setbuf(stdout, NULL);
+		printf("Writing word IDs: ");
+		
+		if (vocabularyWrite(state.vocabulary, wordID) != 0) {
+			perror("Cannot write.\n");
+			return -1;
+		}
+		
+		printf("\n");
+		
+		if (outputClose(wordID) != 0 || tfidfWriteDocuments(argv[3], state.documentID) != 0) {
+			perror("Cannot write.\n");
+			return -1;
+		}
+	}
+	vocabularyDestroy(state.vocabulary);
 	
-	fclose(wordID);
+	if (state.stats != NULL) {
+		statsTime(state.stats, STATS_OUTPUT, statsNow() - start);
+		statsReport(state.stats, 1);
+		statsDestroy(state.stats);
+	}
 	
 	return 0;
 }
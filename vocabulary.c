@@ -0,0 +1,345 @@
+/**
+ * vocabulary.c
+ *
+ * The global word list. Token IDs are handed out in order of first occurence, starting at 1, unless the word list is
+ * pruned afterwards.
+ * Tokens are kept in an arena and their descriptions inside the hash map, so there is no allocation per token.
+ * The map keeps the hash of every token (see hash.h), tokens are never hashed again once they are in.
+ */
+
+#include "vocabulary.h"
+#include "arena.h"
+#include "buffer.h"
+#include "hash.h"
+#include "khash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+	const char* token;
+	unsigned int length;
+	khint32_t hash;
+} TokenKey;
+
+#define tokenKeyHash(key) ((key).hash)
+#define tokenKeyEqual(a, b) ((a).hash == (b).hash && (a).length == (b).length && \
+	memcmp((a).token, (b).token, (a).length) == 0)
+
+KHASH_INIT(Tokens, TokenKey, TokenDesc, 1, tokenKeyHash, tokenKeyEqual)
+
+struct Vocabulary {
+	khash_t(Tokens)* tokens;
+	Arena* strings;
+	unsigned long amountTokens;
+	unsigned long resizes;
+};
+
+/* A line of a word ID file. */
+typedef struct {
+	char* token;
+	unsigned long occurence;
+} WordIDDesc;
+
+Vocabulary* vocabularyInit() {
+	Vocabulary* vocabulary;
+
+	vocabulary					= malloc(sizeof(Vocabulary));
+	vocabulary->tokens			= kh_init(Tokens);
+	vocabulary->strings			= arenaInit(ARENA_BLOCK_SIZE);
+	vocabulary->amountTokens	= 0;
+	vocabulary->resizes			= 0;
+
+	if (vocabulary->tokens == NULL) {
+		arenaDestroy(vocabulary->strings);
+		free(vocabulary);
+		return NULL;
+	}
+
+	return vocabulary;
+}
+
+/*
+Looks up a token, registering it with a new ID if necessary.
+The description lives in the hash map, so it is only valid until the next token is added.
+*/
+TokenDesc* vocabularyAddHashed(Vocabulary* vocabulary, const char* token, unsigned int length, uint64_t hash) {
+	TokenDesc* desc;
+	TokenKey key;
+	khiter_t bucket;
+	khint_t buckets;
+	int result;
+
+	key.token	= token;
+	key.length	= length;
+	key.hash	= (khint32_t) hash;
+
+	bucket = kh_get(Tokens, vocabulary->tokens, key);
+	if (bucket != kh_end(vocabulary->tokens)) {
+		return &kh_value(vocabulary->tokens, bucket);
+	}
+
+	buckets			= kh_n_buckets(vocabulary->tokens);
+	key.token		= arenaCopy(vocabulary->strings, token, length);
+	bucket			= kh_put(Tokens, vocabulary->tokens, key, &result);
+	if (kh_n_buckets(vocabulary->tokens) != buckets) {
+		++vocabulary->resizes;
+	}
+	desc			= &kh_value(vocabulary->tokens, bucket);
+	desc->id		= ++vocabulary->amountTokens;
+	desc->occurence	= 0;
+
+	return desc;
+}
+
+/* Looks up a token without registering it, NULL if it is not in the word list. */
+TokenDesc* vocabularyFindHashed(Vocabulary* vocabulary, const char* token, unsigned int length, uint64_t hash) {
+	TokenKey key;
+	khiter_t bucket;
+
+	key.token	= token;
+	key.length	= length;
+	key.hash	= (khint32_t) hash;
+
+	bucket = kh_get(Tokens, vocabulary->tokens, key);
+	if (bucket == kh_end(vocabulary->tokens) || kh_value(vocabulary->tokens, bucket).id == 0) {
+		return NULL;
+	}
+
+	return &kh_value(vocabulary->tokens, bucket);
+}
+
+TokenDesc* vocabularyAdd(Vocabulary* vocabulary, const char* token) {
+	unsigned int length = strlen(token);
+
+	return vocabularyAddHashed(vocabulary, token, length, hashToken(token, length));
+}
+
+unsigned long vocabularySize(const Vocabulary* vocabulary) {
+	return vocabulary->amountTokens;
+}
+
+/* Size of the hash map and the amount of times it grew, for statistics. */
+void vocabularyTable(const Vocabulary* vocabulary, unsigned long* buckets, unsigned long* resizes) {
+	*buckets	= kh_n_buckets(vocabulary->tokens);
+	*resizes	= vocabulary->resizes;
+}
+
+/*
+Reads a word ID file of another run, e.g. a shard, and adds its tokens in order of their IDs. This keeps the order of
+first occurence when the runs are concatenated. Returns the new ID for every old ID, indexed by the old ID.
+*/
+unsigned long* vocabularyMap(Vocabulary* vocabulary, const char* path, int addOccurence, unsigned long* amount) {
+	FILE* file;
+	Buffer* content;
+	WordIDDesc* descs;
+	WordIDDesc* desc;
+	TokenDesc* tokenDesc;
+	unsigned long* mapping;
+	unsigned long size;
+	unsigned long id;
+	char* line;
+	char* end;
+	char* token;
+	char buffer[65536];
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	content = bufferInit();
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		bufferAdd(content, buffer, size);
+	}
+	bufferAdd(content, "", 1);
+	fclose(file);
+
+	/* Lines are ID, token and document occurence, in no particular order. */
+	*amount	= 0;
+	descs	= NULL;
+	size	= 0;
+	for (line = content->buffer; *line != 0; line = end + 1) {
+		end = strchr(line, '\n');
+		if (end == NULL) {
+			break;
+		}
+		*end = 0;
+
+		id		= strtoul(line, &token, 10);
+		token	= strchr(token, '\t');
+		if (id == 0 || token == NULL || strchr(token + 1, '\t') == NULL) {
+			continue;
+		}
+
+		if (id >= size) {
+			size	= id * 2;
+			descs	= realloc(descs, sizeof(WordIDDesc) * size);
+			memset(descs + *amount + 1, 0, sizeof(WordIDDesc) * (size - *amount - 1));
+		}
+
+		desc				= &descs[id];
+		desc->token			= token + 1;
+		*strchr(desc->token, '\t') = 0;
+		desc->occurence		= strtoul(desc->token + strlen(desc->token) + 1, NULL, 10);
+		if (id > *amount) {
+			*amount = id;
+		}
+	}
+
+	mapping = calloc(*amount + 1, sizeof(unsigned long));
+	for (id = 1; id <= *amount; ++id) {
+		if (descs[id].token == NULL) {
+			continue;
+		}
+
+		tokenDesc = vocabularyAdd(vocabulary, descs[id].token);
+		if (addOccurence) {
+			tokenDesc->occurence += descs[id].occurence;
+		}
+		mapping[id] = tokenDesc->id;
+	}
+
+	free(descs);
+	bufferDestroy(content);
+
+	return mapping;
+}
+
+/* Descending document occurence, ties in order of ID. */
+static int compareOccurence(const void* a, const void* b) {
+	const TokenDesc* d1 = (const TokenDesc*) a;
+	const TokenDesc* d2 = (const TokenDesc*) b;
+
+	if (d1->occurence != d2->occurence) {
+		return d1->occurence > d2->occurence ? -1 : 1;
+	}
+
+	return d1->id < d2->id ? -1 : d1->id > d2->id;
+}
+
+/*
+Drops the tokens with a document occurence outside of minOccurence up to and including maxOccurence and renumbers the
+others in order of descending document occurence, so frequent tokens get small IDs. Only the first keep of them
+remain, unless keep is 0. Dropped tokens stay in the map with ID 0. Returns the new ID for every old ID, indexed by
+the old ID and 0 for dropped tokens, sets amount to the old amount of tokens and occurences to the sum of the
+document occurences of those that remain, which is the amount of entries of a bow of them.
+*/
+unsigned long* vocabularyPrune(Vocabulary* vocabulary, unsigned long minOccurence, unsigned long maxOccurence,
+	unsigned long keep, unsigned long* amount, unsigned long* occurences) {
+	TokenDesc* descs;
+	TokenDesc* desc;
+	unsigned long* mapping;
+	unsigned long kept = 0;
+	unsigned long i;
+	khiter_t bucket;
+
+	descs = malloc(sizeof(TokenDesc) * (vocabulary->amountTokens + 1));
+	for (bucket = kh_begin(vocabulary->tokens); bucket != kh_end(vocabulary->tokens); ++bucket) {
+		if (!kh_exist(vocabulary->tokens, bucket)) {
+			continue;
+		}
+
+		desc = &kh_value(vocabulary->tokens, bucket);
+		if (desc->id != 0 && desc->occurence >= minOccurence && desc->occurence <= maxOccurence) {
+			descs[kept++] = *desc;
+		}
+	}
+
+	qsort(descs, kept, sizeof(TokenDesc), compareOccurence);
+	if (keep > 0 && kept > keep) {
+		kept = keep;
+	}
+
+	mapping		= calloc(vocabulary->amountTokens + 1, sizeof(unsigned long));
+	*occurences	= 0;
+	for (i = 0; i < kept; ++i) {
+		mapping[descs[i].id]	= i + 1;
+		*occurences				+= descs[i].occurence;
+	}
+
+	for (bucket = kh_begin(vocabulary->tokens); bucket != kh_end(vocabulary->tokens); ++bucket) {
+		if (kh_exist(vocabulary->tokens, bucket)) {
+			desc		= &kh_value(vocabulary->tokens, bucket);
+			desc->id	= mapping[desc->id];
+		}
+	}
+
+	*amount						= vocabulary->amountTokens;
+	vocabulary->amountTokens	= kept;
+	free(descs);
+
+	return mapping;
+}
+
+/*
+Takes the document occurence of every token out of the word list, indexed by ID, and starts counting again from 0.
+Sets amount to the amount of tokens.
+*/
+unsigned long* vocabularyResetOccurence(Vocabulary* vocabulary, unsigned long* amount) {
+	unsigned long* occurences;
+	TokenDesc* desc;
+	khiter_t bucket;
+
+	occurences = calloc(vocabulary->amountTokens + 1, sizeof(unsigned long));
+	for (bucket = kh_begin(vocabulary->tokens); bucket != kh_end(vocabulary->tokens); ++bucket) {
+		if (kh_exist(vocabulary->tokens, bucket)) {
+			desc					= &kh_value(vocabulary->tokens, bucket);
+			occurences[desc->id]	= desc->occurence;
+			desc->occurence			= 0;
+		}
+	}
+
+	*amount = vocabulary->amountTokens;
+
+	return occurences;
+}
+
+/* Writes ID, token and document occurence per line, in order of ID. */
+int vocabularyWrite(Vocabulary* vocabulary, Output* wordID) {
+	khiter_t* buckets;
+	khiter_t bucket;
+	TokenDesc* desc;
+	TokenKey* key;
+	unsigned long i;
+
+	/* The order of the buckets depends on the hash, the order of the IDs does not. */
+	buckets = malloc(sizeof(khiter_t) * (vocabulary->amountTokens + 1));
+	for (bucket = kh_begin(vocabulary->tokens); bucket != kh_end(vocabulary->tokens); ++bucket) {
+		/* Pruned tokens all end up at 0, which is not written. */
+		if (kh_exist(vocabulary->tokens, bucket)) {
+			buckets[kh_value(vocabulary->tokens, bucket).id] = bucket;
+		}
+	}
+
+	for (i = 1; i <= vocabulary->amountTokens; ++i) {
+		desc	= &kh_value(vocabulary->tokens, buckets[i]);
+		key		= &kh_key(vocabulary->tokens, buckets[i]);
+
+		outputNumber(wordID, desc->id);
+		outputChar(wordID, '\t');
+		outputWrite(wordID, key->token, key->length);
+		outputChar(wordID, '\t');
+		outputNumber(wordID, desc->occurence);
+		if (outputChar(wordID, '\n') != 0) {
+			free(buckets);
+			return -1;
+		}
+
+		if (i % 10000 == 0) {
+			putchar('.');
+		}
+	}
+
+	free(buckets);
+
+	return 0;
+}
+
+void vocabularyDestroy(Vocabulary* vocabulary) {
+	kh_destroy(Tokens, vocabulary->tokens);
+	arenaDestroy(vocabulary->strings);
+	free(vocabulary);
+}
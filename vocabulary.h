@@ -0,0 +1,34 @@
+/**
+ * vocabulary.h
+ */
+
+#ifndef VOCABULARY_H_
+#define VOCABULARY_H_
+
+#include "output.h"
+#include <stdint.h>
+
+/* Stored in the word list itself, the token is the key. */
+typedef struct {
+	unsigned long id;
+	/* Document occurence. */
+	unsigned long occurence;
+} TokenDesc;
+
+typedef struct Vocabulary Vocabulary;
+
+Vocabulary*		vocabularyInit();
+TokenDesc*		vocabularyFindHashed(Vocabulary* vocabulary, const char* token, unsigned int length, uint64_t hash);
+TokenDesc*		vocabularyAdd(Vocabulary* vocabulary, const char* token);
+TokenDesc*		vocabularyAddHashed(Vocabulary* vocabulary, const char* token, unsigned int length, uint64_t hash);
+unsigned long	vocabularySize(const Vocabulary* vocabulary);
+void			vocabularyTable(const Vocabulary* vocabulary, unsigned long* buckets, unsigned long* resizes);
+unsigned long*	vocabularyMap(Vocabulary* vocabulary, const char* path, int addOccurence, unsigned long* amount);
+unsigned long*	vocabularyPrune(Vocabulary* vocabulary, unsigned long minOccurence, unsigned long maxOccurence,
+					unsigned long keep, unsigned long* amount, unsigned long* occurences);
+unsigned long*	vocabularyResetOccurence(Vocabulary* vocabulary, unsigned long* amount);
+int				vocabularyWrite(Vocabulary* vocabulary, Output* wordID);
+void			vocabularyDestroy(Vocabulary* vocabulary);
+
+
+#endif /* VOCABULARY_H_ */
@@ -0,0 +1,600 @@
+/**
+ * xmlscan.c
+ *
+ * Finds the few elements the tokenizer needs directly in the decompressed dump. A page is scanned in place when it
+ * lies within one chunk of data, otherwise its bytes are collected until its end tag comes by. The events of a page
+ * are only reported once the whole page has been understood, so that a page can still be handed to expat.
+ */
+
+#include "xmlscan.h"
+#include "buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XMLSCAN_X86
+#include <immintrin.h>
+#endif
+
+#define PAGE_START "<page>"
+#define PAGE_START_LENGTH 6
+#define PAGE_END "</page>"
+#define PAGE_END_LENGTH 7
+
+/* Longest entity reference that is decoded, from & up to and including ;. */
+#define ENTITY_MAX 12
+
+#define ELEMENT_PAGE 0
+#define ELEMENT_TITLE 1
+#define ELEMENT_REDIRECT 2
+#define ELEMENT_TEXT 3
+#define ELEMENTS 4
+
+#define EVENT_START 0
+#define EVENT_END 1
+#define EVENT_CHARACTERS 2
+/* Character data with entity references in it. */
+#define EVENT_ENTITIES 3
+
+#define PAGE_DONE 0
+#define PAGE_INCOMPLETE 1
+#define PAGE_UNEXPECTED 2
+
+typedef struct {
+	int kind;
+	int element;
+	const char* begin;
+	const char* end;
+} XmlEvent;
+
+struct XmlScanner {
+	void* data;
+	XML_StartElementHandler start;
+	XML_EndElementHandler end;
+	XML_CharacterDataHandler characters;
+
+	/* Returns the first <, & or carriage return from text on, or end. */
+	const char* (*findSpecial)(const char* text, const char* end);
+
+	/* A page that did not end in the data it started in, or what might be the start of one. */
+	Buffer* pending;
+	/* The events of the page being scanned. */
+	Buffer* events;
+
+	/* Created on the first page that is not understood. */
+	XML_Parser parser;
+	unsigned long fallbacks;
+};
+
+static const char* elements[ELEMENTS] = { "page", "title", "redirect", "text" };
+static const XML_Char* noAttributes[] = { NULL };
+
+static const char* findSpecialScalar(const char* text, const char* end) {
+	for (; text < end; ++text) {
+		if (*text == '<' || *text == '&' || *text == '\r') {
+			return text;
+		}
+	}
+
+	return end;
+}
+
+#ifdef XMLSCAN_X86
+
+__attribute__((target("sse2")))
+static const char* findSpecialSSE2(const char* text, const char* end) {
+	__m128i bytes;
+	unsigned int bits;
+
+	for (; end - text >= 16; text += 16) {
+		bytes	= _mm_loadu_si128((const __m128i*) text);
+		bits	= _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('<')),
+			_mm_cmpeq_epi8(bytes, _mm_set1_epi8('&'))), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+		if (bits != 0) {
+			return text + __builtin_ctz(bits);
+		}
+	}
+
+	return findSpecialScalar(text, end);
+}
+
+__attribute__((target("avx2")))
+static const char* findSpecialAVX2(const char* text, const char* end) {
+	__m256i bytes;
+	unsigned int bits;
+
+	for (; end - text >= 32; text += 32) {
+		bytes	= _mm256_loadu_si256((const __m256i*) text);
+		bits	= _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes,
+			_mm256_set1_epi8('<')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('&'))), _mm256_cmpeq_epi8(bytes,
+			_mm256_set1_epi8('\r'))));
+		if (bits != 0) {
+			return text + __builtin_ctz(bits);
+		}
+	}
+
+	return findSpecialScalar(text, end);
+}
+
+#endif /* XMLSCAN_X86 */
+
+/* Returns the start of the first occurence of tag from text on, or NULL. */
+static const char* findTag(const char* text, const char* end, const char* tag, unsigned long length) {
+	while ((text = memchr(text, '<', end - text)) != NULL) {
+		if ((unsigned long) (end - text) < length) {
+			return NULL;
+		}
+
+		if (memcmp(text, tag, length) == 0) {
+			return text;
+		}
+
+		++text;
+	}
+
+	return NULL;
+}
+
+/* Returns the > that closes the tag whose name starts at text, or NULL if it is not in the data. */
+static const char* findTagEnd(const char* text, const char* end) {
+	char quote = 0;
+
+	for (; text < end; ++text) {
+		if (quote != 0) {
+			if (*text == quote) {
+				quote = 0;
+			}
+		}
+		else if (*text == '"' || *text == '\'') {
+			quote = *text;
+		}
+		else if (*text == '>') {
+			return text;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns which of the reported elements the name starting at text is, or -1. */
+static int findElement(const char* text, const char* close) {
+	const char* name = text;
+	int i;
+
+	while (text < close && *text != ' ' && *text != '\t' && *text != '\n' && *text != '\r' && *text != '/') {
+		++text;
+	}
+
+	for (i = 0; i < ELEMENTS; ++i) {
+		if (strlen(elements[i]) == (unsigned long) (text - name) && memcmp(elements[i], name, text - name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+Decodes the entity reference at text, i.e. one of the predefined entities or a character reference, as UTF-8 into
+decoded and points next past it. Returns the amount of bytes decoded, 0 if the data ends within the reference or -1
+if it is anything else.
+*/
+static int decodeEntity(const char* text, const char* end, char* decoded, const char** next) {
+	static const char* names[] = { "lt", "gt", "amp", "quot", "apos" };
+	static const char characters[] = { '<', '>', '&', '"', '\'' };
+	unsigned long available = end - text;
+	unsigned long length, code, digit;
+	const char* semicolon;
+	int hex, i;
+
+	semicolon = memchr(text, ';', available < ENTITY_MAX ? available : ENTITY_MAX);
+	if (semicolon == NULL) {
+		return available < ENTITY_MAX ? 0 : -1;
+	}
+
+	*next	= semicolon + 1;
+	length	= semicolon - ++text;
+
+	for (i = 0; i < 5; ++i) {
+		if (strlen(names[i]) == length && memcmp(names[i], text, length) == 0) {
+			decoded[0] = characters[i];
+			return 1;
+		}
+	}
+
+	if (length < 2 || *text++ != '#') {
+		return -1;
+	}
+
+	hex = *text == 'x';
+	text += hex;
+	if (text == semicolon) {
+		return -1;
+	}
+
+	for (code = 0; text < semicolon; ++text) {
+		if (*text >= '0' && *text <= '9') {
+			digit = *text - '0';
+		}
+		else if (hex && (*text | 0x20) >= 'a' && (*text | 0x20) <= 'f') {
+			digit = (*text | 0x20) - 'a' + 10;
+		}
+		else {
+			return -1;
+		}
+
+		code = code * (hex ? 16 : 10) + digit;
+		if (code > 0x10ffff) {
+			return -1;
+		}
+	}
+
+	/* Only characters XML allows, expat rejects the others. */
+	if (code < 0x20 && code != '\t' && code != '\n' && code != '\r') {
+		return -1;
+	}
+	else if ((code >= 0xd800 && code < 0xe000) || code == 0xfffe || code == 0xffff) {
+		return -1;
+	}
+
+	if (code < 0x80) {
+		decoded[0] = code;
+		return 1;
+	}
+	else if (code < 0x800) {
+		decoded[0] = 0xc0 | (code >> 6);
+		decoded[1] = 0x80 | (code & 0x3f);
+		return 2;
+	}
+	else if (code < 0x10000) {
+		decoded[0] = 0xe0 | (code >> 12);
+		decoded[1] = 0x80 | ((code >> 6) & 0x3f);
+		decoded[2] = 0x80 | (code & 0x3f);
+		return 3;
+	}
+
+	decoded[0] = 0xf0 | (code >> 18);
+	decoded[1] = 0x80 | ((code >> 12) & 0x3f);
+	decoded[2] = 0x80 | ((code >> 6) & 0x3f);
+	decoded[3] = 0x80 | (code & 0x3f);
+	return 4;
+}
+
+static void addEvent(XmlScanner* scanner, int kind, int element, const char* begin, const char* end) {
+	XmlEvent event;
+
+	event.kind		= kind;
+	event.element	= element;
+	event.begin		= begin;
+	event.end		= end;
+	bufferAdd(scanner->events, (const char*) &event, sizeof(XmlEvent));
+}
+
+/*
+Collects the events of the page whose start tag ends at text. On success, pageEnd is set to the byte after its end
+tag. The character data of <title> and <text> has to be plain text up to its end tag.
+*/
+static int scanPage(XmlScanner* scanner, const char* text, const char* end, const char** pageEnd) {
+	const char* close;
+	const char* content;
+	const char* next;
+	char decoded[4];
+	int element, length, entities;
+	int closing = -1;
+
+	bufferReset(scanner->events);
+	addEvent(scanner, EVENT_START, ELEMENT_PAGE, NULL, NULL);
+
+	while (1) {
+		text = memchr(text, '<', end - text);
+		if (text == NULL) {
+			return PAGE_INCOMPLETE;
+		}
+
+		close = findTagEnd(text + 1, end);
+		if (close == NULL) {
+			return PAGE_INCOMPLETE;
+		}
+
+		/* Comments, CDATA sections, processing instructions and the like. */
+		if (text[1] == '!' || text[1] == '?') {
+			return PAGE_UNEXPECTED;
+		}
+
+		if (text[1] == '/') {
+			element = findElement(text + 2, close);
+			if (closing >= 0 && element != closing) {
+				return PAGE_UNEXPECTED;
+			}
+
+			if (element >= 0) {
+				addEvent(scanner, EVENT_END, element, NULL, NULL);
+			}
+
+			closing	= -1;
+			text	= close + 1;
+
+			if (element == ELEMENT_PAGE) {
+				*pageEnd = text;
+				return PAGE_DONE;
+			}
+
+			continue;
+		}
+
+		element	= findElement(text + 1, close);
+		text	= close + 1;
+		if (element < 0) {
+			continue;
+		}
+		else if (element == ELEMENT_PAGE) {
+			return PAGE_UNEXPECTED;
+		}
+
+		addEvent(scanner, EVENT_START, element, NULL, NULL);
+		if (*(close - 1) == '/') {
+			addEvent(scanner, EVENT_END, element, NULL, NULL);
+			continue;
+		}
+		else if (element == ELEMENT_REDIRECT) {
+			continue;
+		}
+
+		/* The content runs up to the next <, which has to be the end tag. */
+		content		= text;
+		entities	= 0;
+		while ((text = scanner->findSpecial(text, end)) < end && *text == '&') {
+			length = decodeEntity(text, end, decoded, &next);
+			if (length <= 0) {
+				return length == 0 ? PAGE_INCOMPLETE : PAGE_UNEXPECTED;
+			}
+
+			entities	= 1;
+			text		= next;
+		}
+
+		if (end - text < 2) {
+			return PAGE_INCOMPLETE;
+		}
+		else if (*text == '\r' || text[1] != '/') {
+			return PAGE_UNEXPECTED;
+		}
+
+		if (text > content) {
+			addEvent(scanner, entities ? EVENT_ENTITIES : EVENT_CHARACTERS, element, content, text);
+		}
+		closing = element;
+	}
+}
+
+/* Reports character data, entity references are decoded on the way. */
+static void reportEntities(XmlScanner* scanner, const char* text, const char* end) {
+	const char* entity;
+	char decoded[4];
+	int length;
+
+	while (text < end) {
+		entity = memchr(text, '&', end - text);
+		if (entity == NULL) {
+			scanner->characters(scanner->data, text, end - text);
+			return;
+		}
+
+		if (entity > text) {
+			scanner->characters(scanner->data, text, entity - text);
+		}
+
+		length = decodeEntity(entity, end, decoded, &text);
+		scanner->characters(scanner->data, decoded, length);
+	}
+}
+
+/* Reports the events collected by scanPage. */
+static void report(XmlScanner* scanner) {
+	XmlEvent* events = (XmlEvent*) scanner->events->buffer;
+	unsigned long amount = scanner->events->currentsize / sizeof(XmlEvent);
+	unsigned long i;
+
+	for (i = 0; i < amount; ++i) {
+		switch (events[i].kind) {
+			case EVENT_START:
+				scanner->start(scanner->data, elements[events[i].element], noAttributes);
+				break;
+			case EVENT_END:
+				scanner->end(scanner->data, elements[events[i].element]);
+				break;
+			case EVENT_CHARACTERS:
+				scanner->characters(scanner->data, events[i].begin, events[i].end - events[i].begin);
+				break;
+			case EVENT_ENTITIES:
+				reportEntities(scanner, events[i].begin, events[i].end);
+				break;
+		}
+	}
+}
+
+/* Has expat parse a single page, as if it were the only one in the dump. */
+static int fallback(XmlScanner* scanner, const char* page, unsigned long size) {
+	if (scanner->parser == NULL) {
+		scanner->parser = XML_ParserCreate("UTF-8");
+		if (scanner->parser == NULL) {
+			return -1;
+		}
+	}
+	else {
+		XML_ParserReset(scanner->parser, "UTF-8");
+	}
+
+	XML_SetUserData(scanner->parser, scanner->data);
+	XML_SetElementHandler(scanner->parser, scanner->start, scanner->end);
+	XML_SetCharacterDataHandler(scanner->parser, scanner->characters);
+	++scanner->fallbacks;
+
+	if (!XML_Parse(scanner->parser, "<mediawiki>", 11, 0) || !XML_Parse(scanner->parser, page, size, 0) ||
+		!XML_Parse(scanner->parser, "</mediawiki>", 12, 1)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns the byte after </page> if the tag is split between the pending bytes and text, or NULL. */
+static const char* findSplitPageEnd(const Buffer* pending, const char* text, const char* end) {
+	unsigned long i;
+
+	for (i = 1; i < PAGE_END_LENGTH; ++i) {
+		if (pending->currentsize >= i && (unsigned long) (end - text) >= PAGE_END_LENGTH - i &&
+			memcmp(pending->buffer + pending->currentsize - i, PAGE_END, i) == 0 &&
+			memcmp(text, PAGE_END + i, PAGE_END_LENGTH - i) == 0) {
+			return text + PAGE_END_LENGTH - i;
+		}
+	}
+
+	return NULL;
+}
+
+XmlScanner* xmlScannerInit(void* data, XML_StartElementHandler start, XML_EndElementHandler end,
+	XML_CharacterDataHandler characters, int vectorized) {
+	XmlScanner* scanner;
+
+	scanner					= malloc(sizeof(XmlScanner));
+	scanner->data			= data;
+	scanner->start			= start;
+	scanner->end			= end;
+	scanner->characters		= characters;
+	scanner->findSpecial	= findSpecialScalar;
+	scanner->pending		= bufferInit();
+	scanner->events			= bufferInit();
+	scanner->parser			= NULL;
+	scanner->fallbacks		= 0;
+
+#ifdef XMLSCAN_X86
+	if (vectorized) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			scanner->findSpecial = findSpecialAVX2;
+		}
+		else if (__builtin_cpu_supports("sse2")) {
+			scanner->findSpecial = findSpecialSSE2;
+		}
+	}
+#endif
+
+	return scanner;
+}
+
+/* Scans the next chunk of the dump. Returns -1 if expat gave up on a page. */
+int xmlScannerParse(XmlScanner* scanner, const char* data, unsigned long size) {
+	Buffer* pending = scanner->pending;
+	const char* end = data + size;
+	const char* text = data;
+	const char* page;
+	const char* pageEnd;
+	unsigned long missing;
+	int result;
+
+	if (size == 0) {
+		return 0;
+	}
+
+	/* The previous chunk ended in something that might be <page>. */
+	if (pending->currentsize > 0 && pending->currentsize < PAGE_START_LENGTH) {
+		missing = PAGE_START_LENGTH - pending->currentsize;
+		missing = missing < size ? missing : size;
+		bufferAdd(pending, data, missing);
+		if (pending->currentsize < PAGE_START_LENGTH) {
+			return 0;
+		}
+
+		if (memcmp(pending->buffer, PAGE_START, PAGE_START_LENGTH) == 0) {
+			text += missing;
+		}
+		else {
+			bufferReset(pending);
+		}
+	}
+
+	/* Finish the page that started in an earlier chunk. */
+	if (pending->currentsize > 0) {
+		page = findSplitPageEnd(pending, text, end);
+		if (page == NULL && (page = findTag(text, end, PAGE_END, PAGE_END_LENGTH)) != NULL) {
+			page += PAGE_END_LENGTH;
+		}
+
+		if (page == NULL) {
+			bufferAdd(pending, text, end - text);
+			return 0;
+		}
+
+		bufferAdd(pending, text, page - text);
+		text = page;
+
+		if (scanPage(scanner, pending->buffer + PAGE_START_LENGTH, pending->buffer + pending->currentsize,
+			&pageEnd) == PAGE_DONE) {
+			report(scanner);
+		}
+		else if (fallback(scanner, pending->buffer, pending->currentsize) != 0) {
+			return -1;
+		}
+
+		bufferReset(pending);
+	}
+
+	while ((page = memchr(text, '<', end - text)) != NULL) {
+		if (end - page < PAGE_START_LENGTH) {
+			bufferAdd(pending, page, end - page);
+			return 0;
+		}
+		else if (memcmp(page, PAGE_START, PAGE_START_LENGTH) != 0) {
+			text = page + 1;
+			continue;
+		}
+
+		result = scanPage(scanner, page + PAGE_START_LENGTH, end, &pageEnd);
+		if (result == PAGE_UNEXPECTED) {
+			pageEnd = findTag(page, end, PAGE_END, PAGE_END_LENGTH);
+			if (pageEnd == NULL) {
+				result = PAGE_INCOMPLETE;
+			}
+			else {
+				pageEnd += PAGE_END_LENGTH;
+				if (fallback(scanner, page, pageEnd - page) != 0) {
+					return -1;
+				}
+			}
+		}
+		else if (result == PAGE_DONE) {
+			report(scanner);
+		}
+
+		/* Scanned again once its end has been found. */
+		if (result == PAGE_INCOMPLETE) {
+			bufferAdd(pending, page, end - page);
+			return 0;
+		}
+
+		text = pageEnd;
+	}
+
+	return 0;
+}
+
+/* Returns -1 if the dump ended within a page. */
+int xmlScannerFinish(XmlScanner* scanner) {
+	return scanner->pending->currentsize >= PAGE_START_LENGTH ? -1 : 0;
+}
+
+/* The amount of pages that were parsed by expat. */
+unsigned long xmlScannerFallbacks(const XmlScanner* scanner) {
+	return scanner->fallbacks;
+}
+
+void xmlScannerDestroy(XmlScanner* scanner) {
+	if (scanner->parser != NULL) {
+		XML_ParserFree(scanner->parser);
+	}
+
+	bufferDestroy(scanner->pending);
+	bufferDestroy(scanner->events);
+	free(scanner);
+}
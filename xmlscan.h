@@ -0,0 +1,25 @@
+/**
+ * xmlscan.h
+ */
+
+#ifndef XMLSCAN_H_
+#define XMLSCAN_H_
+
+#include <expat.h>
+
+/*
+Streaming scanner for MediaWiki export XML, an alternative to expat for the tokenizer. It only reports <page>, <title>,
+<redirect> and <text>, and the character data of <title> and <text>, to the same handlers as expat would. Pages it
+does not understand, e.g. because of CDATA sections, comments or unknown entities, are handed to expat instead.
+*/
+typedef struct XmlScanner XmlScanner;
+
+XmlScanner*		xmlScannerInit(void* data, XML_StartElementHandler start, XML_EndElementHandler end,
+					XML_CharacterDataHandler characters, int vectorized);
+int				xmlScannerParse(XmlScanner* scanner, const char* data, unsigned long size);
+int				xmlScannerFinish(XmlScanner* scanner);
+unsigned long	xmlScannerFallbacks(const XmlScanner* scanner);
+void			xmlScannerDestroy(XmlScanner* scanner);
+
+
+#endif /* XMLSCAN_H_ */